@@ -0,0 +1,100 @@
+/**
+ * Bank benchmark
+ * The update operations transfer a random amount between two random
+ * accounts, all other operations sum up all accounts in one (long,
+ * read-only) transaction. Every total must be the same, a different
+ * total means that a transaction saw an inconsistent snapshot.
+ * The key range (-r) is the number of accounts.
+ *
+ * usage: bank [-t threads] [-d milliseconds] [-r accounts] [-u transfer percent] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+
+#define INITIAL_BALANCE 1000
+
+static long *accounts;
+static long nr_accounts;
+static volatile int bad_total;				/* some transaction saw a wrong total */
+
+static void bank_init(stm_tx_t *tx, bench_params_t *p)
+{
+    long i;
+
+    nr_accounts = p->range;
+    accounts = (long*)malloc(nr_accounts*sizeof(long));
+    if (accounts==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    for (i=0; i<nr_accounts; i++) accounts[i] = INITIAL_BALANCE;
+}
+
+static void bank_transfer(stm_tx_t *tx, long from, long to, long amount)
+{
+    STM_BEGIN();
+    STM_WRITE(accounts[from], (long)STM_READ(accounts[from]) - amount);
+    STM_WRITE(accounts[to], (long)STM_READ(accounts[to]) + amount);
+    STM_END();
+}
+
+static long bank_total(stm_tx_t *tx)
+{
+    long i, total;
+
+    STM_BEGIN_RO();
+    total = 0;
+    for (i=0; i<nr_accounts; i++) total += (long)STM_READ(accounts[i]);
+    STM_END();
+    return total;
+}
+
+static void bank_op(stm_tx_t *tx, bench_thread_t *t, bench_params_t *p)
+{
+    long from, to;
+
+    if (bench_rand(t, 100) < p->update) {
+	from = bench_rand(t, nr_accounts);
+	to = bench_rand(t, nr_accounts);
+	if (from==to) return;
+	bank_transfer(tx, from, to, 1 + bench_rand(t, 10));
+	t->updates++;
+    } else {
+	if (bank_total(tx)!=nr_accounts*INITIAL_BALANCE) bad_total = 1;
+    }
+}
+
+static int bank_check(bench_params_t *p, long size)
+{
+    long i, total = 0;
+
+    for (i=0; i<nr_accounts; i++) total += accounts[i];
+    return !bad_total && total==nr_accounts*INITIAL_BALANCE;
+}
+
+static const bench_ops_t bank_ops = {
+    "bank", bank_init, bank_op, NULL, NULL, NULL, bank_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &bank_ops);
+}
@@ -0,0 +1,233 @@
+/**
+ * Throughput harness of the microbenchmarks (intset-ll, intset-rb,
+ * intset-hs, intset-sl, bank, range and subword)
+ * Starts the threads, runs the operations of a benchmark for a fixed
+ * time, checks the data structure afterwards and prints one line of
+ * key=value pairs: throughput, abort ratio (total and per cause) and
+ * the adaptation decisions of the STM (stm_get_stats).
+ *
+ * usage: <bench> [-t threads] [-d milliseconds] [-r key range] [-u update percent]
+ *                [-i initial size] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "stm.h"
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "default"
+#endif
+
+typedef struct bench_params {
+    int threads;
+    int duration;					/* ms */
+    long range;						/* keys (intsets), accounts (bank), records (range) or words (subword) */
+    int update;						/* percent of the operations that write */
+    long initial;					/* initial size of the set, -1: range/2 */
+    unsigned int seed;
+} bench_params_t;
+
+typedef struct bench_thread {
+    long id;
+    unsigned int seed;
+    unsigned long ops;
+    unsigned long updates;				/* operations that changed the structure */
+    long delta;						/* net change of the set size */
+    int last_added;					/* intsets: remove next to keep the size */
+} __attribute__((aligned(64))) bench_thread_t;
+
+/* A benchmark either implements op (bank) or the three set
+ * operations, which then run with the update ratio (an add that
+ * succeeded is followed by a remove, so the size stays the same). */
+typedef struct bench_ops {
+    const char *name;
+    void (*init)(stm_tx_t *tx, bench_params_t *p);	/* allocates, called before init adds */
+    void (*op)(stm_tx_t *tx, bench_thread_t *t, bench_params_t *p);
+    int (*contains)(stm_tx_t *tx, long key);
+    int (*add)(stm_tx_t *tx, long key);
+    int (*remove)(stm_tx_t *tx, long key);
+    int (*check)(bench_params_t *p, long size);	/* size: expected number of keys */
+} bench_ops_t;
+
+static const bench_ops_t *bench;
+static bench_params_t bench_params;
+static volatile int bench_stop;
+
+static inline long bench_rand(bench_thread_t *t, long range)
+{
+    return rand_r(&t->seed) % range;
+}
+
+static void bench_intset_op(stm_tx_t *tx, bench_thread_t *t, bench_params_t *p)
+{
+    long key = bench_rand(t, p->range);
+
+    if (bench_rand(t, 100) < p->update) {
+	if (!t->last_added) {
+	    if (bench->add(tx, key)) {
+		t->updates++;
+		t->delta++;
+		t->last_added = 1;
+	    }
+	} else {
+	    if (bench->remove(tx, key)) {
+		t->updates++;
+		t->delta--;
+		t->last_added = 0;
+	    }
+	}
+    } else {
+	bench->contains(tx, key);
+    }
+}
+
+static void *bench_worker(void *arg)
+{
+    bench_thread_t *t = (bench_thread_t*)arg;
+    stm_tx_t *tx = stm_new();
+
+    while (!bench_stop) {
+	if (bench->op!=NULL)
+	    bench->op(tx, t, &bench_params);
+	else
+	    bench_intset_op(tx, t, &bench_params);
+	t->ops++;
+    }
+    stm_delete(tx);
+    return NULL;
+}
+
+/* the result line, the counters are the differences of before and after */
+static void bench_report(const char *name, bench_params_t *p, unsigned long ops, unsigned long updates,
+			 double secs, stm_stats_t *before, stm_stats_t *after, int valid)
+{
+    unsigned long commits, aborts;
+    int i;
+
+    commits = after->commits - before->commits;
+    aborts = after->aborts - before->aborts;
+    printf("bench=%s variant=%s threads=%d duration_ms=%d range=%ld update=%d initial=%ld "
+	   "ops=%lu ops_per_s=%.1f updates=%lu commits=%lu aborts=%lu abort_ratio=%.4f",
+	   name, BENCH_VARIANT, p->threads, p->duration, p->range, p->update, p->initial,
+	   ops, ops/secs, updates, commits, aborts, (commits+aborts) ? (double)aborts/(commits+aborts) : 0.0);
+    for (i=0; i<STM_ABORT_REASONS; i++)
+	printf(" aborts_%s=%lu", stm_abort_reason_name(i), after->aborts_by[i] - before->aborts_by[i]);
+    printf(" ro_commits=%lu validations=%lu extensions=%lu lock_waits=%lu wt_switches=%lu hash_switches=%lu "
+	   "lock_mode_switches=%lu max_reads=%lu max_writes=%lu valid=%d\n",
+	   after->ro_commits - before->ro_commits, after->validations - before->validations,
+	   after->extensions - before->extensions, after->lock_waits - before->lock_waits,
+	   after->wt_switches - before->wt_switches, after->hash_switches - before->hash_switches,
+	   after->lock_mode_switches - before->lock_mode_switches, after->max_reads, after->max_writes, valid);
+}
+
+static int bench_main(int argc, char **argv, const bench_ops_t *b)
+{
+    bench_params_t *p = &bench_params;
+    bench_thread_t *data;
+    pthread_t *threads;
+    stm_stats_t before, after;
+    struct timeval start, end;
+    unsigned long ops = 0, updates = 0;
+    long size, delta = 0;
+    stm_tx_t *tx;
+    double secs;
+    int opt, i, valid;
+
+    bench = b;
+    p->threads = 4;
+    p->duration = 2000;
+    p->range = 1024;
+    p->update = 20;
+    p->initial = -1;
+    p->seed = 1;
+    while ((opt = getopt(argc, argv, "t:d:r:u:i:s:"))!=-1) {
+	switch (opt) {
+	case 't': p->threads = atoi(optarg); break;
+	case 'd': p->duration = atoi(optarg); break;
+	case 'r': p->range = atol(optarg); break;
+	case 'u': p->update = atoi(optarg); break;
+	case 'i': p->initial = atol(optarg); break;
+	case 's': p->seed = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-t threads] [-d milliseconds] [-r key range] [-u update percent] "
+		    "[-i initial size] [-s seed]\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (p->threads<1) p->threads = 1;
+    if (p->range<2) p->range = 2;
+    if (p->initial<0 || p->initial>p->range) p->initial = p->range/2;
+
+    if (posix_memalign((void**)&data, 64, p->threads*sizeof(bench_thread_t))!=0) {
+	perror("malloc");
+	exit(1);
+    }
+    threads = (pthread_t*)malloc(p->threads*sizeof(pthread_t));
+
+    STM_STARTUP();
+    /* fill the structure with distinct random keys */
+    tx = stm_new();
+    bench->init(tx, p);
+    if (bench->add!=NULL) {
+	unsigned int seed = p->seed;
+	for (size=0; size<p->initial; ) {
+	    if (bench->add(tx, rand_r(&seed) % p->range)) size++;
+	}
+    }
+    stm_delete(tx);
+    stm_get_stats(NULL, &before);
+
+    gettimeofday(&start, NULL);
+    for (i=0; i<p->threads; i++) {
+	memset(&data[i], 0x0, sizeof(bench_thread_t));
+	data[i].id = i;
+	data[i].seed = p->seed + i + 1;
+	pthread_create(&threads[i], NULL, bench_worker, &data[i]);
+    }
+    usleep(p->duration*1000);
+    bench_stop = 1;
+    for (i=0; i<p->threads; i++) {
+	pthread_join(threads[i], NULL);
+	ops += data[i].ops;
+	updates += data[i].updates;
+	delta += data[i].delta;
+    }
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec-start.tv_sec) + (end.tv_usec-start.tv_usec)/1e6;
+    stm_get_stats(NULL, &after);
+    valid = bench->check(p, p->initial + delta);
+
+    bench_report(bench->name, p, ops, updates, secs, &before, &after, valid);
+
+    STM_SHUTDOWN();
+    free(threads);
+    free(data);
+    return valid ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * Lock table false sharing benchmark
+ * Every thread updates its own word, the words are one cache line apart
+ * (so the data is not shared) but their locks are neighbours in the
+ * lock table. Build it with the default layout (falseshare), with
+ * scattered lock indices (falseshare-scatter) and with the hot lock
+ * side table (falseshare-hot) to compare the L1D misses per transaction
+ * (coherence traffic on the lock lines) and the throughput.
+ *
+ * usage: falseshare [-t threads] [-s stride in bytes] [-w writes/tx] [-d seconds]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stm.h"
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "default"
+#endif
+
+static volatile int stop;
+static stm_word_t *slots;
+static int stride = 64;
+static int nr_writes = 1;
+
+typedef struct thread_data {
+    long id;
+    unsigned long nr_tx;
+    char padding[64-2*sizeof(unsigned long)];
+} thread_data_t;
+
+static void *worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t*)arg;
+    stm_word_t *slot = slots + data->id*(stride/sizeof(stm_word_t));
+    unsigned long nr_tx = 0;
+    stm_tx_t *tx = stm_new();
+    int i;
+
+    while (!stop) {
+	STM_BEGIN();
+	for (i=0; i<nr_writes; i++) {
+	    stm_word_t value = STM_READ(*slot);
+	    STM_WRITE(*slot, value+1);
+	}
+	STM_END();
+	nr_tx++;
+    }
+    stm_delete(tx);
+    data->nr_tx = nr_tx;
+    return NULL;
+}
+
+/* counts L1D load misses of this process (and of threads started later) */
+static int miss_counter_open()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0x0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(int argc, char **argv)
+{
+    int nr_threads = 4, duration = 5, opt, i, counter;
+    long long misses = -1;
+    unsigned long nr_tx = 0;
+    struct timeval start, end;
+    pthread_t *threads;
+    thread_data_t *data;
+    double secs;
+
+    while ((opt = getopt(argc, argv, "t:s:w:d:")) != -1) {
+	switch (opt) {
+	case 't': nr_threads = atoi(optarg); break;
+	case 's': stride = atoi(optarg); break;
+	case 'w': nr_writes = atoi(optarg); break;
+	case 'd': duration = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-t threads] [-s stride in bytes] [-w writes/tx] [-d seconds]\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (stride<(int)sizeof(stm_word_t)) stride = sizeof(stm_word_t);
+
+    if (posix_memalign((void**)&slots, 64, (size_t)nr_threads*stride)!=0 ||
+	posix_memalign((void**)&data, 64, nr_threads*sizeof(thread_data_t))!=0) {
+	perror("malloc");
+	exit(1);
+    }
+    memset(slots, 0x0, (size_t)nr_threads*stride);
+    threads = (pthread_t*)malloc(nr_threads*sizeof(pthread_t));
+
+    STM_STARTUP();
+    counter = miss_counter_open();
+    if (counter>=0) ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    gettimeofday(&start, NULL);
+    for (i=0; i<nr_threads; i++) {
+	data[i].id = i;
+	data[i].nr_tx = 0;
+	pthread_create(&threads[i], NULL, worker, &data[i]);
+    }
+    sleep(duration);
+    stop = 1;
+    for (i=0; i<nr_threads; i++) {
+	pthread_join(threads[i], NULL);
+	nr_tx += data[i].nr_tx;
+    }
+    gettimeofday(&end, NULL);
+    if (counter>=0) {
+	ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(counter, &misses, sizeof(misses))!=sizeof(misses)) misses = -1;
+	close(counter);
+    }
+    secs = (end.tv_sec-start.tv_sec) + (end.tv_usec-start.tv_usec)/1e6;
+
+    printf("bench=falseshare variant=%s threads=%d stride=%d writes_per_tx=%d txs=%lu tx_per_s=%.1f "
+	   "l1d_misses_per_tx=%.3f\n",
+	   BENCH_VARIANT, nr_threads, stride, nr_writes, nr_tx, nr_tx/secs,
+	   (misses<0 || nr_tx==0) ? -1.0 : (double)misses/nr_tx);
+
+    STM_SHUTDOWN();
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * Integer set as a hash set
+ * A fixed array of buckets with short sorted chains (range/8 buckets,
+ * four keys per bucket at the default initial size). The transactions
+ * are tiny and rarely conflict, this measures the fixed costs of a
+ * transaction (start, commit, hash lookups).
+ *
+ * usage: intset-hs [-t threads] [-d milliseconds] [-r key range] [-u update percent]
+ *                  [-i initial size] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+
+typedef struct node {
+    long key;
+    struct node *next;
+} node_t;
+
+static node_t **buckets;
+static long nr_buckets;
+
+/* the link that points to the first node with a key >= key (or to NULL) */
+static node_t **find(stm_tx_t *tx, long key, node_t **found)
+{
+    node_t **link = &buckets[key % nr_buckets], *n;
+
+    while ((n = (node_t*)STM_READ_P(*link))!=NULL && (long)STM_READ(n->key)<key) link = &n->next;
+    *found = (n!=NULL && (long)STM_READ(n->key)==key) ? n : NULL;
+    return link;
+}
+
+static void hs_init(stm_tx_t *tx, bench_params_t *p)
+{
+    nr_buckets = (p->range>=8) ? p->range/8 : 1;
+    buckets = (node_t**)calloc(nr_buckets, sizeof(node_t*));
+    if (buckets==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+}
+
+static int hs_contains(stm_tx_t *tx, long key)
+{
+    node_t *n;
+
+    STM_BEGIN();
+    find(tx, key, &n);
+    STM_END();
+    return n!=NULL;
+}
+
+static int hs_add(stm_tx_t *tx, long key)
+{
+    node_t **link, *n, *new;
+
+    STM_BEGIN();
+    link = find(tx, key, &n);
+    if (n==NULL) {
+	new = (node_t*)STM_MALLOC(sizeof(node_t));
+	STM_WRITE(new->key, key);
+	STM_WRITE_P(new->next, STM_READ_P(*link));
+	STM_WRITE_P(*link, new);
+    }
+    STM_END();
+    return n==NULL;
+}
+
+static int hs_remove(stm_tx_t *tx, long key)
+{
+    node_t **link, *n;
+
+    STM_BEGIN();
+    link = find(tx, key, &n);
+    if (n!=NULL) {
+	STM_WRITE_P(*link, STM_READ_P(n->next));
+	STM_FREE(n);
+    }
+    STM_END();
+    return n!=NULL;
+}
+
+/* every chain sorted and in its bucket, the expected number of keys */
+static int hs_check(bench_params_t *p, long size)
+{
+    node_t *n;
+    long i, nr = 0;
+
+    for (i=0; i<nr_buckets; i++) {
+	for (n = buckets[i]; n!=NULL; n = n->next) {
+	    if (n->key % nr_buckets!=i || (n->next!=NULL && n->key>=n->next->key)) return 0;
+	    nr++;
+	}
+    }
+    return nr==size;
+}
+
+static const bench_ops_t hs_ops = {
+    "intset-hs", hs_init, NULL, hs_contains, hs_add, hs_remove, hs_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &hs_ops);
+}
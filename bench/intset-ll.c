@@ -0,0 +1,138 @@
+/**
+ * Integer set as a sorted linked list
+ * Every operation walks the list from the head, so the read sets are
+ * long (range/2 entries on average) and an update conflicts with all
+ * operations that passed its position.
+ *
+ * usage: intset-ll [-t threads] [-d milliseconds] [-r key range] [-u update percent]
+ *                  [-i initial size] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <limits.h>
+
+#include "bench.h"
+
+typedef struct node {
+    long key;
+    struct node *next;
+} node_t;
+
+/* sentinels: head has key LONG_MIN, the tail LONG_MAX */
+static node_t *head;
+
+static node_t *new_node(long key, node_t *next)
+{
+    node_t *n = (node_t*)malloc(sizeof(node_t));
+    if (n==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    n->key = key;
+    n->next = next;
+    return n;
+}
+
+static void ll_init(stm_tx_t *tx, bench_params_t *p)
+{
+    head = new_node(LONG_MIN, new_node(LONG_MAX, NULL));
+}
+
+static int ll_contains(stm_tx_t *tx, long key)
+{
+    node_t *n;
+    long k;
+    int found;
+
+    STM_BEGIN();
+    n = (node_t*)STM_READ_P(head->next);
+    while ((k = (long)STM_READ(n->key)) < key) n = (node_t*)STM_READ_P(n->next);
+    found = (k==key);
+    STM_END();
+    return found;
+}
+
+static int ll_add(stm_tx_t *tx, long key)
+{
+    node_t *prev, *n, *new;
+    long k;
+    int added;
+
+    STM_BEGIN();
+    prev = head;
+    n = (node_t*)STM_READ_P(prev->next);
+    while ((k = (long)STM_READ(n->key)) < key) {
+	prev = n;
+	n = (node_t*)STM_READ_P(n->next);
+    }
+    added = (k!=key);
+    if (added) {
+	new = (node_t*)STM_MALLOC(sizeof(node_t));
+	STM_WRITE(new->key, key);
+	STM_WRITE_P(new->next, n);
+	STM_WRITE_P(prev->next, new);
+    }
+    STM_END();
+    return added;
+}
+
+static int ll_remove(stm_tx_t *tx, long key)
+{
+    node_t *prev, *n;
+    long k;
+    int removed;
+
+    STM_BEGIN();
+    prev = head;
+    n = (node_t*)STM_READ_P(prev->next);
+    while ((k = (long)STM_READ(n->key)) < key) {
+	prev = n;
+	n = (node_t*)STM_READ_P(n->next);
+    }
+    removed = (k==key);
+    if (removed) {
+	STM_WRITE_P(prev->next, STM_READ_P(n->next));
+	STM_FREE(n);
+    }
+    STM_END();
+    return removed;
+}
+
+/* sorted, no duplicates and the expected number of keys */
+static int ll_check(bench_params_t *p, long size)
+{
+    node_t *n;
+    long nr = 0;
+
+    for (n = head->next; n->next!=NULL; n = n->next) {
+	if (n->key >= n->next->key) return 0;
+	nr++;
+    }
+    return nr==size;
+}
+
+static const bench_ops_t ll_ops = {
+    "intset-ll", ll_init, NULL, ll_contains, ll_add, ll_remove, ll_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &ll_ops);
+}
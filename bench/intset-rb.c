@@ -0,0 +1,319 @@
+/**
+ * Integer set as a red-black tree
+ * Short read sets (the depth of the tree), but the rebalancing of an
+ * update writes the nodes next to the root now and then.
+ * The insert and delete fixups follow the classic algorithm with NULL
+ * leaves (color of NULL is black).
+ *
+ * usage: intset-rb [-t threads] [-d milliseconds] [-r key range] [-u update percent]
+ *                  [-i initial size] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+
+#define RED 0
+#define BLACK 1
+
+typedef struct node {
+    long key;
+    struct node *left;
+    struct node *right;
+    struct node *parent;
+    long color;
+} node_t;
+
+static node_t *root;
+
+/* transactional accessors, all of them accept NULL like the leaves */
+#define KEY(n)		((long)STM_READ((n)->key))
+#define LEFT(n)		((n)==NULL ? NULL : (node_t*)STM_READ_P((n)->left))
+#define RIGHT(n)	((n)==NULL ? NULL : (node_t*)STM_READ_P((n)->right))
+#define PARENT(n)	((n)==NULL ? NULL : (node_t*)STM_READ_P((n)->parent))
+#define COLOR(n)	((n)==NULL ? BLACK : STM_READ((n)->color))
+#define ROOT()		((node_t*)STM_READ_P(root))
+#define SET_LEFT(n, v)	STM_WRITE_P((n)->left, v)
+#define SET_RIGHT(n, v)	STM_WRITE_P((n)->right, v)
+#define SET_PARENT(n, v) STM_WRITE_P((n)->parent, v)
+#define SET_COLOR(n, c)	do { if ((n)!=NULL) STM_WRITE((n)->color, c); } while (0)
+#define SET_ROOT(v)	STM_WRITE_P(root, v)
+
+static void rotate_left(stm_tx_t *tx, node_t *p)
+{
+    node_t *r = RIGHT(p), *rl = LEFT(r), *pp = PARENT(p);
+
+    SET_RIGHT(p, rl);
+    if (rl!=NULL) SET_PARENT(rl, p);
+    SET_PARENT(r, pp);
+    if (pp==NULL) SET_ROOT(r);
+    else if (LEFT(pp)==p) SET_LEFT(pp, r);
+    else SET_RIGHT(pp, r);
+    SET_LEFT(r, p);
+    SET_PARENT(p, r);
+}
+
+static void rotate_right(stm_tx_t *tx, node_t *p)
+{
+    node_t *l = LEFT(p), *lr = RIGHT(l), *pp = PARENT(p);
+
+    SET_LEFT(p, lr);
+    if (lr!=NULL) SET_PARENT(lr, p);
+    SET_PARENT(l, pp);
+    if (pp==NULL) SET_ROOT(l);
+    else if (RIGHT(pp)==p) SET_RIGHT(pp, l);
+    else SET_LEFT(pp, l);
+    SET_RIGHT(l, p);
+    SET_PARENT(p, l);
+}
+
+static void fix_after_insert(stm_tx_t *tx, node_t *x)
+{
+    node_t *y;
+
+    while (x!=NULL && x!=ROOT() && COLOR(PARENT(x))==RED) {
+	if (PARENT(x)==LEFT(PARENT(PARENT(x)))) {
+	    y = RIGHT(PARENT(PARENT(x)));
+	    if (COLOR(y)==RED) {
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(y, BLACK);
+		SET_COLOR(PARENT(PARENT(x)), RED);
+		x = PARENT(PARENT(x));
+	    } else {
+		if (x==RIGHT(PARENT(x))) {
+		    x = PARENT(x);
+		    rotate_left(tx, x);
+		}
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(PARENT(PARENT(x)), RED);
+		rotate_right(tx, PARENT(PARENT(x)));
+	    }
+	} else {
+	    y = LEFT(PARENT(PARENT(x)));
+	    if (COLOR(y)==RED) {
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(y, BLACK);
+		SET_COLOR(PARENT(PARENT(x)), RED);
+		x = PARENT(PARENT(x));
+	    } else {
+		if (x==LEFT(PARENT(x))) {
+		    x = PARENT(x);
+		    rotate_right(tx, x);
+		}
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(PARENT(PARENT(x)), RED);
+		rotate_left(tx, PARENT(PARENT(x)));
+	    }
+	}
+    }
+    SET_COLOR(ROOT(), BLACK);
+}
+
+static void fix_after_delete(stm_tx_t *tx, node_t *x)
+{
+    node_t *sib;
+
+    while (x!=ROOT() && COLOR(x)==BLACK) {
+	if (x==LEFT(PARENT(x))) {
+	    sib = RIGHT(PARENT(x));
+	    if (COLOR(sib)==RED) {
+		SET_COLOR(sib, BLACK);
+		SET_COLOR(PARENT(x), RED);
+		rotate_left(tx, PARENT(x));
+		sib = RIGHT(PARENT(x));
+	    }
+	    if (COLOR(LEFT(sib))==BLACK && COLOR(RIGHT(sib))==BLACK) {
+		SET_COLOR(sib, RED);
+		x = PARENT(x);
+	    } else {
+		if (COLOR(RIGHT(sib))==BLACK) {
+		    SET_COLOR(LEFT(sib), BLACK);
+		    SET_COLOR(sib, RED);
+		    rotate_right(tx, sib);
+		    sib = RIGHT(PARENT(x));
+		}
+		SET_COLOR(sib, COLOR(PARENT(x)));
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(RIGHT(sib), BLACK);
+		rotate_left(tx, PARENT(x));
+		x = ROOT();
+	    }
+	} else {
+	    sib = LEFT(PARENT(x));
+	    if (COLOR(sib)==RED) {
+		SET_COLOR(sib, BLACK);
+		SET_COLOR(PARENT(x), RED);
+		rotate_right(tx, PARENT(x));
+		sib = LEFT(PARENT(x));
+	    }
+	    if (COLOR(RIGHT(sib))==BLACK && COLOR(LEFT(sib))==BLACK) {
+		SET_COLOR(sib, RED);
+		x = PARENT(x);
+	    } else {
+		if (COLOR(LEFT(sib))==BLACK) {
+		    SET_COLOR(RIGHT(sib), BLACK);
+		    SET_COLOR(sib, RED);
+		    rotate_left(tx, sib);
+		    sib = LEFT(PARENT(x));
+		}
+		SET_COLOR(sib, COLOR(PARENT(x)));
+		SET_COLOR(PARENT(x), BLACK);
+		SET_COLOR(LEFT(sib), BLACK);
+		rotate_right(tx, PARENT(x));
+		x = ROOT();
+	    }
+	}
+    }
+    SET_COLOR(x, BLACK);
+}
+
+static void rb_init(stm_tx_t *tx, bench_params_t *p)
+{
+    root = NULL;
+}
+
+/* the node with the key or NULL */
+static node_t *lookup(stm_tx_t *tx, long key)
+{
+    node_t *n = ROOT();
+    long k;
+
+    while (n!=NULL && (k = KEY(n))!=key) n = (key<k) ? LEFT(n) : RIGHT(n);
+    return n;
+}
+
+static int rb_contains(stm_tx_t *tx, long key)
+{
+    int found;
+
+    STM_BEGIN();
+    found = (lookup(tx, key)!=NULL);
+    STM_END();
+    return found;
+}
+
+static int rb_add(stm_tx_t *tx, long key)
+{
+    node_t *n, *p, *new;
+    long k = 0;
+    int added;
+
+    STM_BEGIN();
+    added = 1;
+    p = NULL;
+    n = ROOT();
+    while (n!=NULL) {
+	p = n;
+	if ((k = KEY(n))==key) {
+	    added = 0;
+	    break;
+	}
+	n = (key<k) ? LEFT(n) : RIGHT(n);
+    }
+    if (added) {
+	new = (node_t*)STM_MALLOC(sizeof(node_t));
+	STM_WRITE(new->key, key);
+	SET_LEFT(new, NULL);
+	SET_RIGHT(new, NULL);
+	SET_PARENT(new, p);
+	STM_WRITE(new->color, RED);
+	if (p==NULL) SET_ROOT(new);
+	else if (key<k) SET_LEFT(p, new);
+	else SET_RIGHT(p, new);
+	fix_after_insert(tx, new);
+    }
+    STM_END();
+    return added;
+}
+
+static int rb_remove(stm_tx_t *tx, long key)
+{
+    node_t *n, *s, *r, *p;
+    int removed;
+
+    STM_BEGIN();
+    n = lookup(tx, key);
+    removed = (n!=NULL);
+    if (removed) {
+	/* two children: move the successor's key here and delete the successor */
+	if (LEFT(n)!=NULL && RIGHT(n)!=NULL) {
+	    s = RIGHT(n);
+	    while (LEFT(s)!=NULL) s = LEFT(s);
+	    STM_WRITE(n->key, KEY(s));
+	    n = s;
+	}
+	r = (LEFT(n)!=NULL) ? LEFT(n) : RIGHT(n);
+	p = PARENT(n);
+	if (r!=NULL) {
+	    SET_PARENT(r, p);
+	    if (p==NULL) SET_ROOT(r);
+	    else if (n==LEFT(p)) SET_LEFT(p, r);
+	    else SET_RIGHT(p, r);
+	    if (COLOR(n)==BLACK) fix_after_delete(tx, r);
+	} else if (p==NULL) {
+	    SET_ROOT(NULL);
+	} else {
+	    /* n is a leaf, it serves as the phantom leaf of the fixup */
+	    if (COLOR(n)==BLACK) fix_after_delete(tx, n);
+	    p = PARENT(n);
+	    if (p!=NULL) {
+		if (n==LEFT(p)) SET_LEFT(p, NULL);
+		else if (n==RIGHT(p)) SET_RIGHT(p, NULL);
+	    }
+	}
+	STM_FREE(n);
+    }
+    STM_END();
+    return removed;
+}
+
+/* black height of the subtree, -1 if the subtree is broken */
+static int check_node(node_t *n, node_t *parent, long lo, long hi, long *nr)
+{
+    int l, r;
+
+    if (n==NULL) return 1;
+    if (n->parent!=parent || n->key<=lo || n->key>=hi) return -1;
+    if (n->color==RED && ((n->left!=NULL && n->left->color==RED) || (n->right!=NULL && n->right->color==RED)))
+	return -1;
+    (*nr)++;
+    l = check_node(n->left, n, lo, n->key, nr);
+    r = check_node(n->right, n, n->key, hi, nr);
+    if (l<0 || l!=r) return -1;
+    return l + (n->color==BLACK);
+}
+
+/* search tree order, parent links, red-black properties and size */
+static int rb_check(bench_params_t *p, long size)
+{
+    long nr = 0;
+
+    if (root!=NULL && root->color!=BLACK) return 0;
+    if (check_node(root, NULL, -1, p->range, &nr)<0) return 0;
+    return nr==size;
+}
+
+static const bench_ops_t rb_ops = {
+    "intset-rb", rb_init, NULL, rb_contains, rb_add, rb_remove, rb_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &rb_ops);
+}
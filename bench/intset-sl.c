@@ -0,0 +1,152 @@
+/**
+ * Integer set as a skip list
+ * Read sets of about 2*log2(size) entries, an update writes one link
+ * per level of the node. The level of a node is derived from a hash of
+ * its key (probability 1/2 per level), so it does not depend on the
+ * thread or on earlier aborts.
+ *
+ * usage: intset-sl [-t threads] [-d milliseconds] [-r key range] [-u update percent]
+ *                  [-i initial size] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <limits.h>
+
+#include "bench.h"
+
+#define MAX_LEVEL 16
+
+typedef struct node {
+    long key;
+    long level;
+    struct node *next[];
+} node_t;
+
+/* head sentinel with MAX_LEVEL links, the end of every level is NULL */
+static node_t *head;
+
+static int node_level(long key)
+{
+    unsigned long h = (unsigned long)key * 0x9e3779b97f4a7c15UL;
+
+    return 1 + __builtin_ctzl((h>>32) | (1UL<<(MAX_LEVEL-1)));
+}
+
+/* fills preds with the last node < key on every level, returns the
+ * first node >= key on level 0 */
+static node_t *find(stm_tx_t *tx, long key, node_t **preds)
+{
+    node_t *x = head, *n;
+    int i;
+
+    for (i=MAX_LEVEL-1; i>=0; i--) {
+	while ((n = (node_t*)STM_READ_P(x->next[i]))!=NULL && (long)STM_READ(n->key)<key) x = n;
+	preds[i] = x;
+    }
+    return (node_t*)STM_READ_P(x->next[0]);
+}
+
+static void sl_init(stm_tx_t *tx, bench_params_t *p)
+{
+    head = (node_t*)calloc(1, sizeof(node_t) + MAX_LEVEL*sizeof(node_t*));
+    if (head==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    head->key = LONG_MIN;
+    head->level = MAX_LEVEL;
+}
+
+static int sl_contains(stm_tx_t *tx, long key)
+{
+    node_t *preds[MAX_LEVEL], *n;
+    int found;
+
+    STM_BEGIN();
+    n = find(tx, key, preds);
+    found = (n!=NULL && (long)STM_READ(n->key)==key);
+    STM_END();
+    return found;
+}
+
+static int sl_add(stm_tx_t *tx, long key)
+{
+    node_t *preds[MAX_LEVEL], *n, *new;
+    int added, level, i;
+
+    STM_BEGIN();
+    n = find(tx, key, preds);
+    added = (n==NULL || (long)STM_READ(n->key)!=key);
+    if (added) {
+	level = node_level(key);
+	new = (node_t*)STM_MALLOC(sizeof(node_t) + level*sizeof(node_t*));
+	STM_WRITE(new->key, key);
+	STM_WRITE(new->level, level);
+	for (i=0; i<level; i++) {
+	    STM_WRITE_P(new->next[i], STM_READ_P(preds[i]->next[i]));
+	    STM_WRITE_P(preds[i]->next[i], new);
+	}
+    }
+    STM_END();
+    return added;
+}
+
+static int sl_remove(stm_tx_t *tx, long key)
+{
+    node_t *preds[MAX_LEVEL], *n;
+    int removed, level, i;
+
+    STM_BEGIN();
+    n = find(tx, key, preds);
+    removed = (n!=NULL && (long)STM_READ(n->key)==key);
+    if (removed) {
+	/* n is the successor of preds[i] on all of its levels */
+	level = (long)STM_READ(n->level);
+	for (i=0; i<level; i++) STM_WRITE_P(preds[i]->next[i], STM_READ_P(n->next[i]));
+	STM_FREE(n);
+    }
+    STM_END();
+    return removed;
+}
+
+/* every level sorted and only with nodes that high, the expected number of keys */
+static int sl_check(bench_params_t *p, long size)
+{
+    node_t *n;
+    long nr = 0;
+    int i;
+
+    for (i=0; i<MAX_LEVEL; i++) {
+	for (n = head->next[i]; n!=NULL; n = n->next[i]) {
+	    if (n->level<=i || (n->next[i]!=NULL && n->key>=n->next[i]->key)) return 0;
+	    if (i==0) nr++;
+	}
+    }
+    return nr==size;
+}
+
+static const bench_ops_t sl_ops = {
+    "intset-sl", sl_init, NULL, sl_contains, sl_add, sl_remove, sl_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &sl_ops);
+}
@@ -0,0 +1,183 @@
+/**
+ * Lock table benchmark
+ * Long transactions that read random words of a large array, so that
+ * every load hits a different stripe of the lock table. Build it with
+ * the default lock table (locktable) and with huge pages and NUMA
+ * interleaving (locktable-huge) to compare dTLB misses and throughput.
+ *
+ * usage: locktable [-t threads] [-r reads/tx] [-m array size in MB] [-d seconds]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stm.h"
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "default"
+#endif
+
+static volatile int stop;
+static stm_word_t *array;
+static size_t nr_words;
+static int nr_reads = 8192;
+
+/* one private word per thread (in its own cache line) makes every tx a writer */
+typedef struct thread_data {
+    stm_word_t result;
+    unsigned long seed;
+    unsigned long nr_tx;
+    char padding[64-3*sizeof(unsigned long)];
+} thread_data_t;
+
+static void *worker(void *arg)
+{
+    thread_data_t *data = (thread_data_t*)arg;
+    unsigned long seed = data->seed, nr_tx = 0;
+    stm_tx_t *tx = stm_new();
+    int i;
+
+    while (!stop) {
+	stm_word_t sum = 0;
+	STM_BEGIN();
+	for (i=0; i<nr_reads; i++) {
+	    /* xorshift */
+	    seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+	    sum += STM_READ(array[seed % nr_words]);
+	}
+	STM_WRITE(data->result, sum);
+	STM_END();
+	nr_tx++;
+    }
+    stm_delete(tx);
+    data->nr_tx = nr_tx;
+    return NULL;
+}
+
+/* counts dTLB load misses of this process (and of threads started later) */
+static int tlb_counter_open()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0x0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* kB of anonymous memory backed by transparent huge pages */
+static long hugepages_kb()
+{
+    char line[256];
+    long kb = -1;
+    FILE *smaps = fopen("/proc/self/smaps_rollup", "r");
+    if (smaps==NULL) return -1;
+    while (fgets(line, sizeof(line), smaps)!=NULL) {
+	if (sscanf(line, "AnonHugePages: %ld kB", &kb)==1) break;
+    }
+    fclose(smaps);
+    return kb;
+}
+
+int main(int argc, char **argv)
+{
+    int nr_threads = 1, duration = 5, size_mb = 512, opt, i, tlb;
+    long long misses = -1;
+    unsigned long nr_tx = 0;
+    struct timeval start, end;
+    pthread_t *threads;
+    thread_data_t *data;
+    double secs;
+
+    while ((opt = getopt(argc, argv, "t:r:m:d:")) != -1) {
+	switch (opt) {
+	case 't': nr_threads = atoi(optarg); break;
+	case 'r': nr_reads = atoi(optarg); break;
+	case 'm': size_mb = atoi(optarg); break;
+	case 'd': duration = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-t threads] [-r reads/tx] [-m array size in MB] [-d seconds]\n", argv[0]);
+	    exit(1);
+	}
+    }
+
+    /* the array itself uses huge pages in all variants, only the lock table differs */
+    nr_words = ((size_t)size_mb*1024*1024)/sizeof(stm_word_t);
+    if ((array = mmap(NULL, nr_words*sizeof(stm_word_t), PROT_READ|PROT_WRITE,
+		      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0))==MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(array, nr_words*sizeof(stm_word_t), MADV_HUGEPAGE);
+#endif
+    memset(array, 0x1, nr_words*sizeof(stm_word_t));
+
+    STM_STARTUP();
+    threads = (pthread_t*)malloc(nr_threads*sizeof(pthread_t));
+    if (posix_memalign((void**)&data, 64, nr_threads*sizeof(thread_data_t))!=0) {
+	perror("malloc");
+	exit(1);
+    }
+
+    tlb = tlb_counter_open();
+    if (tlb>=0) ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+    gettimeofday(&start, NULL);
+    for (i=0; i<nr_threads; i++) {
+	data[i].seed = 88172645463325252UL + i;
+	data[i].nr_tx = 0;
+	pthread_create(&threads[i], NULL, worker, &data[i]);
+    }
+    sleep(duration);
+    stop = 1;
+    for (i=0; i<nr_threads; i++) {
+	pthread_join(threads[i], NULL);
+	nr_tx += data[i].nr_tx;
+    }
+    gettimeofday(&end, NULL);
+    if (tlb>=0) {
+	ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(tlb, &misses, sizeof(misses))!=sizeof(misses)) misses = -1;
+	close(tlb);
+    }
+    secs = (end.tv_sec-start.tv_sec) + (end.tv_usec-start.tv_usec)/1e6;
+
+    printf("bench=locktable variant=%s threads=%d reads_per_tx=%d txs=%lu tx_per_s=%.1f loads_per_s=%.0f "
+	   "dtlb_misses_per_load=%.4f hugepages_kb=%ld\n",
+	   BENCH_VARIANT, nr_threads, nr_reads, nr_tx, nr_tx/secs, (double)nr_tx*nr_reads/secs,
+	   (misses<0 || nr_tx==0) ? -1.0 : (double)misses/((double)nr_tx*nr_reads), hugepages_kb());
+
+    STM_SHUTDOWN();
+    return 0;
+}
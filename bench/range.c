@@ -0,0 +1,148 @@
+/**
+ * Range access benchmark
+ * The records are RECORD_SIZE bytes long and start at an odd offset, so
+ * every record spans several lock stripes and shares its first and last
+ * stripe with its neighbours. All bytes of a record are the same, the
+ * update operations copy (stm_memcpy), fill (stm_memset, stm_store_bytes,
+ * stm_get_write_addr) or increment (stm_get_modify_addr) whole records,
+ * all other operations read records with stm_get_read_addr and
+ * stm_load_bytes. A record with different bytes means that a transaction
+ * saw or wrote an inconsistent snapshot, the bytes around the records
+ * must stay zero. The key range (-r) is the number of records.
+ *
+ * usage: range [-t threads] [-d milliseconds] [-r records] [-u update percent] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+
+#define RECORD_SIZE 100
+#define RECORD_OFFSET 3					/* not aligned to a word or a stripe */
+#define GUARD 64					/* zero bytes after the records */
+
+static unsigned char *memory;
+static long nr_records;
+static volatile int bad_record;				/* some transaction saw a mixed record */
+
+#define RECORD(i) (memory + RECORD_OFFSET + (i)*RECORD_SIZE)
+
+static int range_uniform(const unsigned char *p)
+{
+    long i;
+
+    for (i=1; i<RECORD_SIZE; i++) if (p[i]!=p[0]) return 0;
+    return 1;
+}
+
+static void range_init(stm_tx_t *tx, bench_params_t *p)
+{
+    long i;
+
+    nr_records = p->range;
+    memory = (unsigned char*)calloc(1, RECORD_OFFSET + nr_records*RECORD_SIZE + GUARD);
+    if (memory==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    for (i=0; i<nr_records; i++) memset(RECORD(i), i & 0xff, RECORD_SIZE);
+}
+
+static int range_update(stm_tx_t *tx, bench_thread_t *t)
+{
+    unsigned char buf[RECORD_SIZE], *rec;
+    long a = bench_rand(t, nr_records), b = bench_rand(t, nr_records), i;
+    int c = bench_rand(t, 256), op = bench_rand(t, 5), ok = 1;
+
+    STM_BEGIN();
+    switch (op) {
+    case 0:
+	if (a!=b) stm_memcpy(tx, RECORD(a), RECORD(b), RECORD_SIZE);
+	break;
+    case 1:
+	/* our own writes must be visible to the range reads */
+	stm_memset(tx, RECORD(a), c, RECORD_SIZE);
+	stm_load_bytes(tx, RECORD(a), buf, RECORD_SIZE);
+	ok = range_uniform(buf) && buf[0]==c;
+	break;
+    case 2:
+	memset(buf, c, RECORD_SIZE);
+	stm_store_bytes(tx, RECORD(a), buf, RECORD_SIZE);
+	break;
+    case 3:
+	rec = (unsigned char*)stm_get_modify_addr(tx, RECORD(a), RECORD_SIZE);
+	for (i=0; i<RECORD_SIZE; i++) rec[i]++;
+	stm_finish_writing(tx, RECORD(a), RECORD_SIZE);
+	break;
+    default:
+	/* no stm_finish_writing, the commit writes the buffer */
+	rec = (unsigned char*)stm_get_write_addr(tx, RECORD(a), RECORD_SIZE);
+	memset(rec, c, RECORD_SIZE);
+	break;
+    }
+    STM_END();
+    return ok;
+}
+
+static int range_read(stm_tx_t *tx, bench_thread_t *t)
+{
+    unsigned char buf[RECORD_SIZE], *rec;
+    long a = bench_rand(t, nr_records), b = bench_rand(t, nr_records);
+    int ok;
+
+    STM_BEGIN_RO();
+    rec = (unsigned char*)stm_get_read_addr(tx, RECORD(a), RECORD_SIZE);
+    ok = range_uniform(rec);
+    stm_load_bytes(tx, RECORD(b), buf, RECORD_SIZE);
+    ok &= range_uniform(buf);
+    STM_END();
+    return ok;
+}
+
+static void range_op(stm_tx_t *tx, bench_thread_t *t, bench_params_t *p)
+{
+    int ok;
+
+    if (bench_rand(t, 100) < p->update) {
+	ok = range_update(tx, t);
+	t->updates++;
+    } else {
+	ok = range_read(tx, t);
+    }
+    if (!ok) bad_record = 1;
+}
+
+static int range_check(bench_params_t *p, long size)
+{
+    long i;
+
+    for (i=0; i<RECORD_OFFSET; i++) if (memory[i]) return 0;
+    for (i=0; i<nr_records; i++) if (!range_uniform(RECORD(i))) return 0;
+    for (i=0; i<GUARD; i++) if (RECORD(nr_records)[i]) return 0;
+    return !bad_record;
+}
+
+static const bench_ops_t range_ops = {
+    "range", range_init, range_op, NULL, NULL, NULL, range_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &range_ops);
+}
@@ -0,0 +1,180 @@
+#!/bin/sh
+#
+# Performance regression driver
+# Runs every microbenchmark (and the STAMP applications if -s is given)
+# against every build variant (Makefile: VARIANTS, lib/libadaptSTM-<variant>.a)
+# and thread count, keeps the median of the repetitions and writes
+# <out>/results.csv and <out>/results.json. With a baseline (a results.csv
+# of an earlier run) every configuration that lost more than the threshold
+# of its throughput is reported. The exit status is 2 if there are
+# regressions or a benchmark found its data structure broken.
+#
+# usage: regress.sh [-v "variants"] [-t "threads"] [-b "benchmarks"] [-d milliseconds]
+#                   [-n repetitions] [-a "benchmark arguments"] [-s stamp directory]
+#                   [-o output directory] [-B baseline.csv] [-T threshold percent]
+#
+#   make variants / make variant-benchs build the variants without running them,
+#   cp <out>/results.csv <baseline> stores a new baseline
+#
+# STAMP: patch the sources with stamp/adaptstm-stamp-0.9.10.patch (see
+# README.stamp), the applications are rebuilt for every variant with
+# make -f Makefile.astm STM=<root> STM_VARIANT=-<variant> and run with the
+# small (simulator) inputs. Their throughput is runs per second (1/Time).
+#
+# Copyright (c) 2010 ETH Zurich
+#   Mathias Payer <mathias.payer@inf.ethz.ch>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+VARIANTS="default wb-eager wb-lazy wt whash2 static nobloom noclockline safe"
+THREADS="1 2 4 8"
+BENCHS="intset-ll intset-rb intset-hs intset-sl bank range subword"
+DURATION=2000
+REPS=3
+ARGS=""
+STAMP=""
+OUT="$ROOT/bench/results"
+BASELINE=""
+THRESHOLD=5
+
+usage() {
+    echo "usage: $0 [-v \"variants\"] [-t \"threads\"] [-b \"benchmarks\"] [-d milliseconds] [-n repetitions]" >&2
+    echo "          [-a \"benchmark arguments\"] [-s stamp directory] [-o output directory]" >&2
+    echo "          [-B baseline.csv] [-T threshold percent]" >&2
+    exit 1
+}
+
+while getopts "v:t:b:d:n:a:s:o:B:T:" opt; do
+    case $opt in
+	v) VARIANTS="$OPTARG" ;;
+	t) THREADS="$OPTARG" ;;
+	b) BENCHS="$OPTARG" ;;
+	d) DURATION="$OPTARG" ;;
+	n) REPS="$OPTARG" ;;
+	a) ARGS="$OPTARG" ;;
+	s) STAMP="$OPTARG" ;;
+	o) OUT="$OPTARG" ;;
+	B) BASELINE="$OPTARG" ;;
+	T) THRESHOLD="$OPTARG" ;;
+	*) usage ;;
+    esac
+done
+
+COLUMNS="bench,variant,threads,ops_per_s,abort_ratio,commits,aborts,ro_commits,wt_switches,hash_switches,lock_mode_switches,valid"
+
+# name=value pairs of the benchmark output as one CSV row
+to_csv() {
+    awk -v cols="$COLUMNS" '{
+	n = split(cols, c, ",");
+	for (i=1; i<=NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2]; }
+	row = "";
+	for (i=1; i<=n; i++) row = row (i>1 ? "," : "") v[c[i]];
+	print row;
+    }'
+}
+
+# the row with the median throughput of the repetitions
+median() {
+    sort -t, -k4 -g | awk '{ r[NR] = $0 } END { if (NR) print r[int((NR+1)/2)] }'
+}
+
+# STAMP application, arguments (the thread count is appended)
+stamp_args() {
+    case $1 in
+	bayes) echo "-v32 -r1024 -n2 -p20 -i2 -e2 -t" ;;
+	genome) echo "-g256 -s16 -n16384 -t" ;;
+	intruder) echo "-a10 -l4 -n2048 -s1 -t" ;;
+	kmeans) echo "-m40 -n40 -t0.05 -i inputs/random-n2048-d16-c16.txt -p" ;;
+	labyrinth) echo "-i inputs/random-x32-y32-z3-n96.txt -t" ;;
+	ssca2) echo "-s13 -i1.0 -u1.0 -l3 -p3 -t" ;;
+	vacation) echo "-n2 -q90 -u98 -r16384 -t4096 -c" ;;
+	yada) echo "-a20 -i inputs/633.2 -t" ;;
+    esac
+}
+
+mkdir -p "$OUT" || exit 1
+RAW="$OUT/raw.txt"
+CSV="$OUT/results.csv"
+: > "$RAW"
+echo "$COLUMNS" > "$CSV"
+
+make -s -C "$ROOT" variant-benchs VARIANTS="$VARIANTS" || exit 1
+
+for v in $VARIANTS; do
+    for b in $BENCHS; do
+	for t in $THREADS; do
+	    r=0
+	    while [ $r -lt $REPS ]; do
+		line=$("$ROOT/bench/variants/$v/$b" -t "$t" -d "$DURATION" $ARGS)
+		echo "$line" >> "$RAW"
+		echo "$line" | to_csv
+		r=$((r+1))
+	    done | median >> "$CSV"
+	    tail -n 1 "$CSV"
+	done
+    done
+
+    [ -n "$STAMP" ] || continue
+    for app in bayes genome intruder kmeans labyrinth ssca2 vacation yada; do
+	[ -f "$STAMP/$app/Makefile.astm" ] || continue
+	(cd "$STAMP/$app" && make -s -f Makefile.astm clean >/dev/null &&
+	 make -s -f Makefile.astm STM="$ROOT" STM_VARIANT="-$v" >/dev/null) || { echo "$app: build failed" >&2; continue; }
+	for t in $THREADS; do
+	    r=0
+	    while [ $r -lt $REPS ]; do
+		secs=$(cd "$STAMP/$app" && ./$app $(stamp_args $app) "$t" 2>&1 | tee -a "$RAW" |
+		       awk '/^Time *=/ { print $NF }' | tail -n 1)
+		[ -n "$secs" ] && echo "stamp-$app,$v,$t,$(awk -v s="$secs" 'BEGIN { printf "%.4f", (s>0) ? 1/s : 0 }'),,,,,,,,1"
+		r=$((r+1))
+	    done | median >> "$CSV"
+	    tail -n 1 "$CSV"
+	done
+    done
+done
+
+# the same rows as JSON, numbers unquoted
+awk -F, '
+NR==1 { n = split($0, c, ","); print "["; next }
+{
+    printf "%s  {", (NR>2 ? ",\n" : "");
+    for (i=1; i<=n; i++) {
+	v = $i;
+	if (i>2) { if (v=="") v = "null"; } else v = "\"" v "\"";
+	printf "%s\"%s\": %s", (i>1 ? ", " : ""), c[i], v;
+    }
+    printf "}";
+}
+END { print "\n]" }' "$CSV" > "$OUT/results.json"
+
+status=0
+awk -F, 'NR>1 && $12!="1" { printf "INVALID %s,%s,%s\n", $1, $2, $3; bad = 1 } END { exit bad }' "$CSV" || status=2
+if [ -n "$BASELINE" ]; then
+    awk -F, -v th="$THRESHOLD" '
+	FNR==1 { next }
+	NR==FNR { base[$1","$2","$3] = $4; next }
+	{
+	    k = $1","$2","$3;
+	    if (!(k in base) || base[k]<=0) next;
+	    change = 100.0*($4-base[k])/base[k];
+	    if (change < -th) { printf "REGRESSION %s: %.1f -> %.1f ops/s (%.1f%%)\n", k, base[k], $4, change; bad = 1; }
+	}
+	END { exit bad }' "$BASELINE" "$CSV" || status=2
+    [ $status -eq 0 ] && echo "no regressions against $BASELINE (threshold $THRESHOLD%)"
+fi
+echo "results: $CSV $OUT/results.json"
+exit $status
@@ -0,0 +1,357 @@
+/**
+ * Replay of an access recording (ACCESS_RECORD)
+ * Every recorded descriptor becomes one thread that runs its committed
+ * transactions again: the same loads and stores (into one arena, page
+ * id n at n << page_shift), stm_malloc/stm_free of the same sizes and
+ * read-only starts. The start sites are spread over REPLAY_SITES call
+ * sites of stm_start, so the per-site adaptation sees different sites.
+ * Stores write the thread id, loaded values are not used. A free of a
+ * block that another thread allocated is skipped.
+ *
+ * usage: replay [-n loops] recording
+ *   prints the same key=value line as the microbenchmarks, ops are
+ *   transactions, updates are transactions that stored, range is the
+ *   number of pages
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+#include "adaptstm-record.h"
+
+#define REPLAY_SITES 16
+#define REPLAY_BUCKETS 4096				/* blocks allocated by a thread */
+
+typedef struct replay_op {
+    uint32_t type;					/* REC_* */
+    uint32_t flags;					/* start: REC_READONLY */
+    uint64_t addr;					/* replay address, start: site id */
+    uint64_t size;					/* malloc */
+} replay_op_t;
+
+typedef struct replay_block {
+    uint64_t addr;					/* recorded address */
+    void *ptr;
+    struct replay_block *next;
+} replay_block_t;
+
+typedef struct replay_thread {
+    long id;
+    uint8_t *rec;					/* records of the descriptor */
+    size_t rec_len, rec_size;
+    replay_op_t *ops;
+    size_t nops;
+    unsigned long max_mallocs;				/* per transaction */
+    replay_block_t *blocks[REPLAY_BUCKETS];
+    replay_block_t *pending;				/* mallocs of this attempt */
+    uint64_t *freed;					/* frees of this attempt */
+    unsigned long nfreed;
+    unsigned long txs, writers, skipped_frees;
+    pthread_t thread;
+} replay_thread_t;
+
+static replay_thread_t *replay_threads;
+static long nr_threads;
+static char *arena;
+static uint64_t arena_size;
+static int loops = 1;
+static pthread_barrier_t replay_barrier;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    if ((ptr = realloc(ptr, size))==NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    return ptr;
+}
+
+/* groups the chunks by descriptor */
+static void replay_read(const char *name)
+{
+    FILE *f = fopen(name, "r");
+    rec_header_t header;
+    rec_chunk_t chunk;
+    replay_thread_t *t;
+
+    if (f==NULL) {
+	perror("fopen: cannot read the recording");
+	exit(1);
+    }
+    if (fread(&header, sizeof(header), 1, f)!=1 || memcmp(header.magic, REC_MAGIC, sizeof(header.magic))!=0) {
+	fprintf(stderr, "%s: not an adaptSTM access recording\n", name);
+	exit(1);
+    }
+    if (header.page_shift!=REC_PAGE_SHIFT) {
+	fprintf(stderr, "%s: recorded with pages of 2^%u bytes\n", name, header.page_shift);
+	exit(1);
+    }
+    while (fread(&chunk, sizeof(chunk), 1, f)==1) {
+	if (chunk.id>=nr_threads) {
+	    replay_threads = (replay_thread_t*)xrealloc(replay_threads, (chunk.id+1)*sizeof(replay_thread_t));
+	    memset(&replay_threads[nr_threads], 0x0, (chunk.id+1-nr_threads)*sizeof(replay_thread_t));
+	    nr_threads = chunk.id+1;
+	}
+	t = &replay_threads[chunk.id];
+	if (t->rec_len + chunk.size > t->rec_size) {
+	    t->rec_size = 2*(t->rec_len + chunk.size);
+	    t->rec = (uint8_t*)xrealloc(t->rec, t->rec_size);
+	}
+	if (fread(t->rec + t->rec_len, 1, chunk.size, f)!=chunk.size) {
+	    fprintf(stderr, "%s: truncated\n", name);
+	    break;
+	}
+	t->rec_len += chunk.size;
+    }
+    fclose(f);
+}
+
+/* the records of one descriptor as ops, an unfinished transaction at the end is dropped */
+static void replay_decode(replay_thread_t *t)
+{
+    const uint8_t *p = t->rec, *end = t->rec + t->rec_len;
+    size_t size = 0, last_commit = 0;
+    uint64_t last = 0, v;
+    unsigned long mallocs = 0;
+    replay_op_t *op;
+
+    while (p!=NULL && p<end) {
+	if (t->nops==size) {
+	    size = size ? 2*size : 1024;
+	    t->ops = (replay_op_t*)xrealloc(t->ops, size*sizeof(replay_op_t));
+	}
+	op = &t->ops[t->nops];
+	op->type = *p & REC_TYPE_MASK;
+	op->flags = *p++ & ~REC_TYPE_MASK;
+	op->addr = op->size = 0;
+	switch (op->type) {
+	case REC_START:
+	    p = rec_get_number(p, end, &op->addr);
+	    mallocs = 0;
+	    break;
+	case REC_MALLOC:
+	    if ((p = rec_get_number(p, end, &op->size))==NULL) break;
+	    if (++mallocs > t->max_mallocs) t->max_mallocs = mallocs;
+	    /* fall through */
+	case REC_LOAD:
+	case REC_STORE:
+	case REC_FREE:
+	    if ((p = rec_get_number(p, end, &v))==NULL) break;
+	    last += rec_unzigzag(v);
+	    op->addr = last;
+	    if ((op->type==REC_LOAD || op->type==REC_STORE) && (last | (sizeof(stm_word_t)-1)) + 1 > arena_size)
+		arena_size = (last | (sizeof(stm_word_t)-1)) + 1;
+	    break;
+	case REC_COMMIT:
+	    last_commit = t->nops+1;
+	    break;
+	default:
+	    fprintf(stderr, "descriptor %ld: unknown record %u\n", t->id, op->type);
+	    p = NULL;
+	    continue;
+	}
+	t->nops++;
+    }
+    t->nops = last_commit;
+    for (op = t->ops; op<t->ops + t->nops; op++) {
+	if (op->type==REC_START) t->txs++;
+    }
+    free(t->rec);
+    t->rec = NULL;
+}
+
+static replay_block_t **replay_bucket(replay_thread_t *t, uint64_t addr)
+{
+    return &t->blocks[(addr >> 4) & (REPLAY_BUCKETS-1)];
+}
+
+/* the block of addr, allocated by this thread in an earlier transaction or in this attempt */
+static void *replay_find(replay_thread_t *t, unsigned long npending, uint64_t addr)
+{
+    replay_block_t *b;
+    unsigned long i;
+
+    for (i=0; i<npending; i++) {
+	if (t->pending[i].addr==addr) return t->pending[i].ptr;
+    }
+    for (b = *replay_bucket(t, addr); b!=NULL; b = b->next) {
+	if (b->addr==addr) return b->ptr;
+    }
+    return NULL;
+}
+
+/* after the commit: keep the new blocks, forget the freed ones (also if they are new) */
+static void replay_committed(replay_thread_t *t, unsigned long npending)
+{
+    replay_block_t *b, **prev;
+    unsigned long i;
+
+    for (i=0; i<npending; i++) {
+	b = (replay_block_t*)xrealloc(NULL, sizeof(replay_block_t));
+	*b = t->pending[i];
+	b->next = *replay_bucket(t, b->addr);
+	*replay_bucket(t, b->addr) = b;
+    }
+    for (i=0; i<t->nfreed; i++) {
+	for (prev = replay_bucket(t, t->freed[i]); (b = *prev)!=NULL; prev = &b->next) {
+	    if (b->addr==t->freed[i]) {
+		*prev = b->next;
+		free(b);
+		break;
+	    }
+	}
+    }
+}
+
+#define REPLAY_SITE(n) \
+	case n: if (ro) STM_BEGIN_RO(); else STM_BEGIN(); break;
+
+/* runs the transaction that starts at start, returns the op after its commit */
+static replay_op_t *replay_tx(stm_tx_t *tx, replay_thread_t *t, replay_op_t *start)
+{
+    replay_op_t *op;
+    unsigned long npending, skipped;
+    int ro = (start->flags & REC_READONLY)!=0, stored;
+    void *ptr;
+
+    switch (start->addr % REPLAY_SITES) {
+	REPLAY_SITE(0) REPLAY_SITE(1) REPLAY_SITE(2) REPLAY_SITE(3)
+	REPLAY_SITE(4) REPLAY_SITE(5) REPLAY_SITE(6) REPLAY_SITE(7)
+	REPLAY_SITE(8) REPLAY_SITE(9) REPLAY_SITE(10) REPLAY_SITE(11)
+	REPLAY_SITE(12) REPLAY_SITE(13) REPLAY_SITE(14) REPLAY_SITE(15)
+    }
+    npending = 0;
+    skipped = 0;
+    t->nfreed = 0;
+    stored = 0;
+    for (op = start+1; op->type!=REC_COMMIT; op++) {
+	switch (op->type) {
+	case REC_LOAD:
+	    stm_load(tx, (stm_word_t*)(arena + (op->addr & ~(sizeof(stm_word_t)-1))));
+	    break;
+	case REC_STORE:
+	    stm_store(tx, (stm_word_t*)(arena + (op->addr & ~(sizeof(stm_word_t)-1))), t->id);
+	    stored = 1;
+	    break;
+	case REC_MALLOC:
+	    t->pending[npending].addr = op->addr;
+	    t->pending[npending++].ptr = stm_malloc(tx, op->size);
+	    break;
+	case REC_FREE:
+	    if ((ptr = replay_find(t, npending, op->addr))!=NULL) {
+		stm_free(tx, ptr);
+		t->freed[t->nfreed++] = op->addr;
+	    } else {
+		skipped++;
+	    }
+	    break;
+	}
+    }
+    STM_END();
+    replay_committed(t, npending);
+    t->writers += stored;
+    t->skipped_frees += skipped;
+    return op+1;
+}
+
+static void *replay_worker(void *arg)
+{
+    replay_thread_t *t = (replay_thread_t*)arg;
+    stm_tx_t *tx = stm_new();
+    replay_op_t *op;
+    int i;
+
+    t->pending = (replay_block_t*)xrealloc(NULL, (t->max_mallocs+1)*sizeof(replay_block_t));
+    t->freed = (uint64_t*)xrealloc(NULL, (t->nops+1)*sizeof(uint64_t));
+    pthread_barrier_wait(&replay_barrier);
+    for (i=0; i<loops; i++) {
+	for (op = t->ops; op<t->ops + t->nops; ) op = replay_tx(tx, t, op);
+    }
+    stm_delete(tx);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    bench_params_t *p = &bench_params;
+    stm_stats_t before, after;
+    struct timeval start, end;
+    unsigned long txs = 0, writers = 0, skipped = 0;
+    double secs;
+    long i, n;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:"))!=-1) {
+	switch (opt) {
+	case 'n': loops = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n loops] recording\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (optind>=argc) {
+	fprintf(stderr, "usage: %s [-n loops] recording\n", argv[0]);
+	exit(1);
+    }
+    replay_read(argv[optind]);
+    /* descriptors without a committed transaction do not get a thread */
+    for (i=0, n=0; i<nr_threads; i++) {
+	replay_threads[i].id = i;
+	replay_decode(&replay_threads[i]);
+	if (replay_threads[i].nops!=0) replay_threads[n++] = replay_threads[i];
+    }
+    nr_threads = n;
+    if (nr_threads==0) {
+	fprintf(stderr, "%s: no committed transactions\n", argv[optind]);
+	exit(1);
+    }
+    arena_size = (arena_size + (1UL << REC_PAGE_SHIFT)-1) & ~((1UL << REC_PAGE_SHIFT)-1);
+    if (posix_memalign((void**)&arena, 1UL << REC_PAGE_SHIFT, arena_size ? arena_size : 1)!=0) {
+	perror("malloc");
+	exit(1);
+    }
+    memset(arena, 0x0, arena_size);
+
+    STM_STARTUP();
+    stm_get_stats(NULL, &before);
+    pthread_barrier_init(&replay_barrier, NULL, nr_threads+1);
+    for (i=0; i<nr_threads; i++) pthread_create(&replay_threads[i].thread, NULL, replay_worker, &replay_threads[i]);
+    pthread_barrier_wait(&replay_barrier);
+    gettimeofday(&start, NULL);
+    for (i=0; i<nr_threads; i++) {
+	pthread_join(replay_threads[i].thread, NULL);
+	txs += replay_threads[i].txs*loops;
+	writers += replay_threads[i].writers;
+	skipped += replay_threads[i].skipped_frees;
+    }
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec-start.tv_sec) + (end.tv_usec-start.tv_usec)/1e6;
+    stm_get_stats(NULL, &after);
+
+    p->threads = nr_threads;
+    p->duration = secs*1000;
+    p->range = arena_size >> REC_PAGE_SHIFT;
+    p->update = txs ? 100*writers/txs : 0;
+    p->initial = 0;
+    bench_report("replay", p, txs, writers, secs, &before, &after, 1);
+    if (skipped) fprintf(stderr, "%lu frees of blocks of other threads skipped\n", skipped);
+
+    STM_SHUTDOWN();
+    return 0;
+}
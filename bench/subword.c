@@ -0,0 +1,180 @@
+/**
+ * Sub-word access benchmark
+ * Every word holds four counters of different sizes (16, 8, 8 and 32
+ * bits). The update operations move one unit from a counter to another
+ * one, in the same word or another word, with stm_store_u8/u16/u32 or a
+ * masked stm_store2 of the word, and read both counters and the whole
+ * word again (our partial writes must be merged with the rest of the
+ * word). All other operations sum up all counters in one (long,
+ * read-only) transaction. Every sum must be the same, a lost update of a
+ * neighbouring counter (partial-word write-back, write-through undo)
+ * changes it. The key range (-r) is the number of words.
+ *
+ * usage: subword [-t threads] [-d milliseconds] [-r words] [-u update percent] [-s seed]
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "bench.h"
+
+#define INITIAL_COUNT 100
+#define FIELDS 4
+
+typedef union slot {
+    stm_word_t word;
+    struct {
+	uint16_t h;
+	uint8_t b0, b1;
+	uint32_t w;
+    } f;
+} __attribute__((aligned(8))) slot_t;
+
+static const unsigned long field_max[FIELDS] = { 0xffff, 0xff, 0xff, 0xffffffffUL };
+
+static slot_t *slots;
+static long nr_slots;
+static volatile int bad_sum;				/* some transaction saw a wrong sum */
+
+static void subword_init(stm_tx_t *tx, bench_params_t *p)
+{
+    long i;
+
+    nr_slots = p->range;
+    if (posix_memalign((void**)&slots, 64, nr_slots*sizeof(slot_t))!=0) {
+	perror("malloc");
+	exit(1);
+    }
+    memset(slots, 0x0, nr_slots*sizeof(slot_t));
+    for (i=0; i<nr_slots; i++) {
+	slots[i].f.h = INITIAL_COUNT;
+	slots[i].f.b0 = INITIAL_COUNT;
+	slots[i].f.b1 = INITIAL_COUNT;
+	slots[i].f.w = INITIAL_COUNT;
+    }
+}
+
+static volatile void *field_addr(long i, int f)
+{
+    switch (f) {
+    case 0: return &slots[i].f.h;
+    case 1: return &slots[i].f.b0;
+    case 2: return &slots[i].f.b1;
+    default: return &slots[i].f.w;
+    }
+}
+
+static unsigned long field_load(stm_tx_t *tx, long i, int f)
+{
+    switch (f) {
+    case 0: return stm_load_u16(tx, (volatile uint16_t*)field_addr(i, f));
+    case 1:
+    case 2: return stm_load_u8(tx, (volatile uint8_t*)field_addr(i, f));
+    default: return stm_load_u32(tx, (volatile uint32_t*)field_addr(i, f));
+    }
+}
+
+/* the counter in a value of the whole word (little endian) */
+static unsigned long field_of_word(stm_word_t word, long i, int f)
+{
+    unsigned long shift = ((char*)field_addr(i, f) - (char*)&slots[i]) * 8;
+
+    return (word >> shift) & field_max[f];
+}
+
+static void field_store(stm_tx_t *tx, long i, int f, unsigned long value, int masked)
+{
+    unsigned long shift = ((char*)field_addr(i, f) - (char*)&slots[i]) * 8;
+
+    if (masked) {
+	stm_store2(tx, &slots[i].word, (stm_word_t)value << shift, (stm_word_t)field_max[f] << shift);
+	return;
+    }
+    switch (f) {
+    case 0: stm_store_u16(tx, (volatile uint16_t*)field_addr(i, f), value); break;
+    case 1:
+    case 2: stm_store_u8(tx, (volatile uint8_t*)field_addr(i, f), value); break;
+    default: stm_store_u32(tx, (volatile uint32_t*)field_addr(i, f), value); break;
+    }
+}
+
+static int subword_move(stm_tx_t *tx, bench_thread_t *t)
+{
+    long a = bench_rand(t, nr_slots), b = bench_rand(t, nr_slots);
+    int f = bench_rand(t, FIELDS), g = bench_rand(t, FIELDS), masked = bench_rand(t, 2), ok;
+    unsigned long from, to;
+
+    if (a==b && f==g) return 1;
+    STM_BEGIN();
+    ok = 1;
+    from = field_load(tx, a, f);
+    to = field_load(tx, b, g);
+    if (from>0 && to<field_max[g]) {
+	field_store(tx, a, f, from-1, masked);
+	field_store(tx, b, g, to+1, masked);
+	/* our partial writes, merged with the rest of the words */
+	ok = field_load(tx, a, f)==from-1 && field_load(tx, b, g)==to+1 &&
+	    field_of_word(stm_load(tx, &slots[a].word), a, f)==from-1 &&
+	    field_of_word(stm_load(tx, &slots[b].word), b, g)==to+1;
+    }
+    STM_END();
+    return ok;
+}
+
+static unsigned long subword_total(stm_tx_t *tx)
+{
+    unsigned long total;
+    long i;
+    int f;
+
+    STM_BEGIN_RO();
+    total = 0;
+    for (i=0; i<nr_slots; i++) {
+	for (f=0; f<FIELDS; f++) total += field_load(tx, i, f);
+    }
+    STM_END();
+    return total;
+}
+
+static void subword_op(stm_tx_t *tx, bench_thread_t *t, bench_params_t *p)
+{
+    if (bench_rand(t, 100) < p->update) {
+	if (!subword_move(tx, t)) bad_sum = 1;
+	t->updates++;
+    } else {
+	if (subword_total(tx)!=nr_slots*FIELDS*INITIAL_COUNT) bad_sum = 1;
+    }
+}
+
+static int subword_check(bench_params_t *p, long size)
+{
+    unsigned long total = 0;
+    long i;
+
+    for (i=0; i<nr_slots; i++) total += slots[i].f.h + slots[i].f.b0 + slots[i].f.b1 + slots[i].f.w;
+    return !bad_sum && total==nr_slots*FIELDS*INITIAL_COUNT;
+}
+
+static const bench_ops_t subword_ops = {
+    "subword", subword_init, subword_op, NULL, NULL, NULL, subword_check
+};
+
+int main(int argc, char **argv)
+{
+    return bench_main(argc, argv, &subword_ops);
+}
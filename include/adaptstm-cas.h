@@ -1,5 +1,6 @@
 /**
- * This file contains the implementation of CAS and FETCH AND ADD
+ * This file contains the implementation of CAS, FETCH AND ADD and
+ * of the time stamp counter access
  *
  * Copyright (c) 2010 ETH Zurich
  *   Mathias Payer <mathias.payer@inf.ethz.ch>
@@ -50,3 +51,13 @@ inline stm_word_t __always_inline FETCH_ADD(volatile stm_word_t *p, stm_word_t i
   return result;
 }
 
+/**
+ * Reads the time stamp counter. rdtscp waits until all previous
+ * instructions are executed, the lfence keeps later loads behind it.
+ */
+inline stm_word_t __always_inline TSC_READ()
+{
+  unsigned int lo, hi, aux;
+  __asm__ __volatile__("rdtscp; lfence" : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+  return (stm_word_t)(((uint64_t)hi << 32) | lo);
+}
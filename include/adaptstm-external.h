@@ -33,6 +33,8 @@
 
 #include <setjmp.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "adaptstm-stats.h"
 
 
 #ifdef __cplusplus
@@ -57,8 +59,27 @@ typedef struct stm_tx stm_tx_t;
  *  FUNCTIONS                                                      *
 \*******************************************************************/
 
-/** Inits the whole STM system */
+/**
+ * Inits the whole STM system
+ * The lock table has 2^22 entries unless ADAPTSTM_LOCK_BITS is set
+ */
 void stm_init(void);
+/** Inits the whole STM system with a lock table of 2^bits entries */
+void stm_init_locks(unsigned int bits);
+
+/* flags for stm_register_region */
+#define STM_REGION_HASH_MULT 0x1
+#define STM_REGION_ADAPTIVE 0x2
+
+/**
+ * Gives [addr, addr+size) its own lock granularity of 2^shift bytes
+ * Regions must not overlap and must not be changed inside a transaction.
+ * Returns -1 if there are too many regions or the library was built
+ * without LOCK_REGIONS.
+ */
+int stm_register_region(void *addr, size_t size, unsigned int shift, int flags);
+/** Removes the region starting at addr */
+void stm_unregister_region(void *addr);
 /** Frees the datastructure of the STM */
 void stm_exit(void);
 
@@ -71,6 +92,26 @@ void stm_delete(stm_tx_t *tx);
 
 /** Starts a transaction */
 void stm_start(stm_tx_t *tx, jmp_buf *env);
+/**
+ * Starts a read-only transaction (loads are not logged).
+ * A store restarts the transaction in normal mode.
+ */
+void stm_start_ro(stm_tx_t *tx, jmp_buf *env);
+
+#define STM_DEADLINE_NS 0x0
+#define STM_DEADLINE_TSC 0x1
+#define STM_DEADLINE_ESCALATE 0x2
+#define STM_TIMED_OUT 1
+/**
+ * Starts a transaction that stops retrying at a deadline: a budget in
+ * ns from the first attempt (STM_DEADLINE_NS) or an absolute TSC value
+ * (STM_DEADLINE_TSC, CLOCK_MONOTONIC ns on cpus without an invariant TSC
+ * and rdtscp). Returns 0 when the attempt runs. Past the deadline
+ * it returns STM_TIMED_OUT without starting, or with
+ * STM_DEADLINE_ESCALATE waits for all other transactions and runs alone
+ * until it commits. Conflicts close to the deadline abort the owner.
+ */
+int stm_start_deadline(stm_tx_t *tx, jmp_buf *env, uint64_t deadline, int flags);
 /** Commits a transaction */
 void stm_commit(stm_tx_t *tx);
 /** Retries the transaction */
@@ -81,14 +122,57 @@ void stm_retry(stm_tx_t *tx);
  */
 void stm_abort(stm_tx_t *tx);
 
+/* contention management policies */
+#define STM_CM_YIELD 0
+#define STM_CM_BACKOFF 1
+#define STM_CM_KARMA 2
+#define STM_CM_POLKA 3
+#define STM_CM_GREEDY 4
+#define STM_CM_AGGRESSIVE 5
+
+/**
+ * Selects the contention manager of a descriptor (STM_CM_*).
+ * The default is read from ADAPTSTM_CM (yield, backoff, karma, polka,
+ * greedy, aggressive) when the STM is initialized.
+ */
+void stm_set_cm(stm_tx_t *tx, int policy);
+/** Returns the contention manager of a descriptor */
+int stm_get_cm(stm_tx_t *tx);
+
+/* priority classes */
+#define STM_PRIO_LOW 0
+#define STM_PRIO_NORMAL 1
+#define STM_PRIO_HIGH 2
+
+/**
+ * Sets the priority class of a descriptor (default: STM_PRIO_NORMAL).
+ * Transactions do not wait for owners of a lower class, they ask them
+ * to abort instead.
+ */
+void stm_set_priority(stm_tx_t *tx, int level);
+/** Returns the priority class of a descriptor */
+int stm_get_priority(stm_tx_t *tx);
+
 
 /** Reads a shared address and returns its value */
 stm_word_t stm_load(stm_tx_t *tx, volatile stm_word_t *addr);
 
 /** Stores a value to a shared address */
 void stm_store(stm_tx_t *tx, volatile stm_word_t *addr, stm_word_t value);
+/** Stores the bits of value that are set in mask, the other bits keep their value */
 void stm_store2(stm_tx_t *tx, volatile stm_word_t *addr, stm_word_t value, stm_word_t mask);
 
+/**
+ * Sub-word loads and stores (addr is aligned to the size). A store only
+ * changes its bytes of the word and does not read the word first.
+ */
+uint8_t stm_load_u8(stm_tx_t *tx, volatile uint8_t *addr);
+uint16_t stm_load_u16(stm_tx_t *tx, volatile uint16_t *addr);
+uint32_t stm_load_u32(stm_tx_t *tx, volatile uint32_t *addr);
+void stm_store_u8(stm_tx_t *tx, volatile uint8_t *addr, uint8_t value);
+void stm_store_u16(stm_tx_t *tx, volatile uint16_t *addr, uint16_t value);
+void stm_store_u32(stm_tx_t *tx, volatile uint32_t *addr, uint32_t value);
+
 
 /** Allocates memory */
 void *stm_malloc(stm_tx_t *tx, size_t size);
@@ -98,16 +182,32 @@ void stm_free(stm_tx_t *tx, void *addr);
 void *stm_realloc(stm_tx_t *tx, void *addr, size_t size);
 
 
-/** Get a pointer to the transactional version of a shared address for reading */
+/* Range accesses
+ * A range takes the lock of every stripe once and logs one read entry
+ * per stripe, the bytes are copied as blocks. The pointers stay valid
+ * until the transaction ends.
+ */
+/** Get a pointer to the transactional version of a shared address for reading (a private copy) */
 volatile void* stm_get_read_addr   (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
 /** Get a pointer to the transactional version of a shared address for reading */
 volatile void* stm_get_read2_addr   (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
-/** Get a pointer to the transactional version of a shared address for writing */
+/**
+ * Get a pointer to the transactional version of a shared address for writing
+ * (write-through: addr itself, write-back: an uninitialized buffer)
+ */
 volatile void* stm_get_write_addr  (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
 /** Get a pointer to the transactional version of a shared address for modifying */
 volatile void* stm_get_modify_addr (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
-/** Tells the STM that the writing/modiying is done */
+/** Tells the STM that the writing/modiying is done (the commit does it otherwise) */
 void  stm_finish_writing  (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+/** Copies a shared range into private memory */
+void stm_load_bytes(stm_tx_t *tx, volatile void *addr, void *buf, size_t size);
+/** Copies private memory into a shared range */
+void stm_store_bytes(stm_tx_t *tx, volatile void *addr, const void *buf, size_t size);
+/** Copies between two shared ranges that do not overlap */
+void stm_memcpy(stm_tx_t *tx, volatile void *to, volatile void *from, size_t size);
+/** Sets every byte of a shared range to c */
+void stm_memset(stm_tx_t *tx, volatile void *addr, int c, size_t size);
 
 
 /** Gets the transaction descriptor of the current thread */
@@ -120,7 +220,52 @@ jmp_buf *stm_get_env(stm_tx_t *tx);
 int stm_in_transaction(stm_tx_t *tx);
 
 
-/** Get statistic from the current thread */
+/**
+ * Sets a tuning parameter, val points to an unsigned long. With tx ==
+ * NULL the global value changes, descriptors pick it up at their next
+ * adaptation. Otherwise only the descriptor changes (call it from its
+ * thread, outside of a transaction). Values are clamped to their range.
+ * Keys: adapt_period, adapt_retry_percent, whash_grow_percent,
+ * whash_shrink_percent, nrwbeforehash, max_yields, backoff_max_rounds,
+ * locking_abort_percent, locking_lazy_held, locking_eager_held.
+ * Returns 1 if the key exists, 0 otherwise.
+ */
+int stm_set_parameter(stm_tx_t *tx, const char *key, void *val);
+/**
+ * Copies the counters of a descriptor, or the sum over all descriptors
+ * if tx is NULL. Threads keep running, every descriptor is copied at a
+ * consistent point. Can be called from any thread.
+ */
+void stm_get_stats(stm_tx_t *tx, stm_stats_t *stats);
+/**
+ * Copies the STM_HIST_* latency histogram of a descriptor, or the
+ * merged histogram of all descriptors if tx is NULL (like
+ * stm_get_stats). Empty without CYCLE_STATS.
+ */
+void stm_get_hist(stm_tx_t *tx, int which, stm_hist_t *hist);
+/**
+ * Returns the value (in TSC cycles) below which percent (0-100) of
+ * the samples of hist lie, rounded up to the bucket bound, 0 if empty.
+ */
+unsigned long stm_hist_percentile(const stm_hist_t *hist, double percent);
+/**
+ * Prints the abort profile (ABORT_PROFILE): the locks, access sites and
+ * pairs of transaction start sites that caused the most aborts. Can be
+ * called at any time, stm_exit writes it to the file named by
+ * ADAPTSTM_PROFILE (or stdout with GLOBAL_STATS).
+ */
+void stm_dump_profile(FILE *out);
+/** Clears the abort profile (counts of concurrent aborts may be lost) */
+void stm_reset_profile(void);
+/**
+ * Prints the hardware counters (PERF_COUNTERS) per transaction start
+ * site: cycles, instructions, L1D, LLC, dTLB and branch misses of the
+ * transaction body, of the commit phases and of aborted attempts.
+ * stm_exit writes it to the file named by ADAPTSTM_PERF (or stdout
+ * with GLOBAL_STATS).
+ */
+void stm_dump_perf(FILE *out);
+/** Reads a tuning parameter of a descriptor (or the global one if tx is NULL) into *(unsigned long *)val */
 int stm_get_parameter(stm_tx_t *tx, const char *key, void *val);
 
 
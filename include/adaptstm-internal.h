@@ -27,30 +27,160 @@ static inline void buf_acquire_all_locks(stm_tx_t *tx);
 static inline stm_word_t buf_validate(stm_tx_t *tx);
 static inline void buf_release_all_locks(stm_tx_t *tx, stm_word_t version);
 static inline void buf_write_back(stm_tx_t *tx);
+static inline void buf_undo_writes(stm_tx_t *tx);
+static void buf_write_merge(writeset_t *write);
 static inline void buf_reset(stm_tx_t *tx);
 static inline writeset_t *buf_get_write_addr(stm_tx_t *tx, stm_word_t *addr, stm_word_t allocate, stm_word_t value);
 static inline stm_word_t buf_check_read(stm_tx_t *tx, stm_word_t *addr);
+static inline stm_word_t buf_check_read_ro(stm_tx_t *tx, stm_word_t *addr);
+static inline stm_word_t buf_read_lock(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t idx, stm_word_t *addr);
+static inline stm_word_t buf_read_lock_ro(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t *addr);
+static inline void buf_log_read(stm_tx_t *tx, stm_word_t idx, stm_word_t version);
+static inline stm_word_t buf_read_filter(stm_tx_t *tx, stm_word_t idx);
+static inline stm_word_t buf_byte_mask(stm_word_t off, stm_word_t len);
+static inline char *buf_stripe_end(char *addr, char *end);
+static void buf_overlay_writes(stm_tx_t *tx, char *addr, char *end, char *to);
+static void buf_read_range(stm_tx_t *tx, char *addr, stm_word_t size, char *to);
+static void buf_write_range(stm_tx_t *tx, char *addr, stm_word_t size, const char *from);
+static void buf_grow_read_filter(stm_tx_t *tx);
 
-static void lock_reset();
-static inline stm_word_t lock_safe_get_value(stm_tx_t *tx, volatile stm_word_t *lock);
+static void lock_reset(volatile stm_word_t *table, size_t size);
+static volatile stm_word_t *lock_alloc_table(size_t size);
+static void lock_free_table(volatile stm_word_t *table, size_t size);
+static inline stm_word_t lock_safe_get_value(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t *addr);
+#ifdef LOCK_REGIONS
+static inline lock_region_t *lock_region_of(stm_word_t addr);
+static inline stm_word_t lock_idx_from_addr(stm_word_t addr);
+#endif
+#ifdef LOCKS_HOT
+static inline stm_word_t lock_idx_hot(stm_word_t idx);
+static inline void lock_hot_count(stm_word_t idx);
+static void lock_hot_reset();
+static void lock_hot_promote();
+#endif
+#ifdef LOCKS_CLASSIFY
+static stm_word_t lock_classify_conflict(stm_tx_t *owner, stm_word_t *addr);
+static void lock_count_conflict(stm_tx_t *owner, stm_word_t *addr);
+static int lock_conflicts_window(lock_conflicts_t *conflicts, stm_word_t min, stm_word_t *nr);
+#endif
+#ifdef ADAPTIVE_LOCKING
+static inline void lock_account_held(stm_tx_t *tx);
+static void lock_adapt_mode(stm_tx_t *tx);
+#endif
+#ifdef LOCKS_QUIESCE
+static void lock_adapt_check(stm_tx_t *tx);
+static void lock_quiesce_init();
+static int lock_quiesce_begin(int wait);
+static void lock_quiesce_end();
+static void lock_quiesce_wait(stm_tx_t *tx);
+#endif
+#ifdef LOCKS_RESIZE
+static void lock_resize(stm_word_t bits);
+#endif
 static inline void lock_acquire(stm_tx_t *tx, stm_word_t *addr);
 
-static inline void cont_handle_conflict(stm_tx_t *tx, stm_tx_t *other);
+static inline void cont_handle_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void stm_param_init();
+static void stm_stats_read(stm_tx_t *tx, void *to, const void *from, size_t size);
+#ifdef CYCLE_STATS
+static inline unsigned long hist_bucket(unsigned long v);
+static inline void hist_add(stm_hist_t *hist, unsigned long v);
+static void hist_print();
+#endif
+#ifdef ABORT_PROFILE
+static prof_entry_t *prof_slot(prof_entry_t *table, stm_word_t key, stm_word_t key2);
+static void prof_record(stm_tx_t *tx);
+static int prof_top(prof_entry_t *table, prof_entry_t **top, int n);
+static void prof_print_reasons(FILE *out, prof_entry_t *e);
+static void prof_exit();
+#endif
+#ifdef TX_TRACE
+static inline void trace_add(stm_tx_t *tx, stm_word_t type, stm_word_t info, stm_word_t arg, stm_word_t other);
+static void trace_abort(stm_tx_t *tx);
+static void trace_flush_tx(stm_tx_t *tx);
+static void trace_flush();
+static void *trace_loop(void *arg);
+static void trace_init();
+static void trace_exit();
+#endif
+#ifdef LIVE_STATS
+static void live_init();
+static void live_exit();
+static void live_attach(stm_tx_t *tx);
+static void live_update(stm_tx_t *tx);
+#endif
+#ifdef ACCESS_RECORD
+static stm_word_t rec_map_id(rec_map_t *map, stm_word_t key);
+static stm_word_t rec_cached_id(rec_cache_t *cache, stm_word_t size, rec_map_t *map, stm_word_t key);
+static void rec_grow(stm_tx_t *tx);
+static inline void rec_put_addr(stm_tx_t *tx, stm_word_t addr);
+static void rec_access(stm_tx_t *tx, stm_word_t type, stm_word_t addr);
+static void rec_range(stm_tx_t *tx, stm_word_t type, stm_word_t addr, stm_word_t size);
+static void rec_malloc(stm_tx_t *tx, void *addr, size_t size);
+static void rec_start(stm_tx_t *tx, stm_word_t readonly, void *site);
+static void rec_flush_tx(stm_tx_t *tx);
+static void rec_new(stm_tx_t *tx);
+static void rec_init();
+static void rec_exit();
+#endif
+#ifdef PERF_COUNTERS
+static void perf_open(stm_tx_t *tx);
+static void perf_close(stm_tx_t *tx);
+static inline uint64_t perf_rdpmc(uint32_t counter);
+static inline void perf_read(stm_tx_t *tx, uint64_t *values);
+static perf_site_t *perf_site(stm_tx_t *tx, void *site);
+static inline void perf_add(uint64_t *sum, uint64_t *from, uint64_t *to);
+static void perf_commit(stm_tx_t *tx, uint64_t samples[5][PERF_EVENTS], stm_word_t writer);
+static void perf_abort(stm_tx_t *tx);
+static void perf_print_line(FILE *out, const char *name, uint64_t *values, unsigned long n);
+static void perf_exit();
+#endif
+static void stm_param_load(stm_tx_t *tx);
+static int stm_param_find(const char *key);
+static void cm_init();
+static void cm_clock_init();
+static inline uint64_t cm_now();
+static void cm_remote_aborted(stm_tx_t *tx);
+static inline void cm_kill(stm_tx_t *tx, stm_tx_t *other);
+static inline void cm_backoff(stm_tx_t *tx, unsigned int round);
+static inline unsigned long cm_priority(stm_tx_t *tx);
+static void cm_deadlock(stm_tx_t *tx);
+static int cm_priority_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static int cm_deadline_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+#ifdef GLOBAL_STATS
+static inline void prio_latency_add(prio_latency_t *lat, unsigned long cycles);
+static void prio_latency_merge(prio_latency_t *to, prio_latency_t *from);
+static void prio_latency_print();
+#endif
+#ifdef CM_BLOCKING
+static void cm_block(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_wake(stm_tx_t *tx);
+#endif
+static void cm_yield(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_exp_backoff(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_karma(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_polka(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_greedy(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+static void cm_aggressive(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
 
-static inline void mem_free_memory(stm_tx_t *tx);
+static void clock_init();
+static inline stm_word_t clock_start_version(stm_tx_t *tx);
+static inline stm_word_t clock_is_newer(stm_tx_t *tx, stm_word_t version);
+static inline stm_word_t clock_extend_version(stm_tx_t *tx, stm_word_t version);
+static inline void clock_conflict(stm_tx_t *tx, stm_word_t version);
+static inline stm_word_t clock_commit_version(stm_tx_t *tx, stm_word_t *validate);
+#ifdef CLOCK_TLC
+static void tlc_acquire_id(stm_tx_t *tx);
+static void tlc_release_id(stm_tx_t *tx);
+#endif
 
-/** Get a pointer to the transactional version of a shared address for reading */
-volatile void* stm_get_read_addr   (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes) { return NULL; }
-/** Get a pointer to the transactional version of a shared address for reading */
-volatile void* stm_get_read2_addr   (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes) { return NULL; }
-/** Get a pointer to the transactional version of a shared address for writing */
-volatile void* stm_get_write_addr  (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes) { return NULL; }
-/** Get a pointer to the transactional version of a shared address for modifying */
-volatile void* stm_get_modify_addr (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes) { return NULL; }
-/** Tells the STM that the writing/modiying is done */
-void  stm_finish_writing  (stm_tx_t *tx, volatile void *addr, unsigned int num_bytes) {}
+static inline void mem_free_memory(stm_tx_t *tx);
 
-void stm_store2(stm_tx_t *tx, volatile stm_word_t *addr, stm_word_t value, stm_word_t mask) {
-    stm_store(tx, (stm_word_t*)addr, value);
-}
+static void stm_ro_restart(stm_tx_t *tx);
+static void *range_alloc(stm_tx_t *tx, stm_word_t size);
+static void range_reset(stm_tx_t *tx);
+static void range_undo(stm_tx_t *tx);
+static volatile void *range_get_write_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes, int modify);
+static inline void stm_load_sub(stm_tx_t *tx, volatile void *addr, void *to, stm_word_t size);
+static inline void stm_store_sub(stm_tx_t *tx, volatile void *addr, const void *from, stm_word_t size);
 
@@ -0,0 +1,64 @@
+/**
+ * This file contains the layout of the shared memory segment with the
+ * live statistics (LIVE_STATS), it is shared by the STM and stmtop
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef ADAPTSTM_LIVE_H
+#define ADAPTSTM_LIVE_H
+
+#include <stdint.h>
+
+/* The segment is /adaptstm.<pid> (or ADAPTSTM_LIVE), it is removed by
+ * stm_exit. Every descriptor owns one slot, only its thread writes it
+ * with plain stores. Readers see every field torn free (aligned 64 bit
+ * words), but the fields of a slot are not a consistent snapshot. */
+#define LIVE_MAGIC "ADSTMLV1"
+#define LIVE_PREFIX "/adaptstm."
+#define LIVE_SLOTS 256					/* more descriptors are not shown */
+#define LIVE_HASH_FIXED 0xff				/* no adaptive write hash function */
+
+typedef struct live_thread {
+    uint64_t in_use;					/* 1 between stm_new and stm_delete */
+    uint64_t tid;					/* thread that called stm_new */
+    uint64_t commits;
+    uint64_t aborts;
+    uint64_t lock_waits;
+    uint64_t reads;					/* read set size of the last attempt */
+    uint64_t writes;					/* write set size of the last attempt */
+    uint64_t whashsize;					/* buckets of the write hash */
+    uint8_t writethrough;				/* 1: write-through, 0: write-back */
+    uint8_t lazy;					/* 1: lazy, 0: eager locking */
+    uint8_t adaptive_hash;				/* write hash function or LIVE_HASH_FIXED */
+    uint8_t readonly;					/* last attempt ran read-only */
+    uint32_t priority;					/* STM_PRIO_* */
+} __attribute__((aligned(128))) live_thread_t;
+
+typedef struct live_segment {
+    char magic[8];
+    uint64_t pid;
+    uint64_t tsc_khz;
+    uint64_t lock_bits;					/* lock table size at stm_init */
+    uint64_t started;					/* time() of stm_init */
+    uint64_t nslots;					/* slots handed out so far (freed ones are reused) */
+    char comm[64];					/* name of the process */
+    live_thread_t threads[LIVE_SLOTS];
+} live_segment_t;
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * This file contains the format of the access recording
+ * (ACCESS_RECORD), it is shared by the STM and the replay driver
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef ADAPTSTM_RECORD_H
+#define ADAPTSTM_RECORD_H
+
+#include <stdint.h>
+
+/* The file starts with a rec_header_t, followed by any number of
+ * chunks: a rec_chunk_t and size bytes of records of one descriptor.
+ * The chunks of a descriptor are in order and end at a transaction
+ * boundary, chunks of different descriptors are interleaved. Only
+ * committed attempts are recorded.
+ *
+ * No values and no real addresses are recorded: every page that is
+ * accessed gets an id (in the order of the first access, shared by all
+ * descriptors) and an address is recorded as id << page_shift | offset
+ * in the page. The replay puts page id n at n << page_shift in one
+ * arena, so accesses to the same word (and stripe) stay the same.
+ *
+ * A record is one byte (type and flags) followed by unsigned LEB128
+ * numbers. Addresses are zigzag encoded deltas to the last address of
+ * the descriptor, so the common short strides take one byte. */
+#define REC_MAGIC "ADSTMRC1"
+#define REC_PAGE_SHIFT 12
+
+/* record types (low 4 bits) */
+#define REC_START 1					/* number: start site id */
+#define REC_LOAD 2					/* address */
+#define REC_STORE 3					/* address */
+#define REC_MALLOC 4					/* number: size, address of the block */
+#define REC_FREE 5					/* address of the block */
+#define REC_COMMIT 6
+#define REC_TYPE_MASK 0x0f
+#define REC_READONLY 0x10				/* start: stm_start_ro */
+
+#define REC_MAX_SIZE 21					/* largest record in bytes */
+
+typedef struct rec_header {
+    char magic[8];
+    uint32_t page_shift;
+    uint32_t reserved;
+} rec_header_t;
+
+typedef struct rec_chunk {
+    uint32_t id;					/* descriptor */
+    uint32_t size;					/* bytes of records that follow */
+} rec_chunk_t;
+
+static inline int rec_put_number(uint8_t *buf, uint64_t v)
+{
+    int n = 0;
+
+    while (v>=0x80) {
+	buf[n++] = (uint8_t)v | 0x80;
+	v >>= 7;
+    }
+    buf[n++] = (uint8_t)v;
+    return n;
+}
+
+/* NULL if the number does not end before end */
+static inline const uint8_t *rec_get_number(const uint8_t *buf, const uint8_t *end, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (buf<end && shift<64) {
+	*v |= (uint64_t)(*buf & 0x7f) << shift;
+	if (!(*buf++ & 0x80)) return buf;
+	shift += 7;
+    }
+    return NULL;
+}
+
+static inline uint64_t rec_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t rec_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif
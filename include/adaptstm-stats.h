@@ -0,0 +1,90 @@
+/**
+ * This file contains the counters of adaptSTM (abort causes, stm_stats_t
+ * and the latency histograms), it is shared by the STM, its interface
+ * and the tools
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef ADAPTSTM_STATS_H
+#define ADAPTSTM_STATS_H
+
+/* abort causes */
+#define STM_ABORT_EXPLICIT 0				/* stm_retry called by the application */
+#define STM_ABORT_READ_VALIDATE 1			/* a read saw a newer version, extension failed */
+#define STM_ABORT_COMMIT_VALIDATE 2			/* commit-time validation failed */
+#define STM_ABORT_LOCK_VERSION 3			/* a lock was newer than the snapshot when taken */
+#define STM_ABORT_CONFLICT 4				/* the contention manager gave up on a lock owner */
+#define STM_ABORT_DEADLOCK 5
+#define STM_ABORT_KILLED 6				/* another transaction asked us to abort */
+#define STM_ABORT_RO_RESTART 7				/* a read-only transaction wrote */
+#define STM_ABORT_DEADLINE 8
+#define STM_ABORT_REASONS 9
+
+/** Short name of an abort cause (STM_ABORT_*) */
+static inline const char *stm_abort_reason_name(int reason)
+{
+    static const char *const names[STM_ABORT_REASONS] = {
+	"explicit", "read", "commit", "lock", "conflict", "deadlock", "killed", "ro", "deadline"
+    };
+    return (reason>=0 && reason<STM_ABORT_REASONS) ? names[reason] : "?";
+}
+
+/** Counters of one descriptor or of all (stm_get_stats) */
+typedef struct stm_stats {
+    unsigned long commits;
+    unsigned long ro_commits;				/* commits without writes */
+    unsigned long aborts;
+    unsigned long aborts_by[STM_ABORT_REASONS];		/* indexed by STM_ABORT_* */
+    unsigned long reads;				/* read set entries of committed transactions */
+    unsigned long writes;				/* write set entries of committed transactions */
+    unsigned long validations;
+    unsigned long extensions;				/* successful read set extensions */
+    unsigned long lock_waits;				/* locks found owned by another transaction */
+    unsigned long wt_switches;				/* write-through <-> write-back */
+    unsigned long hash_switches;			/* write hash function or size changes */
+    unsigned long lock_mode_switches;			/* eager <-> lazy locking */
+    unsigned long timeouts;
+    unsigned long escalations;
+    unsigned long cycles_committed;			/* TSC cycles of committed attempts (CYCLE_STATS) */
+    unsigned long cycles_wasted;			/* TSC cycles of aborted attempts (CYCLE_STATS) */
+    /* maxima, the fields above are summed up */
+    unsigned long max_reads;
+    unsigned long max_writes;
+} stm_stats_t;
+
+/* latency histograms (CYCLE_STATS), log-linear in TSC cycles: values
+ * below 2^STM_HIST_SUB_BITS get their own bucket, every power of two
+ * above is split into 2^STM_HIST_SUB_BITS buckets (error < 12.5%) */
+#define STM_HIST_ATTEMPT 0				/* start to commit or abort of one attempt */
+#define STM_HIST_TX 1					/* first start to commit, including retries */
+#define STM_HIST_ACQUIRE 2				/* commit: lock acquisition and commit version */
+#define STM_HIST_VALIDATE 3				/* commit: read set validation (if needed) */
+#define STM_HIST_WRITEBACK 4				/* commit: write back of the write set */
+#define STM_HIST_RELEASE 5				/* commit: lock release */
+#define STM_HISTS 6
+#define STM_HIST_SUB_BITS 3
+#define STM_HIST_BUCKETS ((65 - STM_HIST_SUB_BITS) << STM_HIST_SUB_BITS)
+typedef struct stm_hist {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long buckets[STM_HIST_BUCKETS];
+} stm_hist_t;
+
+#endif /* ADAPTSTM_STATS_H */
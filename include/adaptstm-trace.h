@@ -0,0 +1,69 @@
+/**
+ * This file contains the binary format of the event trace (TX_TRACE),
+ * it is shared by the STM and the stmtrace analyzer
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef ADAPTSTM_TRACE_H
+#define ADAPTSTM_TRACE_H
+
+#include <stdint.h>
+
+/* The file starts with a trace_header_t, followed by any number of
+ * chunks: a trace_chunk_t and count records of one descriptor. The
+ * chunks of a descriptor are in order, chunks of different
+ * descriptors are interleaved. */
+#define TRACE_MAGIC "ADSTMTR2"
+
+/* event types */
+#define TRACE_START 1					/* info: 1 if read-only */
+#define TRACE_LOAD 2					/* new read set entry, arg: lock index */
+#define TRACE_STORE 3					/* new write set entry, arg: lock index */
+#define TRACE_LOCK 4					/* lock acquired, arg: lock index */
+#define TRACE_WAIT 5					/* lock owned by other, arg: lock index */
+#define TRACE_WAIT_END 6				/* the lock was released (or we own it) */
+#define TRACE_VALIDATE 7				/* info: 1 if valid, arg: read set size */
+#define TRACE_EXTEND 8					/* snapshot extended, arg: read set size */
+#define TRACE_COMMIT 9					/* arg: write set size */
+#define TRACE_ABORT 10					/* info: STM_ABORT_*, other: cause if known */
+#define TRACE_KILL 11					/* asked other to abort */
+#define TRACE_TYPES 12
+
+#define TRACE_NOBODY 0xffffffffU			/* other is not known */
+
+typedef struct trace_header {
+    char magic[8];
+    uint64_t tsc_khz;					/* timestamp ticks per ms (TSC, or ns of CLOCK_MONOTONIC) */
+} trace_header_t;
+
+typedef struct trace_chunk {
+    uint32_t id;					/* descriptor */
+    uint32_t count;					/* records that follow */
+    uint64_t dropped;					/* records lost so far (ring full) */
+} trace_chunk_t;
+
+typedef struct trace_rec {
+    uint64_t tsc;
+    uint32_t arg;
+    uint32_t other;					/* descriptor id or TRACE_NOBODY */
+    uint8_t type;					/* TRACE_* */
+    uint8_t info;
+} trace_rec_t;
+
+#endif
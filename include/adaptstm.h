@@ -24,7 +24,21 @@
 #define ADAPTSTM_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <setjmp.h>
+#include "adaptstm-stats.h"
+#ifdef TX_TRACE
+#include <pthread.h>
+#include "adaptstm-trace.h"
+#endif
+#ifdef LIVE_STATS
+#include "adaptstm-live.h"
+#endif
+#ifdef ACCESS_RECORD
+#include <pthread.h>
+#include "adaptstm-record.h"
+#endif
 
 // typedef uint32_t stm_word_t;
 typedef intptr_t stm_word_t;
@@ -39,19 +53,26 @@ typedef struct lockset {
     stm_word_t version;
 } __attribute__ ((packed)) lockset_t;
 
-/* one read entry in the buffer */
+/* one read entry in the buffer (index of the lock in the lock array) */
 typedef struct readset {
-    stm_word_t *lock;
+    uint32_t lock;
     stm_word_t version;
 } __attribute__ ((packed)) readset_t;
 
 // number of read or lock entries in a set (to start with)
 #define NRRLENTRIESINSET 64
 
+/* direct mapped filter of the locks in the read set, an entry is
+ * (readepoch << 32 | lock index), so a new epoch clears the filter */
+#define RFILTER_MIN_SIZE 256
+#define RFILTER_MAX_SIZE (1 << 16)
+#define RFILTER_TAG(tx, idx) ((((uint64_t)(tx)->readepoch) << 32) | (uint32_t)(idx))
+
 /* one write entry in the buffer */
 typedef struct writeset {
     stm_word_t *addr;
     stm_word_t value;
+    stm_word_t mask; /* write-back: bits of value that were written, the others come from memory */
     //stm_word_t version; /* version == 0 if we already have that lock */
     struct writeset *next;
 } __attribute__ ((packed)) writeset_t;
@@ -87,6 +108,37 @@ typedef struct mem_block {
 
 mem_block_t *allocated;
 
+/* Scratch memory of the range accesses (stm_get_*_addr, stm_memcpy, ...),
+ * handed out with a bump pointer and reset when the next attempt starts */
+#define RANGE_CHUNK_SIZE (64*1024)
+#define RANGE_COPY_SIZE 4096 /* stack buffer of stm_memcpy and stm_memset */
+#define RANGE_ALIGN(size) (((size) + 15) & ~(stm_word_t)15)
+typedef struct range_chunk {
+    struct range_chunk *next;
+    stm_word_t size;					/* bytes of data */
+    stm_word_t used;
+    char data[] __attribute__ ((aligned (16)));
+} range_chunk_t;
+
+/* write-back: a buffer of stm_get_write_addr/stm_get_modify_addr that
+ * stm_finish_writing (or the commit) moves into the write set */
+typedef struct range_buf {
+    char *addr;						/* shared range */
+    stm_word_t size;
+    struct range_buf *next;
+    char data[] __attribute__ ((aligned (16)));
+} range_buf_t;
+
+/* write-through: the old bytes of stripes that a range access locked
+ * first (they hold none of our write entries), restored after the
+ * write entries on abort */
+typedef struct range_undo {
+    char *addr;
+    stm_word_t size;
+    char *data;
+    struct range_undo *next;
+} range_undo_t;
+
 /* Allocated but unused tx descriptors */
 typedef struct tx_block {
         void *tx;                     /* Address of memory */
@@ -95,14 +147,17 @@ typedef struct tx_block {
 
 pthread_mutex_t unused_tx_mutex;
 tx_block_t *unused_tx;
+struct stm_tx *all_tx;					/* all descriptors ever allocated (protected by unused_tx_mutex) */
 
 /*************************************************************************
  * Lock manager definitions
  *************************************************************************/
-#define NUM_BITS_FOR_HASH 22
-#define LOCK_HASH_ARRAY_SIZE (1 << NUM_BITS_FOR_HASH)
+#define NUM_BITS_FOR_HASH 22 /* default, can be changed with ADAPTSTM_LOCK_BITS or stm_init_locks */
+#define LOCK_MIN_BITS 10
+#define LOCK_MAX_BITS 30 /* lock indices must fit into 32 bits (readset_t) */
+#define LOCK_HASH_ARRAY_SIZE (lock_mask + 1)
 #define LOCK_SHIFT 5 /* for word based locking */
-#define LOCK_MASK (LOCK_HASH_ARRAY_SIZE - 1)
+#define LOCK_MASK (lock_mask)
 #define LOCK_FREE_MASK 0x01 /* 1 bit */
 
 #define MAX_NUM_YIELD_PER_LOCK 4 /* spin x times before a retry */
@@ -112,9 +167,158 @@ tx_block_t *unused_tx;
 
 //volatile stm_word_t locks[LOCK_HASH_ARRAY_SIZE];
 volatile stm_word_t *locks;
+stm_word_t lock_bits;					/* the lock table has 2^lock_bits entries */
+stm_word_t lock_mask;
+
+/* the lock table is mmaped if it should use huge pages or be interleaved */
+#if defined(LOCKS_HUGEPAGES) || defined(LOCKS_NUMA_INTERLEAVE)
+#define LOCKS_MMAP
+#define HUGEPAGE_SIZE (2*1024*1024)
+#define HUGEPAGE_1GB_SIZE (1024*1024*1024)
+#endif
+
+/* Cache line layout of the lock table
+ * With LOCK_SCATTER the lowest bits of the lock index select the cache
+ * line instead of the word in the line, so neighbouring stripes do not
+ * share a line. With LOCKS_HOT, locks that are acquired often (sampled)
+ * or contended move into a side table with one lock per cache line,
+ * which lives behind the lock table (indices >= LOCK_HASH_ARRAY_SIZE).
+ */
+#ifdef __LP64__
+#define LOCKS_PER_LINE_BITS 3
+#else
+#define LOCKS_PER_LINE_BITS 4
+#endif
+#define LOCKS_PER_LINE (1 << LOCKS_PER_LINE_BITS)
+#ifdef LOCK_SCATTER
+#define LOCK_PERMUTE(idx) ((((idx) & (LOCKS_PER_LINE-1)) << (lock_bits - LOCKS_PER_LINE_BITS)) | ((idx) >> LOCKS_PER_LINE_BITS))
+#else
+#define LOCK_PERMUTE(idx) (idx)
+#endif
+
+#ifdef LOCKS_HOT
+#if !defined(ADAPTIVENESS)
+#error "LOCKS_HOT needs ADAPTIVENESS"
+#endif
+#define LOCK_HOT_SLOTS 64 /* direct mapped by the lock index */
+#define LOCK_HOT_WORDS (LOCK_HOT_SLOTS*LOCKS_PER_LINE)
+#define LOCK_HOT_SAMPLE 64 /* count every n-th lock acquisition of a tx */
+#define LOCK_HOT_THRESHOLD 32 /* promote locks with that many hits in the sketch */
+stm_word_t lock_hot_map[LOCK_HOT_SLOTS];		/* lock index that uses the slot or -1 */
+typedef struct lock_hot_candidate {
+    stm_word_t idx;
+    stm_word_t count;
+} lock_hot_candidate_t;
+lock_hot_candidate_t lock_hot_candidates[LOCK_HOT_SLOTS];	/* updated without synchronization */
+unsigned long lock_hot_promotions;
+#define LOCK_IDX_HOT(idx) lock_idx_hot(idx)
+#define LOCK_HOT_COUNT(lock) lock_hot_count((lock) - locks)
+#else
+#define LOCK_HOT_WORDS 0
+#define LOCK_IDX_HOT(idx) (idx)
+#define LOCK_HOT_COUNT(lock)
+#endif
+/* bytes allocated for a lock table with that many entries */
+#define LOCK_TABLE_SIZE(entries) (((entries) + LOCK_HOT_WORDS)*sizeof(stm_word_t))
+
+/* multiplicative (Fibonacci) hash of a stripe number, uses the upper bits */
+#define LOCK_HASH_MULTIPLY(stripe) ((stm_word_t)(((uint64_t)(stripe) * 0x9E3779B97F4A7C15ULL) >> (64 - lock_bits)))
+
+/* Lock regions
+ * Address ranges can be registered with their own granularity (2^shift
+ * bytes per lock) and hash function, everything else uses the default
+ * region. With LOCKS_ADAPTIVE, regions that suffer from false conflicts
+ * (the owner of the lock never wrote our address) get a finer
+ * granularity or the multiplicative hash.
+ */
+#define STM_REGION_HASH_MULT 0x1			/* use LOCK_HASH_MULTIPLY instead of shift & mask */
+#define STM_REGION_ADAPTIVE 0x2				/* adapt shift and hash to false conflicts */
+
+/* conflicts of a decision window, indexed by the result of lock_classify_conflict */
+enum {
+	CONFLICT_UNKNOWN = 0,				/* the owner has no write to this lock (yet) */
+	CONFLICT_TRUE = 1,				/* the owner wrote the same word */
+	CONFLICT_STRIPE = 2,				/* the owner wrote another word of the stripe */
+	CONFLICT_ALIAS = 3				/* the owner wrote another stripe with the same lock */
+};
+typedef struct lock_conflicts {
+    volatile stm_word_t total;
+    volatile stm_word_t nr[4];
+} __attribute__ ((aligned (64))) lock_conflicts_t;
+
+#if defined(LOCKS_ADAPTIVE) && !(defined(LOCK_REGIONS) && defined(ADAPTIVENESS))
+#error "LOCKS_ADAPTIVE needs LOCK_REGIONS and ADAPTIVENESS"
+#endif
+#if defined(LOCKS_RESIZE) || defined(LOCKS_ADAPTIVE)
+#define LOCKS_CLASSIFY
+#define LOCK_CLASSIFY_MAX_WRITES 256 /* max. write entries of the owner we look at */
+#endif
+
+#ifdef LOCK_REGIONS
+#define LOCK_REGIONS_MAX 16
+#ifdef __LP64__
+#define LOCK_MIN_SHIFT 3 /* one word per lock */
+#else
+#define LOCK_MIN_SHIFT 2
+#endif
+#define LOCK_MAX_SHIFT 16
+#define LOCK_ADAPT_MIN_CONFLICTS 1024 /* conflicts per decision window */
+#define LOCK_ADAPT_FALSE_PERCENT 25 /* adapt if more false conflicts of one kind */
+typedef struct lock_region {
+    stm_word_t start;
+    stm_word_t size;
+    stm_word_t shift;
+    stm_word_t flags;					/* STM_REGION_* */
+#ifdef LOCKS_ADAPTIVE
+    lock_conflicts_t conflicts;
+#endif
+} __attribute__ ((aligned (64))) lock_region_t;
+lock_region_t lock_regions[LOCK_REGIONS_MAX + 1];	/* the last one is the default region */
+stm_word_t lock_nregions;
+#define LOCK_DEFAULT_REGION (&lock_regions[LOCK_REGIONS_MAX])
+#ifdef LOCKS_ADAPTIVE
+unsigned long lock_adaptations;
+#endif
+#endif
 
-#define LOCK_IDX_FROM_ADDR(addr) (((stm_word_t)addr >> LOCK_SHIFT) & LOCK_MASK)
+/* Online resize of the lock table
+ * If too many conflicts are aliases (the owner wrote a different stripe
+ * that maps to the same lock), the table is rebuilt with twice the
+ * entries.
+ */
+#ifdef LOCKS_RESIZE
+#define LOCK_RESIZE_MIN_CONFLICTS 4096 /* conflicts per decision window */
+#define LOCK_RESIZE_ALIAS_PERCENT 25 /* grow if more aliases than that */
+lock_conflicts_t lock_table_conflicts;
+unsigned long lock_resizes;
+#endif
+
+/* Changing the mapping of addresses to locks drains all transactions:
+ * stm_start sets in_flight and then checks lock_quiesce_pending, the
+ * quiescing thread sets pending and then waits for in_flight == 0. An
+ * expedited membarrier on the slow side orders both, without it every
+ * stm_start needs a fence. Escalated transactions (past their deadline)
+ * use the same drain to run alone.
+ */
+#define LOCKS_QUIESCE
+int lock_quiesce_fence;					/* 1 if membarrier is not available */
+volatile stm_word_t lock_quiesce_pending;		/* 1 while the mapping changes */
+#define LOCK_QUIESCE_FENCE() do { if (unlikely(lock_quiesce_fence)) __sync_synchronize(); \
+	else __asm__ __volatile__("": : :"memory"); } while (0)
+
+#if defined(LOCK_REGIONS)
+#define LOCK_IDX_RAW(addr) lock_idx_from_addr((stm_word_t)(addr))
+#define LOCK_SHIFT_OF(addr) (lock_region_of((stm_word_t)(addr))->shift)
+#elif defined(LOCK_HASH_MULT)
+#define LOCK_IDX_RAW(addr) LOCK_HASH_MULTIPLY((stm_word_t)(addr) >> LOCK_SHIFT)
+#define LOCK_SHIFT_OF(addr) LOCK_SHIFT
+#else
+#define LOCK_IDX_RAW(addr) (((stm_word_t)addr >> LOCK_SHIFT) & LOCK_MASK)
+#define LOCK_SHIFT_OF(addr) LOCK_SHIFT
+#endif
+#define LOCK_IDX_FROM_ADDR(addr) LOCK_IDX_HOT(LOCK_PERMUTE(LOCK_IDX_RAW(addr)))
 #define ADDR2LOCKADDR(addr) (locks + LOCK_IDX_FROM_ADDR(addr))
+#define LOCK_ADDR_FROM_IDX(idx) (locks + (idx))
 #define LOCK_GET_VALUE(addr) ((stm_word_t)*(addr)) /* get the value of the lock */
 #define LOCK_GET_VERSION_FROM_VALUE(lockValue) ((stm_word_t)lockValue) /* Get version */
 #define LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) ((stm_tx_t*)lockValue) /* Get address of owner */
@@ -151,6 +355,60 @@ volatile stm_word_t *locks;
 //#define WBLOOMHASH(addr) ((addr>>LOCK_SHIFT)^(addr<<NUM_BITS_FOR_HASH))
 //#define WBLOOMHASH(addr) (addr)
 #define WBLOOMHASH(addr) (1 << ((((stm_word_t)addr>>3)^((stm_word_t)addr>>5)) & 0x3F))
+/* buf_get_write_addr: allocate, the caller already owns the lock (and knows that addr has no entry yet) */
+#define WBUF_LOCKED 2
+#define WBUF_NEW 3
+/* write entries of partly written words (mask) are merged with memory */
+#define WMASK_ALL (~(stm_word_t)0)
+#define WMASK_MERGE(write, mem) (((mem) & ~(write)->mask) | ((write)->value & (write)->mask))
+/* the word that contains a sub-word address and the offset in it */
+#define SUBWORD_BASE(addr) ((stm_word_t*)((stm_word_t)(addr) & ~(stm_word_t)(sizeof(stm_word_t)-1)))
+#define SUBWORD_OFF(addr) ((stm_word_t)(addr) & (sizeof(stm_word_t)-1))
+
+/*************************************************************************
+ * Read-only transactions
+ *************************************************************************/
+#define RO_PROMOTE_COMMITS 16 /* write-free commits of a site before it runs read-only */
+#define RO_SITES 16 /* direct mapped table of transaction start sites per tx */
+#define RO_SITE_IDX(site) ((((stm_word_t)site) >> 2) & (RO_SITES-1))
+
+/* one start site (return address of stm_start) */
+typedef struct ro_site {
+    void *site;
+    unsigned long streak;				/* consecutive write-free commits */
+} ro_site_t;
+
+/* ADAPTIVE_LOCKING: every descriptor chooses eager or lazy locking at
+ * stm_start. If more than LOCKING_ABORT_PERCENT of the transactions of
+ * an adaptation period abort, transactions that would hold their locks
+ * for more than LOCKING_LAZY_HELD percent of their accesses (the ones
+ * after the first write) lock at commit time, the ones below
+ * LOCKING_EAGER_HELD lock on the first write. Write-through needs
+ * eager locking. Without ADAPTIVE_LOCKING EAGER_LOCKING decides.
+ */
+#define LOCKING_ABORT_PERCENT 60
+#define LOCKING_LAZY_HELD 50
+#define LOCKING_EAGER_HELD 25
+#ifdef ADAPTIVE_LOCKING
+#if !defined(ADAPTIVENESS) || !defined(WRITEBACK)
+#error "ADAPTIVE_LOCKING needs ADAPTIVENESS and WRITEBACK"
+#endif
+#define TX_EAGER(tx) (!(tx)->lazy)
+#elif defined(EAGER_LOCKING)
+#define TX_EAGER(tx) 1
+#else
+#define TX_EAGER(tx) 0
+#endif
+
+/* stores are buffered in the write set (otherwise written in place) */
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+#define TX_WRITEBACK(tx) (!(tx)->writethrough)
+#elif defined(WRITEBACK)
+#define TX_WRITEBACK(tx) 1
+#else
+#define TX_WRITEBACK(tx) 0
+#endif
+
 
 /*************************************************************************
  * Global version counter definitions
@@ -165,6 +423,53 @@ volatile stm_word_t gv_counter;
 #endif
 #define GLOBAL_VERSION_INC (FETCH_ADD(&GLOBAL_VERSION,2))
 
+/* Clock strategies (default: one FETCH_ADD per writing commit)
+ * CLOCK_GV4: TL2 GV4, try one CAS and use the version of the winner on failure
+ * CLOCK_GV5: commit with GLOBAL_VERSION+2, the clock is only moved forward by
+ *            transactions that see a too new version (aborts and extensions)
+ * CLOCK_GV6: like GV5, but every CLOCK_GV6_PERIOD-th commit uses GV4
+ * CLOCK_TLC: thread local clocks, the version in the lock contains the
+ *            id of the writer and its local clock (no read-set extension)
+ */
+/* CLOCK_TSC: versions are taken from the (invariant) time stamp counter,
+ *            commits are pushed clock_tsc_skew cycles into the future to
+ *            cover the offset between cores. Falls back to the default
+ *            clock if the cpu has no constant_tsc/nonstop_tsc/rdtscp.
+ */
+#if defined(CLOCK_GV4) + defined(CLOCK_GV5) + defined(CLOCK_GV6) + defined(CLOCK_TLC) + defined(CLOCK_TSC) > 1
+#error "select at most one of CLOCK_GV4, CLOCK_GV5, CLOCK_GV6, CLOCK_TLC and CLOCK_TSC"
+#endif
+
+#define CLOCK_GV6_PERIOD 32 /* must be a power of 2 */
+
+#ifdef CLOCK_TLC
+#ifdef __LP64__
+#define TLC_TID_BITS 10
+#else
+#define TLC_TID_BITS 6
+#endif
+#define TLC_MAX_THREADS (1 << TLC_TID_BITS)
+#define TLC_VERSION(tid, clock) ((((stm_word_t)clock) << (TLC_TID_BITS+1)) | ((tid) << 1) | LOCK_FREE)
+#define TLC_TID_FROM_VERSION(version) ((((stm_word_t)version) >> 1) & (TLC_MAX_THREADS-1))
+#define TLC_CLOCK_FROM_VERSION(version) (((stm_word_t)version) >> (TLC_TID_BITS+1))
+/* slots of the clock vector (protected by unused_tx_mutex), stm_delete
+ * returns the slot and its clock to the free list */
+stm_word_t tlc_next_id;
+stm_word_t tlc_nr_free;
+stm_word_t tlc_free_ids[TLC_MAX_THREADS];
+stm_word_t tlc_clocks[TLC_MAX_THREADS];
+#endif
+
+#ifdef CLOCK_TSC
+#ifndef __LP64__
+#error "CLOCK_TSC needs 64 bit lock words"
+#endif
+#define TSC_VERSION(tsc) ((((stm_word_t)tsc) << 1) | LOCK_FREE)
+#define TSC_CALIBRATION_ROUNDS 1000
+int clock_tsc;						/* 1 if the tsc is used, 0 for the fallback */
+stm_word_t clock_tsc_skew;				/* max. offset between two cores (in cycles) */
+#endif
+
 
 /*************************************************************************
  * transaction struct definitions
@@ -179,9 +484,281 @@ enum {
 	TX_WAITING = 4
 };
 
+/*************************************************************************
+ * Contention management
+ *************************************************************************/
+/* Policies, selected per descriptor with stm_set_cm (default: ADAPTSTM_CM
+ * environment variable or yield). Policies that abort the lock owner set
+ * its cm_abort to the serial of its current attempt, the owner polls the
+ * flag in stm_load, stm_store, stm_commit and while it waits itself.
+ */
+#define STM_CM_YIELD 0					/* yield, give up after some yields (the old behaviour) */
+#define STM_CM_BACKOFF 1				/* randomized exponential backoff, then give up */
+#define STM_CM_KARMA 2					/* more work (kept over retries) wins, waiting adds karma */
+#define STM_CM_POLKA 3					/* karma with exponential backoff while waiting */
+#define STM_CM_GREEDY 4					/* the older transaction (first start) wins */
+#define STM_CM_AGGRESSIVE 5				/* always abort the owner */
+#define STM_CM_POLICIES 6
+
+#define CM_BACKOFF_MIN 64 /* spins of the first backoff round */
+#define CM_BACKOFF_MAX_ROUNDS 12 /* backoff limit doubles up to 2^12 times the minimum */
+#define CM_KARMA_WAIT 1 /* karma gained per wait round */
+
+#define CM_ABORT_REQUESTED(tx) ((tx)->cm_abort==(tx)->cm_serial)
+#define CM_CHECK_ABORT(tx) do { if (unlikely(CM_ABORT_REQUESTED(tx))) cm_remote_aborted(tx); } while (0)
+
+int cm_default_policy;
+
+/* Priority classes: a transaction never waits politely for an owner of
+ * a lower class (it asks the owner to abort and waits), a transaction
+ * of a lower class backs off and retries. The policy only decides
+ * between transactions of the same class.
+ */
+#define STM_PRIO_LOW 0					/* batch / maintenance */
+#define STM_PRIO_NORMAL 1				/* default */
+#define STM_PRIO_HIGH 2					/* latency critical */
+#define STM_PRIO_LEVELS 3
+#define CM_PRIO_LOW_WAITS 2 /* backoff rounds before a lower class tx retries */
+#define CM_PRIO_BACKOFF 2 /* additional backoff rounds per class difference */
+
+/* Deadlines: stm_start_deadline converts a budget in ns to an absolute
+ * value of the cm clock. A transaction past its deadline times out or
+ * escalates (drains all others and runs alone) at its next start. With
+ * less than CM_DEADLINE_URGENT_NS left, waiting for an owner would
+ * likely miss the deadline, so the owner is asked to abort unless its
+ * own deadline is earlier.
+ * The cm clock (deadlines, greedy timestamps) is the TSC if the cpu has
+ * an invariant TSC and rdtscp, otherwise CLOCK_MONOTONIC in ns. It is
+ * set up (and the TSC calibrated) when it is used for the first time.
+ */
+#define STM_DEADLINE_NS 0x0				/* relative budget in ns */
+#define STM_DEADLINE_TSC 0x1				/* absolute value of the cm clock */
+#define STM_DEADLINE_ESCALATE 0x2			/* run alone instead of timing out */
+#define STM_TIMED_OUT 1
+#define CM_DEADLINE_URGENT_NS 50000
+#define CM_TSC_CALIBRATE_NS 1000000
+unsigned long cm_tsc_khz;				/* cm clock ticks per ms (TSC: calibrated) */
+unsigned long cm_deadline_urgent;			/* CM_DEADLINE_URGENT_NS in cm clock ticks */
+int cm_clock_tsc;					/* 1: the cm clock is the TSC */
+volatile int cm_clock_ready;				/* set after the cm clock is set up */
+pthread_once_t cm_clock_once = PTHREAD_ONCE_INIT;
+
+#ifdef GLOBAL_STATS
+/* commit latency (first start to commit, in TSC cycles) of a class */
+#define PRIO_LAT_BUCKETS 64 /* log2 buckets */
+typedef struct prio_latency {
+    unsigned long commits;
+    unsigned long cycles;
+    unsigned long max;
+    unsigned long buckets[PRIO_LAT_BUCKETS];
+} prio_latency_t;
+prio_latency_t prio_latency[STM_PRIO_LEVELS];		/* of deleted descriptors (unused_tx_mutex) */
+#endif
+
+/* With CM_BLOCKING waiters spin for CM_SPIN_NS and then sleep on a futex
+ * of the lock owner, which is woken when the owner releases its locks
+ * (only if somebody waits). A membarrier of the waiter orders its
+ * registration with the release of the owner, without it the sleep
+ * is bounded by CM_BLOCK_TIMEOUT_NS.
+ */
+#ifdef CM_BLOCKING
+#define CM_SPIN_NS 2000
+#define CM_BLOCK_TIMEOUT_NS 1000000
+unsigned long cm_spin_pauses;				/* pause instructions for CM_SPIN_NS (calibrated) */
+int cm_block_membarrier;				/* 1 if membarrier is available */
+#define CM_WAIT(tx, other, lock) cm_block(tx, other, lock)
+#else
+#define CM_WAIT(tx, other, lock) sched_yield()
+#endif
+
+/* Always-on counters: every descriptor keeps its own cache line(s),
+ * only its thread writes them. Updates increment seq before and after
+ * (odd: update in progress), stm_get_stats copies a descriptor until it
+ * read the same even seq before and after the copy.
+ */
+#define STM_STATS_SUMS (offsetof(stm_stats_t, max_reads)/sizeof(unsigned long))
+typedef struct tx_stats {
+    volatile unsigned long seq;
+    stm_stats_t s;
+#ifdef CYCLE_STATS
+    stm_hist_t hist[STM_HISTS];				/* indexed by STM_HIST_* */
+#endif
+} __attribute__((aligned(64))) tx_stats_t;
+#define TX_STATS_BEGIN(tx) do { (tx)->stats.seq++; asm __volatile__("": : :"memory"); } while (0)
+#define TX_STATS_END(tx) do { asm __volatile__("": : :"memory"); (tx)->stats.seq++; } while (0)
+#define TX_STAT_INC(tx, field) do { TX_STATS_BEGIN(tx); (tx)->stats.s.field++; TX_STATS_END(tx); } while (0)
+/* records the cause and restarts */
+#define TX_ABORT(tx, reason) do { (tx)->abort_reason = (reason); stm_retry(tx); } while (0)
+
+/* ABORT_PROFILE: stm_retry attributes every abort to the lock (and
+ * address) that caused it, to the application code that accessed it
+ * (return address of stm_load/stm_store/stm_commit) and, if the other
+ * transaction is known, to the pair of start sites. The counts go into
+ * small open addressing tables, an abort that finds no slot within
+ * PROF_PROBES is only counted as dropped. The accesses only remember
+ * their return address.
+ */
+#ifdef ABORT_PROFILE
+#define PROF_BITS 10
+#define PROF_SLOTS (1 << PROF_BITS)
+#define PROF_PROBES 8
+#define PROF_TOP 10 /* entries printed per table */
+#define PROF_NONE (~0UL) /* prof_lock: no lock index known */
+#define PROF_CLAIMED (~1UL) /* key of a slot whose key2 is being written, never a real key */
+typedef struct prof_entry {
+    volatile stm_word_t key, key2;			/* 0: free */
+    volatile stm_word_t count;
+    volatile stm_word_t by[STM_ABORT_REASONS];
+    volatile stm_word_t addr;				/* lock table: last address */
+    volatile stm_word_t site;				/* site table: start site */
+} prof_entry_t;
+prof_entry_t prof_locks[PROF_SLOTS];			/* key: lock index + 1 */
+prof_entry_t prof_sites[PROF_SLOTS];			/* key: return address of the access */
+prof_entry_t prof_edges[PROF_SLOTS];			/* key: start site of the aborted tx, key2: of the other */
+#define PROF_PC(tx) ((tx)->prof_pc = __builtin_return_address(0))
+#define PROF_CONFLICT(tx, idx, address, other) do { (tx)->prof_lock = (idx); \
+	(tx)->prof_addr = (stm_word_t)(address); (tx)->prof_other = (other); } while (0)
+#define PROF_CLEAR(tx) PROF_CONFLICT(tx, PROF_NONE, 0, NULL)
+#else
+#define PROF_PC(tx) do { } while (0)
+#define PROF_CONFLICT(tx, idx, address, other) do { } while (0)
+#define PROF_CLEAR(tx) do { } while (0)
+#endif
+
+/* TX_TRACE: if ADAPTSTM_TRACE names a file, every descriptor writes
+ * its events (adaptstm-trace.h) into a ring of TRACE_RING records. Only
+ * the thread of the descriptor moves trace_head, only the flusher
+ * (a background thread every TRACE_FLUSH_MS, and stm_exit) moves
+ * trace_tail, a full ring drops events. Read the file with stmtrace.
+ */
+#ifdef TX_TRACE
+#define TRACE_RING_BITS 16
+#define TRACE_RING (1 << TRACE_RING_BITS)
+#define TRACE_FLUSH_MS 10
+FILE *trace_file;					/* NULL: tracing is off */
+pthread_t trace_thread;
+volatile stm_word_t trace_running;
+pthread_mutex_t trace_mutex;				/* one flusher at a time */
+stm_word_t trace_next_id;
+#define TRACE_ID(tx) ((tx)!=NULL ? (tx)->trace_id : TRACE_NOBODY)
+#define TRACE(tx, type, info, arg, other) \
+	do { if (unlikely((tx)->trace_ring!=NULL)) trace_add(tx, type, info, arg, other); } while (0)
+#else
+#define TRACE(tx, type, info, arg, other) do { } while (0)
+#endif
+
+/* LIVE_STATS: stm_init publishes the counters and the adaptation state
+ * of every descriptor in a POSIX shared memory segment
+ * (adaptstm-live.h), watch it with stmtop. The slot of a descriptor is
+ * refreshed at every commit and abort. */
+#ifdef LIVE_STATS
+live_segment_t *live_seg;				/* NULL if shm_open failed */
+char live_name[64];
+#define LIVE_UPDATE(tx) do { if ((tx)->live!=NULL) live_update(tx); } while (0)
+#else
+#define LIVE_UPDATE(tx) do { } while (0)
+#endif
+
+/* PERF_COUNTERS: every thread opens a group of hardware counters
+ * (perf_event_open, user space only) and reads them with rdpmc at the
+ * start, at the commit phase boundaries and at the abort. The deltas
+ * go to the start site of the transaction in a small table of the
+ * descriptor (updated under the stats sequence counter). Without
+ * perf (or without permission) nothing is counted. */
+#ifdef PERF_COUNTERS
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES 2				/* L1D read misses */
+#define PERF_LLC_MISSES 3
+#define PERF_DTLB_MISSES 4				/* dTLB read misses */
+#define PERF_BRANCH_MISSES 5
+#define PERF_EVENTS 6
+#define PERF_PHASE_ACQUIRE 0
+#define PERF_PHASE_VALIDATE 1
+#define PERF_PHASE_WRITEBACK 2
+#define PERF_PHASE_RELEASE 3
+#define PERF_PHASES 4
+#define PERF_SITES 32					/* per descriptor, more sites share the last one */
+typedef struct perf_site {
+    void *site;						/* return address of stm_start, NULL: free */
+    unsigned long commits, aborts, writers;		/* writers: commits with a write set */
+    uint64_t body[PERF_EVENTS];				/* start to commit of committed attempts */
+    uint64_t aborted[PERF_EVENTS];			/* start to abort */
+    uint64_t phase[PERF_PHASES][PERF_EVENTS];		/* commit phases of writers */
+} perf_site_t;
+stm_word_t perf_disabled;				/* perf_event_open failed once */
+#define PERF_SAMPLE(tx, values) do { if ((tx)->perf_cur!=NULL) perf_read(tx, values); } while (0)
+#else
+#define PERF_SAMPLE(tx, values) do { } while (0)
+#endif
+
+/* ACCESS_RECORD: if ADAPTSTM_RECORD names a file, every descriptor
+ * records the accesses of its committed attempts (adaptstm-record.h)
+ * into a buffer, an abort rewinds the buffer to the start of the
+ * attempt. The buffer is written out at a start once it holds
+ * REC_FLUSH bytes, at stm_delete and at stm_exit. Page and site ids
+ * come from global maps (rec_mutex), every descriptor caches
+ * REC_CACHE pages and REC_SITE_CACHE sites. Replay the file with
+ * bench/replay. */
+#ifdef ACCESS_RECORD
+#define REC_FLUSH (1 << 16)
+#define REC_CACHE 256
+#define REC_SITE_CACHE 16
+#define REC_HASH(key) (((key) * 0x9e3779b97f4a7c15UL) >> 20)
+typedef struct rec_map {
+    stm_word_t *keys;					/* key+1, 0: free */
+    stm_word_t *ids;
+    stm_word_t size;					/* power of 2 */
+    stm_word_t count;
+} rec_map_t;
+typedef struct rec_cache {
+    stm_word_t key;					/* page or site, ~0: free */
+    stm_word_t id;
+} rec_cache_t;
+FILE *rec_file;						/* NULL: recording is off */
+pthread_mutex_t rec_mutex;				/* the file and the maps */
+rec_map_t rec_pages, rec_sites;
+stm_word_t rec_next_id;
+#define REC(tx, type, addr) \
+	do { if (unlikely((tx)->rec_buf!=NULL)) rec_access(tx, type, (stm_word_t)(addr)); } while (0)
+#define REC_RANGE(tx, type, addr, size) \
+	do { if (unlikely((tx)->rec_buf!=NULL)) rec_range(tx, type, (stm_word_t)(addr), size); } while (0)
+#else
+#define REC(tx, type, addr) do { } while (0)
+#define REC_RANGE(tx, type, addr, size) do { } while (0)
+#endif
+
+/* Runtime parameters (stm_set_parameter/stm_get_parameter). The
+ * descriptors keep a copy: stm_new and the adaptation in stm_start
+ * (once per period, if stm_param_epoch changed) copy the global values
+ * unless the parameter was set on the descriptor itself.
+ */
+#define ADAPT_PERIOD 64 /* commits between two adaptations */
+#define ADAPT_RETRY_PERCENT 60 /* more retries per commit: write-back instead of write-through */
+#define WHASH_GROW_PERCENT 33 /* grow the write hash above that load */
+#define WHASH_SHRINK_PERCENT 10 /* shrink it below that load */
+enum {
+    STM_PARAM_ADAPT_PERIOD,
+    STM_PARAM_ADAPT_RETRY_PERCENT,
+    STM_PARAM_WHASH_GROW_PERCENT,
+    STM_PARAM_WHASH_SHRINK_PERCENT,
+    STM_PARAM_NRWBEFOREHASH,
+    STM_PARAM_MAX_YIELDS,
+    STM_PARAM_BACKOFF_MAX_ROUNDS,
+    STM_PARAM_LOCKING_ABORT_PERCENT,
+    STM_PARAM_LOCKING_LAZY_HELD,
+    STM_PARAM_LOCKING_EAGER_HELD,
+    STM_PARAMS
+};
+#define TX_PARAM(tx, p) ((tx)->param[STM_PARAM_##p])
+unsigned long stm_params[STM_PARAMS];			/* global values */
+volatile unsigned long stm_param_epoch;			/* incremented by every global change */
+
 /* transaction struct */
 typedef struct stm_tx {
     stm_word_t status;					/* Transaction status (not read by other threads) */
+    volatile stm_word_t in_flight;			/* 1 from stm_start until the end of commit/abort */
+    struct stm_tx *next_tx;				/* list of all descriptors */
     stm_word_t max_version;				/* Max version which may be read without extending the readset */
     //readset_t **readhash;				/* Hash table for tx local reads */
     //stm_word_t readbloom;				/* Bloom filter for tx local reads (if bloom hit -> search table) */
@@ -198,6 +775,9 @@ typedef struct stm_tx {
     readset_t *readset;
     stm_word_t nrreads;
     stm_word_t maxreads;
+    uint64_t *readfilter;				/* locks that are already in the read set */
+    stm_word_t readfiltermask;
+    uint32_t readepoch;					/* current tag of the read filter */
 
     stm_word_t writesize, locksize, readsize;
     stm_word_t whashsize;
@@ -208,6 +788,21 @@ typedef struct stm_tx {
     
     stm_word_t adaptive_hash;
     stm_word_t writethrough;
+#ifdef ADAPTIVE_LOCKING
+    stm_word_t lazy;					/* 1: acquire the locks at commit */
+    unsigned long first_write;				/* accesses before the first write */
+    unsigned long adaptaccesses, adaptheld;		/* accesses of writers, of them after the first write */
+#endif
+#ifdef LOCKS_HOT
+    unsigned long lock_samples;				/* lock acquisitions until the next sample */
+#endif
+
+    stm_word_t readonly;				/* loads are not logged, stores restart the tx */
+    stm_word_t ro_forbidden;				/* a store restarted this tx, run it in normal mode */
+#ifdef ADAPTIVE_READONLY
+    ro_site_t *ro_site;					/* start site of the current tx */
+    ro_site_t ro_sites[RO_SITES];
+#endif
     
     bufferslab_t *freeslabs;				/* amount of free slabs for this tx */
     
@@ -217,10 +812,40 @@ typedef struct stm_tx {
     
     mem_block_t *allocated;				/* Memory allocated by this transation (freed upon abort) */
     mem_block_t *freed;					/* Memory freed by this transation (freed upon commit) */
+    range_chunk_t *range_chunks;			/* scratch memory of the range accesses, newest first */
+    range_buf_t *range_pending;				/* write-back buffers that are not finished yet */
+    range_undo_t *range_undo;				/* write-through: stripes written by range accesses */
+
+#ifdef CLOCK_TLC
+    stm_word_t tlc_id;					/* slot of this tx in the clock vector */
+    stm_word_t tlc_clock;				/* local clock (incremented on every writing commit) */
+    stm_word_t *tlc_seen;				/* last clock seen from every other tx */
+#endif
+#ifdef CLOCK_GV6
+    unsigned long gv6_commits;				/* writing commits (every CLOCK_GV6_PERIOD-th uses GV4) */
+#endif
 
     struct stm_tx *waiting_for;				/* Current transaction is waiting for transaction */
     unsigned int yielded;				/* Counter to count how often a transaction has sleept while waiting for a lock */
 
+    unsigned long param[STM_PARAMS];			/* copy of the runtime parameters */
+    unsigned long param_local;				/* bit p: param[p] was set on this descriptor */
+    unsigned long param_epoch;				/* stm_param_epoch of the copy */
+    stm_word_t cm_policy;				/* STM_CM_* */
+    volatile stm_word_t cm_serial;			/* attempt number, incremented on every start */
+    volatile stm_word_t cm_abort;			/* == cm_serial if another tx wants us to abort */
+    volatile unsigned long cm_karma;			/* work of the aborted attempts of this tx */
+    volatile uint64_t cm_timestamp;			/* first start of this tx (greedy), 0 if not set */
+    unsigned long cm_seed;				/* for the randomized backoff */
+    stm_word_t priority;				/* STM_PRIO_* */
+    uint64_t deadline;					/* absolute TSC value, 0 without deadline */
+    stm_word_t deadline_flags;				/* STM_DEADLINE_* */
+    stm_word_t escalated;				/* 1 while running alone after the deadline */
+#ifdef CM_BLOCKING
+    volatile int cm_futex;				/* incremented when waiters are woken */
+    volatile stm_word_t cm_waiters;			/* nr of transactions that sleep on cm_futex */
+#endif
+
     //void *begin_stack;					/* The following two pointers depict the stack region of the current */
     //void *end_stack;					/* Transaction. Memory accesses in this area not buffered */
     
@@ -232,12 +857,62 @@ typedef struct stm_tx {
     jmp_buf env;					/* Environment for setjmp/longjmp */
     //jmp_buf *jmp;					/* Pointer to environment (NULL when not using setjmp/longjmp) */
 
+    stm_word_t abort_reason;				/* STM_ABORT_* of the next stm_retry */
+    tx_stats_t stats;
+#ifdef CYCLE_STATS
+    uint64_t cyc_attempt;				/* TSC at the start of this attempt */
+    uint64_t cyc_start;					/* TSC at the first start of this tx, 0 if not set */
+#endif
+#ifdef ABORT_PROFILE
+    void *prof_site;					/* return address of stm_start */
+    void *prof_pc;					/* return address of the last access */
+    stm_word_t prof_lock;				/* lock index of the conflict, PROF_NONE if unknown */
+    stm_word_t prof_addr;
+    void *prof_other;					/* start site of the other transaction */
+    volatile stm_word_t prof_kill_lock;			/* set by the transaction that kills us */
+    void * volatile prof_kill_site;
+    stm_word_t prof_aborts;				/* recorded aborts (stm_dump_profile sums them) */
+    stm_word_t prof_dropped;				/* aborts without a free slot */
+#endif
+#ifdef TX_TRACE
+    trace_rec_t *trace_ring;				/* NULL if tracing is off */
+    volatile uint64_t trace_head;			/* next record to write */
+    volatile uint64_t trace_tail;			/* next record to flush */
+    uint64_t trace_dropped;
+    stm_word_t trace_id;
+    volatile stm_word_t trace_killer;			/* id of the tx that asked us to abort */
+#endif
+#ifdef LIVE_STATS
+    live_thread_t *live;				/* slot in live_seg or NULL */
+#endif
+#ifdef ACCESS_RECORD
+    uint8_t *rec_buf;					/* NULL if recording is off */
+    stm_word_t rec_len, rec_size;
+    stm_word_t rec_mark;				/* rec_len at the start of this attempt */
+    stm_word_t rec_last, rec_mark_last;			/* last recorded address (delta base) */
+    stm_word_t rec_id;
+    rec_cache_t rec_pages[REC_CACHE];
+    rec_cache_t rec_sites[REC_SITE_CACHE];
+#endif
+#ifdef PERF_COUNTERS
+    int perf_fd[PERF_EVENTS];				/* -1: not available */
+    struct perf_event_mmap_page *perf_page[PERF_EVENTS];
+    stm_word_t perf_tid;				/* thread the counters belong to */
+    perf_site_t *perf_cur;				/* site of this attempt, NULL: no counters */
+    uint64_t perf_start[PERF_EVENTS];
+    perf_site_t perf_sites[PERF_SITES];
+#endif
+
 #if defined(STATS) || defined(GLOBAL_STATS)
     stm_word_t start;					/* Start timestamp */
     unsigned long retries;				/* Retries of the same transaction */
     unsigned long aborts;				/* Total number of aborts (cumulative) */
     unsigned long commits;				/* Total number of commits */
 #endif
+#ifdef GLOBAL_STATS
+    uint64_t lat_start;					/* TSC at the first start of this tx, 0 if not set */
+    prio_latency_t latency[STM_PRIO_LEVELS];
+#endif
 #ifdef STATS
     //    unsigned long nb_writes;             /* Total number of writes */
     unsigned long nb_reads;              /* Total number of reads  */
@@ -258,6 +933,17 @@ typedef struct stm_tx {
     unsigned long nb_lock_ver_err_rec;
 
     unsigned long nb_read_ver_change;
+    unsigned long nb_read_dups;
+
+    unsigned long nb_commit_validate;
+    unsigned long nb_commit_novalidate;
+    unsigned long nb_clock_cas_fail;
+
+    unsigned long nb_ro_commits;
+    unsigned long nb_ro_restarts;
+    unsigned long nb_cm_kills;				/* remote aborts requested by this tx */
+    unsigned long nb_cm_killed;				/* remote aborts of this tx */
+    unsigned long nb_cm_blocks;				/* sleeps on the futex of a lock owner */
 #endif
 } stm_tx_t;
 
@@ -277,6 +963,7 @@ unsigned long xxstm_nr_tx = 0;
 inline static void static_assert_structure_offsets() {
         static_assert(SIZEOFSLAB >= sizeof(bufferslab_t));
 	static_assert(NRWBEFOREHASH<=NRWRITESINSLAB);
+	static_assert(LOCK_MAX_BITS<=32); /* lock index in readset_t */
 }
 
 /*************************************************************************
@@ -287,6 +974,9 @@ inline static void static_assert_structure_offsets() {
       
 /* global functions */
 void stm_init();
+void stm_init_locks(unsigned int bits);
+int stm_register_region(void *addr, size_t size, unsigned int shift, int flags);
+void stm_unregister_region(void *addr);
 void stm_exit();
 jmp_buf *stm_get_env(stm_tx_t *tx);
 
@@ -297,9 +987,39 @@ void stm_commit(stm_tx_t *tx);
 inline void stm_retry(stm_tx_t *tx);
 
 void stm_start(stm_tx_t *tx, jmp_buf *env);
+void stm_start_ro(stm_tx_t *tx, jmp_buf *env);
+int stm_start_deadline(stm_tx_t *tx, jmp_buf *env, uint64_t deadline, int flags);
+void stm_set_cm(stm_tx_t *tx, int policy);
+int stm_get_cm(stm_tx_t *tx);
+void stm_set_priority(stm_tx_t *tx, int level);
+int stm_get_priority(stm_tx_t *tx);
+int stm_set_parameter(stm_tx_t *tx, const char *key, void *val);
+int stm_get_parameter(stm_tx_t *tx, const char *key, void *val);
+void stm_get_stats(stm_tx_t *tx, stm_stats_t *stats);
+void stm_get_hist(stm_tx_t *tx, int which, stm_hist_t *hist);
+unsigned long stm_hist_percentile(const stm_hist_t *hist, double percent);
+void stm_dump_profile(FILE *out);
+void stm_reset_profile(void);
+void stm_dump_perf(FILE *out);
 
 stm_word_t stm_load(stm_tx_t *tx, stm_word_t *addr);
 void stm_store(stm_tx_t *tx, stm_word_t *addr, stm_word_t value);
+void stm_store2(stm_tx_t *tx, stm_word_t *addr, stm_word_t value, stm_word_t mask);
+uint8_t stm_load_u8(stm_tx_t *tx, volatile uint8_t *addr);
+uint16_t stm_load_u16(stm_tx_t *tx, volatile uint16_t *addr);
+uint32_t stm_load_u32(stm_tx_t *tx, volatile uint32_t *addr);
+void stm_store_u8(stm_tx_t *tx, volatile uint8_t *addr, uint8_t value);
+void stm_store_u16(stm_tx_t *tx, volatile uint16_t *addr, uint16_t value);
+void stm_store_u32(stm_tx_t *tx, volatile uint32_t *addr, uint32_t value);
+volatile void *stm_get_read_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+volatile void *stm_get_read2_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+volatile void *stm_get_write_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+volatile void *stm_get_modify_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+void stm_finish_writing(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes);
+void stm_load_bytes(stm_tx_t *tx, volatile void *addr, void *buf, size_t size);
+void stm_store_bytes(stm_tx_t *tx, volatile void *addr, const void *buf, size_t size);
+void stm_memcpy(stm_tx_t *tx, volatile void *to, volatile void *from, size_t size);
+void stm_memset(stm_tx_t *tx, volatile void *addr, int c, size_t size);
 
 void *stm_malloc(stm_tx_t *tx, size_t size);
 void stm_free(stm_tx_t *tx, void *addr);
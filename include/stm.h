@@ -41,18 +41,30 @@
                                             sigsetjmp(*buf, 1); \
                                             stm_start(STM_SELF, buf); \
                                         } while (0)
+#define STM_BEGIN_RO()                  do { \
+                                            sigjmp_buf *buf = stm_get_env(tx); \
+                                            sigsetjmp(*buf, 1); \
+                                            stm_start_ro(STM_SELF, buf); \
+                                        } while (0)
 
+/* STM_BEGIN_DEADLINE(budget, flags) { ... STM_END(); } else { timed out } */
+#define STM_BEGIN_DEADLINE(deadline, flags) \
+                                        if (({ \
+                                            sigjmp_buf *buf = stm_get_env(tx); \
+                                            sigsetjmp(*buf, 1); \
+                                            stm_start_deadline(STM_SELF, buf, deadline, flags); \
+                                        }) == 0)
 
 #define STM_END()                       stm_commit(STM_SELF)
 
 typedef volatile stm_word_t word;
 
 #define STM_READ(var)                   stm_load(STM_SELF, (word*)(void*)&(var))
-#define STM_READ_F(var)                 W2F(STM_READ(var))
+#define STM_READ_F(var)                 U322F(stm_load_u32(STM_SELF, (volatile uint32_t*)(void*)&(var)))
 #define STM_READ_P(var)                 W2VP(STM_READ(var))
 
 #define STM_WRITE(var, val)             ({stm_store(STM_SELF, (word*)(void*)&(var), (word)(val)); var;})
-#define STM_WRITE_F(var, val)           STM_WRITE(var, F2W(val,(word*)(void*)&(var)))
+#define STM_WRITE_F(var, val)           ({stm_store_u32(STM_SELF, (volatile uint32_t*)(void*)&(var), F2U32(val)); var;})
 #define STM_WRITE_P(var, val)           STM_WRITE(var, VP2W(val))
 
 #define STM_LOCAL_WRITE(var, val)       ({var = val; var;})
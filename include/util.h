@@ -26,7 +26,11 @@ extern "C" {
 #define DIM(A)                          (sizeof(A)/sizeof((A)[0]))
 #define UNS(a)                          ((ustm_word_t)(a))
 #define ASSERT(x)                       /* assert(x) */
-#define CTASSERT(x)                     ({ int a[1-(2*!(x))]; a[0] = 0;})
+#ifdef __cplusplus
+#define CTASSERT(x)                     static_assert(x, #x)
+#else
+#define CTASSERT(x)                     _Static_assert(x, #x)
+#endif
 
 
 /*
@@ -36,6 +40,9 @@ extern "C" {
 #define W2F(v)                         word2float(v)
 #define F2W(v,a)                         float2word(v,a)
 
+#define U322F(v)                       uint322float(v)
+#define F2U32(v)                       float2uint32(v)
+
 #define WP2FP(v)                       wordp2floatpp(v)
 #define FP2WP(v)                       floatp2wordp(v)
 
@@ -70,6 +77,8 @@ word2float (stm_word_t val)
 
 /* =============================================================================
  * float2word
+ * -- for full word stores only, the other half is read from addr; STM_WRITE_F
+ *    stores the float with stm_store_u32 (F2U32) and does not need it
  * =============================================================================
  */
 static __inline__ stm_word_t
@@ -94,6 +103,38 @@ float2word (float val, stm_word_t* addr)
 }
 
 
+/* =============================================================================
+ * uint322float
+ * =============================================================================
+ */
+static __inline__ float
+uint322float (uint32_t val)
+{
+    union {
+        uint32_t i;
+        float f;
+    } convert;
+    convert.i = val;
+    return convert.f;
+}
+
+
+/* =============================================================================
+ * float2uint32
+ * =============================================================================
+ */
+static __inline__ uint32_t
+float2uint32 (float val)
+{
+    union {
+        uint32_t i;
+        float f;
+    } convert;
+    convert.f = val;
+    return convert.i;
+}
+
+
 /* =============================================================================
  * wordp2floatp
  * =============================================================================
@@ -21,6 +21,7 @@
  * MA  02110-1301, USA.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -29,6 +30,24 @@
 #include <string.h>
 #include <sched.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#if defined(LOCKS_HUGEPAGES) || defined(LOCKS_NUMA_INTERLEAVE) || defined(LIVE_STATS) || defined(PERF_COUNTERS)
+#include <sys/mman.h>
+#endif
+#ifdef LIVE_STATS
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#ifdef PERF_COUNTERS
+#include <linux/perf_event.h>
+#endif
+#ifdef CM_BLOCKING
+#include <limits.h>
+#include <linux/futex.h>
+#endif
 #ifndef NO_SSE
 #include <emmintrin.h>
 #endif
@@ -84,6 +103,31 @@ inline static void sse2_memset128aligned(void *ptr, int n, stm_word_t word)
     _mm_sfence();
 }
 
+/* copies n bytes 64 at a time, neither side needs to be aligned */
+inline __always_inline static void sse2_memcpy(void *to, const void *from, size_t n)
+{
+    char *t = (char*)to;
+    const char *f = (const char*)from;
+#ifndef NO_SSE
+    __m128i a, b, c, d;
+
+    for (; n>=64; n-=64, t+=64, f+=64) {
+	a = _mm_loadu_si128((const __m128i*)&f[0]);
+	b = _mm_loadu_si128((const __m128i*)&f[16]);
+	c = _mm_loadu_si128((const __m128i*)&f[32]);
+	d = _mm_loadu_si128((const __m128i*)&f[48]);
+	_mm_storeu_si128((__m128i*)&t[0], a);
+	_mm_storeu_si128((__m128i*)&t[16], b);
+	_mm_storeu_si128((__m128i*)&t[32], c);
+	_mm_storeu_si128((__m128i*)&t[48], d);
+    }
+    for (; n>=16; n-=16, t+=16, f+=16) {
+	_mm_storeu_si128((__m128i*)t, _mm_loadu_si128((const __m128i*)f));
+    }
+#endif
+    memcpy(t, f, n);
+}
+
 /** allocates SIZEOFSLAB slab (128b to span 2 cachelines)
  *  this function is thread safe!
  */
@@ -138,25 +182,65 @@ static void free_slabs(stm_tx_t *tx, bufferslab_t *free, bufferslab_t *last)
 
 /* Called once (from main) to initialize STM infrastructure. */
 void stm_init()
+{
+    char *bits = getenv("ADAPTSTM_LOCK_BITS");
+    stm_init_locks((bits!=NULL) ? atoi(bits) : NUM_BITS_FOR_HASH);
+}
+
+/* Same as stm_init, but with a lock table of 2^bits entries */
+void stm_init_locks(unsigned int bits)
 {
     DEBUG_START
-    DPRINTF("stm init\n");
+    DPRINTF("stm init (%d lock bits)\n", bits);
     GLOBAL_VERSION=1;
     
     allocated = NULL;
     unused_tx = NULL;
+    all_tx = NULL;
     GLOBAL_VERSION=1;
     
-#ifdef VALGRIND
-    // valgrind cannot memalgin >1meg
-    if (posix_memalign((void**)&locks, LOCK_HASH_ARRAY_SIZE/4, LOCK_HASH_ARRAY_SIZE*sizeof(stm_word_t))) {
-#else
-    if (posix_memalign((void**)&locks, LOCK_HASH_ARRAY_SIZE*sizeof(stm_word_t), LOCK_HASH_ARRAY_SIZE*sizeof(stm_word_t))) {
+    if (bits<LOCK_MIN_BITS) bits = LOCK_MIN_BITS;
+    if (bits>LOCK_MAX_BITS) bits = LOCK_MAX_BITS;
+    lock_bits = bits;
+    lock_mask = (1UL << bits) - 1;
+    locks = lock_alloc_table(LOCK_TABLE_SIZE(LOCK_HASH_ARRAY_SIZE));
+    lock_reset(locks, LOCK_TABLE_SIZE(LOCK_HASH_ARRAY_SIZE));
+#ifdef LOCKS_HOT
+    lock_hot_reset();
+    lock_hot_promotions = 0;
+#endif
+    clock_init();
+    stm_param_init();
+    stm_reset_profile();
+    cm_init();
+#ifdef TX_TRACE
+    trace_init();
+#endif
+#ifdef LIVE_STATS
+    live_init();
+#endif
+#ifdef ACCESS_RECORD
+    rec_init();
+#endif
+#ifdef LOCK_REGIONS
+    lock_nregions = 0;
+    memset(LOCK_DEFAULT_REGION, 0x0, sizeof(lock_region_t));
+    LOCK_DEFAULT_REGION->shift = LOCK_SHIFT;
+#ifdef LOCK_HASH_MULT
+    LOCK_DEFAULT_REGION->flags |= STM_REGION_HASH_MULT;
+#endif
+#ifdef LOCKS_ADAPTIVE
+    LOCK_DEFAULT_REGION->flags |= STM_REGION_ADAPTIVE;
+    lock_adaptations = 0;
+#endif
+#endif
+#ifdef LOCKS_RESIZE
+    memset(&lock_table_conflicts, 0x0, sizeof(lock_conflicts_t));
+    lock_resizes = 0;
+#endif
+#ifdef LOCKS_QUIESCE
+    lock_quiesce_init();
 #endif
-	printf("Could not allocate locks\n");
-	exit(1);
-    }
-    lock_reset();
     pthread_mutex_init(&unused_tx_mutex, NULL);
 
 }
@@ -166,6 +250,24 @@ void stm_init()
 void stm_exit()
 {
     DPRINTF("stm exit\n");
+#ifdef ABORT_PROFILE
+    prof_exit();
+#endif
+#if defined(CYCLE_STATS) && defined(GLOBAL_STATS)
+    hist_print();
+#endif
+#ifdef TX_TRACE
+    trace_exit();
+#endif
+#ifdef ACCESS_RECORD
+    rec_exit();
+#endif
+#ifdef LIVE_STATS
+    live_exit();
+#endif
+#ifdef PERF_COUNTERS
+    perf_exit();
+#endif
     /* free buffers */
     while (allocated!=NULL) {
 	mem_block_t *cur = allocated;
@@ -173,9 +275,10 @@ void stm_exit()
 	free(cur->addr);
 	free(cur);
     }
-    free((stm_word_t*)locks);
+    lock_free_table(locks, LOCK_TABLE_SIZE(LOCK_HASH_ARRAY_SIZE));
 
     pthread_mutex_destroy(&unused_tx_mutex);
+    all_tx = NULL;
     while (unused_tx!=NULL) {
 	tx_block_t *cur = unused_tx;
 	unused_tx = unused_tx->next;
@@ -185,6 +288,17 @@ void stm_exit()
     
 #ifdef GLOBAL_STATS
     printf("Total nr of new transactions: %ld\n", xxstm_nr_tx);
+    prio_latency_print();
+#ifdef LOCKS_RESIZE
+    printf("Lock table: 2^%ld entries (%ld resizes)\n", lock_bits, lock_resizes);
+#endif
+#ifdef LOCKS_HOT
+    printf("Hot locks: %ld promotions\n", lock_hot_promotions);
+#endif
+#ifdef LOCKS_ADAPTIVE
+    printf("Lock regions: %ld adaptations, default region: shift %ld%s\n", lock_adaptations,
+	   LOCK_DEFAULT_REGION->shift, (LOCK_DEFAULT_REGION->flags & STM_REGION_HASH_MULT) ? " (mult. hash)" : "");
+#endif
 #endif
     DEBUG_END
 }
@@ -214,12 +328,22 @@ stm_tx_t *stm_new()
 	    unused_tx = unused_tx->next;
 	    newtx = (stm_tx_t*)cur->tx;
 	    free(cur);
+#ifdef CLOCK_TLC
+	    tlc_acquire_id(newtx);
+#endif
+#ifdef LIVE_STATS
+	    live_attach(newtx);
+#endif
 	    pthread_mutex_unlock(&unused_tx_mutex);
+#ifdef PERF_COUNTERS
+	    perf_open(newtx);
+#endif
 	    return newtx;
 	}
 	pthread_mutex_unlock(&unused_tx_mutex);
     }
-    if ((newtx = (stm_tx_t*)malloc(sizeof(stm_tx_t)))==NULL) {
+    /* the counters need their own cache line */
+    if (posix_memalign((void**)&newtx, 64, sizeof(stm_tx_t))!=0) {
 	perror("malloc: no free memory!");
 	exit(1);
     }
@@ -239,9 +363,13 @@ stm_tx_t *stm_new()
 
 
     newtx->status = TX_IDLE;
+    newtx->in_flight = 0;
 
     newtx->freeslabs = NULL;
     newtx->buffers = NULL;
+    newtx->range_chunks = NULL;
+    newtx->range_pending = NULL;
+    newtx->range_undo = NULL;
     newtx->writeset = alloc_slab(newtx);
 
     ret = posix_memalign((void**)&(newtx->lockset), 64, NRRLENTRIESINSET*sizeof(lockset_t));
@@ -254,10 +382,25 @@ stm_tx_t *stm_new()
 	perror("malloc: no free memory!");
 	exit(1);
     }
+    if (posix_memalign((void**)&newtx->readfilter, 64, RFILTER_MIN_SIZE*sizeof(uint64_t))!=0) {
+	perror("malloc: no free memory!");
+	exit(1);
+    }
+    memset(newtx->readfilter, 0x0, RFILTER_MIN_SIZE*sizeof(uint64_t));
+    newtx->readfiltermask = RFILTER_MIN_SIZE-1;
+    newtx->readepoch = 0;
 
 #ifdef ADAPTIVENESS
     // adaptiveness
     newtx->writethrough=1;
+#ifdef ADAPTIVE_LOCKING
+    newtx->lazy=0;
+    newtx->adaptaccesses=0;
+    newtx->adaptheld=0;
+#endif
+#ifdef LOCKS_HOT
+    newtx->lock_samples = LOCK_HOT_SAMPLE;
+#endif
 #ifdef ADAPTIVEHASH
     newtx->adaptive_hash=0;
 #endif
@@ -266,6 +409,8 @@ stm_tx_t *stm_new()
 #endif
     newtx->wtotal=0;
     newtx->nrtx=0;
+    newtx->adaptretries=0;
+    newtx->adaptcommits=1;
 #endif
     
     /* clear read and writeset */
@@ -275,6 +420,8 @@ stm_tx_t *stm_new()
     newtx->retries=0;
     newtx->aborts=0;
     newtx->commits=0;
+    newtx->lat_start=0;
+    memset(newtx->latency, 0x0, sizeof(newtx->latency));
     xxstm_nr_tx++;
 #endif
 #ifdef STATS
@@ -290,8 +437,106 @@ stm_tx_t *stm_new()
     newtx->nb_read_ver_err=0;
     newtx->nb_read_ver_err_rec=0;
     newtx->nb_read_ver_change=0;
+    newtx->nb_read_dups=0;
     newtx->nb_lock_ver_err=0;
     newtx->nb_lock_ver_err_rec=0;
+    newtx->nb_commit_validate=0;
+    newtx->nb_commit_novalidate=0;
+    newtx->nb_clock_cas_fail=0;
+    newtx->nb_ro_commits=0;
+    newtx->nb_ro_restarts=0;
+    newtx->nb_cm_kills=0;
+    newtx->nb_cm_killed=0;
+    newtx->nb_cm_blocks=0;
+#endif
+
+    newtx->readonly = 0;
+    newtx->ro_forbidden = 0;
+
+    newtx->param_local = 0;
+    stm_param_load(newtx);
+    newtx->abort_reason = STM_ABORT_EXPLICIT;
+    memset(&newtx->stats, 0x0, sizeof(tx_stats_t));
+#ifdef CYCLE_STATS
+    newtx->cyc_start = 0;
+#endif
+#ifdef PERF_COUNTERS
+    {
+	int i;
+	for (i=0; i<PERF_EVENTS; i++) {
+	    newtx->perf_fd[i] = -1;
+	    newtx->perf_page[i] = NULL;
+	}
+	newtx->perf_tid = 0;
+	newtx->perf_cur = NULL;
+	memset(newtx->perf_sites, 0x0, sizeof(newtx->perf_sites));
+    }
+#endif
+#ifdef TX_TRACE
+    newtx->trace_ring = NULL;
+    newtx->trace_head = 0;
+    newtx->trace_tail = 0;
+    newtx->trace_dropped = 0;
+    newtx->trace_killer = TRACE_NOBODY;
+    if (trace_file!=NULL && posix_memalign((void**)&newtx->trace_ring, 64, TRACE_RING*sizeof(trace_rec_t))!=0) {
+	perror("malloc: no free memory!");
+	exit(1);
+    }
+#endif
+#ifdef ABORT_PROFILE
+    newtx->prof_aborts = 0;
+    newtx->prof_dropped = 0;
+#endif
+    newtx->cm_policy = cm_default_policy;
+    newtx->cm_serial = 1;
+    newtx->cm_abort = 0;
+    newtx->cm_karma = 0;
+    newtx->cm_timestamp = 0;
+    newtx->cm_seed = (unsigned long)newtx | 1;
+    newtx->priority = STM_PRIO_NORMAL;
+    newtx->deadline = 0;
+    newtx->deadline_flags = 0;
+    newtx->escalated = 0;
+#ifdef CM_BLOCKING
+    newtx->cm_futex = 0;
+    newtx->cm_waiters = 0;
+#endif
+#ifdef ADAPTIVE_READONLY
+    memset(newtx->ro_sites, 0x0, sizeof(newtx->ro_sites));
+#endif
+
+#ifdef CLOCK_TLC
+    if ((newtx->tlc_seen = (stm_word_t*)calloc(TLC_MAX_THREADS, sizeof(stm_word_t)))==NULL) {
+	perror("malloc: no free memory!");
+	exit(1);
+    }
+#endif
+#ifdef CLOCK_GV6
+    newtx->gv6_commits = 0;
+#endif
+    
+    /* register the new descriptor */
+    pthread_mutex_lock(&unused_tx_mutex);
+#ifdef TX_TRACE
+    newtx->trace_id = trace_next_id++;
+#endif
+#ifdef ACCESS_RECORD
+    rec_new(newtx);
+#endif
+#ifdef CLOCK_TLC
+    tlc_acquire_id(newtx);
+#endif
+#ifdef LIVE_STATS
+    newtx->live = NULL;
+    live_attach(newtx);
+#endif
+    newtx->next_tx = all_tx;
+    /* lockless readers (stm_get_stats) may follow all_tx at any time */
+    asm __volatile__("": : :"memory");
+    all_tx = newtx;
+    pthread_mutex_unlock(&unused_tx_mutex);
+#ifdef PERF_COUNTERS
+    perf_open(newtx);
 #endif
     
     return newtx;
@@ -301,6 +546,13 @@ stm_tx_t *stm_new()
 void stm_delete(stm_tx_t *tx)
 {
     DPRINTF("stm delete: %p\n", tx);
+#ifdef ACCESS_RECORD
+    if (tx->rec_buf!=NULL) {
+	pthread_mutex_lock(&rec_mutex);
+	rec_flush_tx(tx);
+	pthread_mutex_unlock(&rec_mutex);
+    }
+#endif
     /* Check status */
 #ifdef GLOBAL_STATS
     printf("Global statistics:\n");
@@ -316,11 +568,33 @@ void stm_delete(stm_tx_t *tx)
     printf("Avg. nr. writes/tx: %ld (min: %ld max: %ld)\n",  tx->nb_tot_writes/nrtx, tx->nb_min_writes, tx->nb_max_writes);
     printf("Nr. of read version failures: %ld (recovered: %ld)\n",  tx->nb_read_ver_err, tx->nb_read_ver_err_rec);
     printf("Nr. of read version changes before return: %ld\n", tx->nb_read_ver_change);
+    printf("Nr. of duplicate reads not logged: %ld\n", tx->nb_read_dups);
     printf("Nr. of lock version failures: %ld (recovered: %ld)\n",  tx->nb_lock_ver_err, tx->nb_lock_ver_err_rec);
+    printf("Nr. of commit validations: %ld (skipped: %ld, clock CAS failures: %ld)\n", tx->nb_commit_validate, tx->nb_commit_novalidate, tx->nb_clock_cas_fail);
+    printf("Nr. of read-only commits: %ld (restarted in normal mode: %ld)\n", tx->nb_ro_commits, tx->nb_ro_restarts);
+    printf("Nr. of remote aborts: %ld (aborted by others: %ld)\n", tx->nb_cm_kills, tx->nb_cm_killed);
+    printf("Nr. of blocking waits: %ld\n", tx->nb_cm_blocks);
+    printf("Nr. of locking mode switches: %ld\n", tx->stats.s.lock_mode_switches);
+    printf("Nr. of deadline timeouts: %ld (escalations: %ld)\n", tx->stats.s.timeouts, tx->stats.s.escalations);
 #endif
     assert(tx->status != TX_ACTIVE && tx->status != TX_WAITING);
     
     pthread_mutex_lock(&unused_tx_mutex);
+#ifdef CLOCK_TLC
+    tlc_release_id(tx);
+#endif
+#ifdef LIVE_STATS
+    /* the slot goes to the next stm_new */
+    if (tx->live!=NULL) tx->live->in_use = 0;
+    tx->live = NULL;
+#endif
+#ifdef GLOBAL_STATS
+    {
+	int i;
+	for (i=0; i<STM_PRIO_LEVELS; i++) prio_latency_merge(&prio_latency[i], &tx->latency[i]);
+	memset(tx->latency, 0x0, sizeof(tx->latency));
+    }
+#endif
     tx_block_t *cur = (tx_block_t*)malloc(sizeof(tx_block_t));
     cur->next = unused_tx;
     cur->tx = tx;
@@ -340,972 +614,4087 @@ static void free_tx(stm_tx_t *tx)
 	free(cur);
     }
 
+    while (tx->range_chunks!=NULL) {
+	range_chunk_t *chunk = tx->range_chunks;
+	tx->range_chunks = chunk->next;
+	free(chunk);
+    }
+
     free(tx->readset);
+    free(tx->readfilter);
+#ifdef TX_TRACE
+    free(tx->trace_ring);
+#endif
+#ifdef ACCESS_RECORD
+    free(tx->rec_buf);
+#endif
+#ifdef PERF_COUNTERS
+    perf_close(tx);
+#endif
     free(tx->lockset);
 
     free(tx->writehash);
+#ifdef CLOCK_TLC
+    free(tx->tlc_seen);
+#endif
     free(tx);
 }
 
 /*******************************************************************\
- * START, COMMIT and ABORT
+ * Runtime parameters
 \*******************************************************************/
 
-/**
- * Start a transaction
- *
- * @param tx is a pointer to the transaction descriptor
- * @param env is a pointer to the jump buffer which is used to return to this point in case of a retry
- *            or NULL to create a jump buffer internally using the stack saving mechanism
- */
-void stm_start(stm_tx_t *tx, jmp_buf *env)
+/* indexed by STM_PARAM_* */
+static const struct {
+    const char *name;
+    unsigned long def, min, max;
+} stm_param_info[STM_PARAMS] = {
+    { "adapt_period", ADAPT_PERIOD, 1, 1UL<<20 },
+    { "adapt_retry_percent", ADAPT_RETRY_PERCENT, 0, 100000 },
+    { "whash_grow_percent", WHASH_GROW_PERCENT, 1, 100 },
+    { "whash_shrink_percent", WHASH_SHRINK_PERCENT, 0, 100 },
+    { "nrwbeforehash", NRWBEFOREHASH, 0, NRWRITESINSLAB-1 },
+    { "max_yields", MAX_NUM_YIELD_PER_LOCK, 0, 1UL<<20 },
+    { "backoff_max_rounds", CM_BACKOFF_MAX_ROUNDS, 0, 40 },
+    { "locking_abort_percent", LOCKING_ABORT_PERCENT, 0, 100000 },
+    { "locking_lazy_held", LOCKING_LAZY_HELD, 0, 100 },
+    { "locking_eager_held", LOCKING_EAGER_HELD, 0, 100 }
+};
+
+static void stm_param_init()
 {
-    DPRINTF("\tstm start: %p\n", tx);
-    /* Check status */
-    assert(tx->status != TX_ACTIVE && tx->status != TX_WAITING);
-    
-    //tx->jmp = env;
+    int i;
+    for (i=0; i<STM_PARAMS; i++) stm_params[i] = stm_param_info[i].def;
+    stm_param_epoch = 0;
+}
+
+/* copies the global values that were not set on the descriptor */
+static void stm_param_load(stm_tx_t *tx)
+{
+    int i;
+    tx->param_epoch = stm_param_epoch;
+    __sync_synchronize();
+    for (i=0; i<STM_PARAMS; i++) {
+	if (!(tx->param_local & (1UL << i))) tx->param[i] = stm_params[i];
+    }
+}
+
+static int stm_param_find(const char *key)
+{
+    int i;
+    for (i=0; i<STM_PARAMS; i++) {
+	if (strcmp(key, stm_param_info[i].name)==0) return i;
+    }
+    return -1;
+}
+
+int stm_set_parameter(stm_tx_t *tx, const char *key, void *val)
+{
+    int i = stm_param_find(key);
+    unsigned long value;
     
-    /* Reset the tansactional memory buffer */
-    tx->freed = NULL;
-    tx->allocated = NULL;
+    if (i<0) return 0;
+    value = *(unsigned long*)val;
+    if (value<stm_param_info[i].min) value = stm_param_info[i].min;
+    if (value>stm_param_info[i].max) value = stm_param_info[i].max;
+    if (tx==NULL) {
+	stm_params[i] = value;
+	/* descriptors copy all values after they saw the new epoch */
+	__sync_fetch_and_add(&stm_param_epoch, 1);
+    } else {
+	tx->param[i] = value;
+	tx->param_local |= 1UL << i;
+    }
+    return 1;
+}
 
-#ifdef ADAPTIVENESS
-    // used for adaptiveness
-    tx->wtotal+=tx->nr_uniq_writes;
-    tx->nrtx++;
+int stm_get_parameter(stm_tx_t *tx, const char *key, void *val)
+{
+    int i = stm_param_find(key);
     
-    // adapt every 100 transactions
-    if (unlikely(tx->adaptcommits%64==0)) {
+    if (i<0) return 0;
+    *(unsigned long*)val = (tx==NULL) ? stm_params[i] : tx->param[i];
+    return 1;
+}
 
-	// adapt write through or write back
-	if ((tx->adaptretries*100) / (tx->adaptcommits+1) > 60) {
-	    //if (tx->writethrough==1) printf("changing wt to wb\n");
-	    tx->writethrough=0; /* false */
-	} else {
-	    //if (tx->writethrough==0) printf("changing wb to wt\n");
-	    tx->writethrough=1;
-	}
 
-#ifdef ADAPTIVE_WHASH
-	if ((tx->wtotal/tx->nrtx)*3>tx->whashsize && tx->whashsize<WBUF_MAX_HASH_ARRAY_SIZE) {
-	    // more than 33% load in the whashtable -> double the whashtable
-	    tx->whashsize*=2;
-	    tx->whashmask = tx->whashsize-1;
-	    //printf("new whashsize: %d\n", tx->whashsize);
-	    //free(tx->writehash);
-	    //if (posix_memalign((void**)&(tx->writehash), 64, tx->whashsize*sizeof(writeset_t*))!=0) {
-	    //perror("malloc: no free memory!");
-	    //exit(1);
-	    //}
-	}
-	if ((tx->wtotal/tx->nrtx)*10<tx->whashsize && tx->whashsize>16) {
-	    // less than 10% load in the whashtable -> half the whashtable
-	    tx->whashsize/=2;
-	    tx->whashmask = tx->whashsize-1;
-	    //printf("new whashsize: %d\n", tx->whashsize);
-	    //free(tx->writehash);
-	    //if (posix_memalign((void**)&(tx->writehash), 64, tx->whashsize*sizeof(writeset_t*))!=0) {
-	    //perror("malloc: no free memory!");
-	    //exit(1);
-	    //}
-	}
-#endif
-	
-	if (tx->whashcollisions*10/(tx->wtotal+1)) {
-	    // > 25% collisionrate
-	    //printf("switching hash fct: %d\n", tx->adaptive_hash);
-#ifdef ADAPTIVEHASH
-	    tx->adaptive_hash = (tx->adaptive_hash+1) % 6;
-#endif
-#ifdef ADAPTIVEWHASH2
-	    tx->adaptive_hash = (tx->adaptive_hash+3) % 7 + 2;
-#endif
-	}
-	
-	tx->whashcollisions=0;
-	// reset
-	tx->adaptretries = 0;
-	tx->adaptcommits = 1;
+/*******************************************************************\
+ * Statistics
+\*******************************************************************/
 
-    }
-    tx->writebloom = 0;
-#else
-    // no adaptiveness: set the writehash to zero and remove wbloom
-    sse2_memzero128aligned(tx->writehash, tx->whashsize*sizeof(writeset_t*));
-    tx->writebloom = -1;
-#endif
+/* copies a part of tx->stats of one descriptor while its thread keeps running */
+static void stm_stats_read(stm_tx_t *tx, void *to, const void *from, size_t size)
+{
+    unsigned long seq;
     
-    /* clear read and writeset */
-    tx->nr_uniq_writes = 0;
-    tx->nrreads = 0;
-    tx->nrlocks = 0;
+    do {
+	while ((seq = tx->stats.seq) & 1) asm __volatile__("pause": : :"memory");
+	__sync_synchronize();
+	memcpy(to, from, size);
+	__sync_synchronize();
+    } while (seq != tx->stats.seq);
+}
+
+void stm_get_stats(stm_tx_t *tx, stm_stats_t *stats)
+{
+    stm_stats_t cur;
+    unsigned long *sum = (unsigned long*)stats, *add = (unsigned long*)&cur;
+    stm_word_t i;
     
-    tx->waiting_for = NULL;
+    if (tx!=NULL) {
+	stm_stats_read(tx, stats, (void*)&tx->stats.s, sizeof(stm_stats_t));
+	return;
+    }
+    /* descriptors are never removed from all_tx, the list only grows at the head */
+    memset(stats, 0x0, sizeof(stm_stats_t));
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	stm_stats_read(tx, &cur, (void*)&tx->stats.s, sizeof(stm_stats_t));
+	for (i=0; i<STM_STATS_SUMS; i++) sum[i] += add[i];
+	if (cur.max_reads > stats->max_reads) stats->max_reads = cur.max_reads;
+	if (cur.max_writes > stats->max_writes) stats->max_writes = cur.max_writes;
+    }
+}
+
+#ifdef CYCLE_STATS
+/* index of the log-linear bucket of v */
+static inline unsigned long hist_bucket(unsigned long v)
+{
+    unsigned long shift;
     
-#ifdef STATS
-    tx->nb_reads = 0;
-    tx->nb_writes = 0;
+    if (v < (1UL << STM_HIST_SUB_BITS)) return v;
+    shift = 63 - __builtin_clzl(v) - STM_HIST_SUB_BITS;
+    return ((shift + 1) << STM_HIST_SUB_BITS) + ((v >> shift) & ((1UL << STM_HIST_SUB_BITS) - 1));
+}
+
+/* only the thread of the descriptor, between TX_STATS_BEGIN and TX_STATS_END */
+static inline void hist_add(stm_hist_t *hist, unsigned long v)
+{
+    hist->count++;
+    hist->sum += v;
+    if (v > hist->max) hist->max = v;
+    hist->buckets[hist_bucket(v)]++;
+}
+
+/* prints count, avg, percentiles and max of all histograms of all descriptors */
+static void hist_print()
+{
+    static const char *names[STM_HISTS] = { "attempt", "transaction", "acquire", "validate", "write back", "release" };
+    stm_stats_t stats;
+    stm_hist_t hist;
+    int i;
+    
+    for (i=0; i<STM_HISTS; i++) {
+	stm_get_hist(NULL, i, &hist);
+	if (hist.count==0) continue;
+	printf("Cycles %s: %ld samples, avg %ld p50 %ld p90 %ld p99 %ld p99.9 %ld max %ld\n", names[i],
+	       hist.count, hist.sum/hist.count, stm_hist_percentile(&hist, 50), stm_hist_percentile(&hist, 90),
+	       stm_hist_percentile(&hist, 99), stm_hist_percentile(&hist, 99.9), hist.max);
+    }
+    stm_get_stats(NULL, &stats);
+    if (stats.cycles_committed + stats.cycles_wasted > 0)
+	printf("Cycles committed: %ld, wasted in aborted attempts: %ld (%.1f%%)\n", stats.cycles_committed,
+	       stats.cycles_wasted, 100.0*stats.cycles_wasted/(stats.cycles_committed + stats.cycles_wasted));
+}
 #endif
-    /* remember the current version */
-    tx->max_version = GLOBAL_VERSION;
-#ifdef GLOBAL_STATS
-    tx->start    = tx->max_version;
+
+void stm_get_hist(stm_tx_t *tx, int which, stm_hist_t *hist)
+{
+#ifdef CYCLE_STATS
+    stm_hist_t *cur;
+    stm_word_t i;
+    
+    if (which < 0 || which >= STM_HISTS) {
+	memset(hist, 0x0, sizeof(stm_hist_t));
+	return;
+    }
+    if (tx!=NULL) {
+	stm_stats_read(tx, hist, &tx->stats.hist[which], sizeof(stm_hist_t));
+	return;
+    }
+    memset(hist, 0x0, sizeof(stm_hist_t));
+    cur = (stm_hist_t*)malloc(sizeof(stm_hist_t));
+    if (cur==NULL) {
+	perror("malloc for the histogram failed\n");
+	exit(1);
+    }
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	stm_stats_read(tx, cur, &tx->stats.hist[which], sizeof(stm_hist_t));
+	hist->count += cur->count;
+	hist->sum += cur->sum;
+	if (cur->max > hist->max) hist->max = cur->max;
+	for (i=0; i<STM_HIST_BUCKETS; i++) hist->buckets[i] += cur->buckets[i];
+    }
+    free(cur);
+#else
+    memset(hist, 0x0, sizeof(stm_hist_t));
 #endif
+}
 
-    /* Change transaction status to TX_ACTIVE*/
-    tx->status = TX_ACTIVE;
+unsigned long stm_hist_percentile(const stm_hist_t *hist, double percent)
+{
+    unsigned long rank, seen = 0, upper, shift;
+    stm_word_t i;
+    
+    if (hist->count==0) return 0;
+    rank = (unsigned long)(hist->count * percent / 100.0 + 0.999999);
+    if (rank==0) rank = 1;
+    for (i=0; i<STM_HIST_BUCKETS; i++) {
+	seen += hist->buckets[i];
+	if (seen >= rank) break;
+    }
+    if (i < (1 << STM_HIST_SUB_BITS)) {
+	upper = i;
+    } else {
+	shift = (i >> STM_HIST_SUB_BITS) - 1;
+	upper = (((1UL << STM_HIST_SUB_BITS) + (i & ((1 << STM_HIST_SUB_BITS) - 1))) << shift) + (1UL << shift) - 1;
+    }
+    return (upper < hist->max) ? upper : hist->max;
 }
 
+
+/*******************************************************************\
+ * Abort profile
+\*******************************************************************/
+
+#ifdef ABORT_PROFILE
 /**
- * Commit this transaction
- *
- * @param tx is a pointer to the transaction descriptor
+ * Finds or claims the slot of (key, key2), NULL if the probes are taken.
+ * A slot is claimed with PROF_CLAIMED, the key is published after key2,
+ * so an insert of the same pair waits for it instead of taking a second slot.
  */
-void stm_commit(stm_tx_t *tx)
+static prof_entry_t *prof_slot(prof_entry_t *table, stm_word_t key, stm_word_t key2)
 {
-    stm_word_t commit_version;
+    stm_word_t h = ((key ^ (key2 * 31)) * 0x9E3779B97F4A7C15ULL) >> (8*sizeof(stm_word_t) - PROF_BITS);
+    stm_word_t i;
+    prof_entry_t *e;
     
-    DPRINTF("\tstm commit start: %p\n", tx);
+    for (i=0; i<PROF_PROBES; i++) {
+	e = &table[(h+i) & (PROF_SLOTS-1)];
+	if (e->key==0 && CAS(&e->key, 0, PROF_CLAIMED)) {
+	    e->key2 = key2;
+	    asm __volatile__("": : :"memory");
+	    e->key = key;
+	    return e;
+	}
+	while (e->key==PROF_CLAIMED) asm __volatile__("pause": : :"memory");
+	if (e->key==key && e->key2==key2) return e;
+    }
+    return NULL;
+}
 
-    /* Check status */
-    assert(tx->status == TX_ACTIVE);
+/* called by stm_abort_or_retry_helper, the totals are counted per descriptor */
+static void prof_record(stm_tx_t *tx)
+{
+    stm_word_t reason = tx->abort_reason;
+    prof_entry_t *e;
     
-    if (tx->nr_uniq_writes==0) {
-	/* No need to acquire, validate or extend anything in read only mode */
-	tx->status = TX_COMMITTED;
-    } else {
-	/* Try to acquire all locks */
-	buf_acquire_all_locks(tx);
-	
-	/* Increment the counter and get the newest version */
-	commit_version = GLOBAL_VERSION_INC+2;
-	
-	/* Special case: if max_version + 2 == commit_version we do not need to validate */
-	if ((tx->max_version)+2 != commit_version) {
-	    /* Before we can write back we need to validate the read set */
-	    if (unlikely(!buf_validate(tx))) {
-		/* This is the end of this function since stm_retry never returns */
-		DPRINTF("\tstm commit validate failed: %p\n", tx);
-		stm_retry(tx);
-	    }
+    tx->prof_aborts++;
+    if (tx->prof_lock!=PROF_NONE) {
+	if ((e = prof_slot(prof_locks, tx->prof_lock+1, 0))!=NULL) {
+	    FETCH_ADD(&e->count, 1);
+	    FETCH_ADD(&e->by[reason], 1);
+	    if (tx->prof_addr!=0) e->addr = tx->prof_addr;
+	} else {
+	    tx->prof_dropped++;
 	}
-	/* The locks are acquired and the read set validated */
-	tx->status = TX_COMMITTED;
-	
-	/* Write the write buffer back to the shared memory */
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-	if (!tx->writethrough)
-	    buf_write_back(tx);
-#elif defined(WRITEBACK)
-	buf_write_back(tx);
-#endif
-
-	buf_release_all_locks(tx, commit_version);
     }
+    if ((e = prof_slot(prof_sites, (stm_word_t)tx->prof_pc, 0))!=NULL) {
+	FETCH_ADD(&e->count, 1);
+	FETCH_ADD(&e->by[reason], 1);
+	e->site = (stm_word_t)tx->prof_site;
+    } else {
+	tx->prof_dropped++;
+    }
+    if (tx->prof_other!=NULL) {
+	if ((e = prof_slot(prof_edges, (stm_word_t)tx->prof_site, (stm_word_t)tx->prof_other))!=NULL)
+	    FETCH_ADD(&e->count, 1);
+	else
+	    tx->prof_dropped++;
+    }
+    PROF_CLEAR(tx);
+}
+
+/* the n entries with the highest count, in descending order */
+static int prof_top(prof_entry_t *table, prof_entry_t **top, int n)
+{
+    int i, j, k, nr = 0;
     
-    /* Free the memory which was freed during the transaction */
-    mem_free_memory(tx);
-    
-    /* Reset the buffer */
-    buf_reset(tx);
+    for (i=0; i<PROF_SLOTS; i++) {
+	if (table[i].key==0 || table[i].count==0) continue;
+	for (j=0; j<nr && top[j]->count>=table[i].count; j++);
+	if (j==n) continue;
+	if (nr<n) nr++;
+	for (k=nr-1; k>j; k--) top[k] = top[k-1];
+	top[j] = &table[i];
+    }
+    return nr;
+}
 
-    DPRINTF("\tstm commit done: %p\n", tx);
+static void prof_print_reasons(FILE *out, prof_entry_t *e)
+{
+    int i;
+    for (i=0; i<STM_ABORT_REASONS; i++) {
+	if (e->by[i]) fprintf(out, " %s:%lu", stm_abort_reason_name(i), (unsigned long)e->by[i]);
+    }
+    fprintf(out, "\n");
+}
 
-#ifdef ADAPTIVENESS
-    tx->adaptcommits++;
-#endif
+void stm_dump_profile(FILE *out)
+{
+    prof_entry_t *top[PROF_TOP];
+    unsigned long aborts = 0, dropped = 0;
+    stm_tx_t *tx;
+    int i, nr;
+    
+    /* descriptors are never removed from all_tx */
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	aborts += tx->prof_aborts;
+	dropped += tx->prof_dropped;
+    }
+    fprintf(out, "Abort profile: %lu aborts (%lu not attributed)\n", aborts, dropped);
+    fprintf(out, "Top locks:\n");
+    nr = prof_top(prof_locks, top, PROF_TOP);
+    for (i=0; i<nr; i++) {
+	fprintf(out, "  lock %lu (addr %p): %lu", (unsigned long)top[i]->key-1, (void*)top[i]->addr, (unsigned long)top[i]->count);
+	prof_print_reasons(out, top[i]);
+    }
+    fprintf(out, "Top access sites:\n");
+    nr = prof_top(prof_sites, top, PROF_TOP);
+    for (i=0; i<nr; i++) {
+	fprintf(out, "  pc %p (tx %p): %lu", (void*)top[i]->key, (void*)top[i]->site, (unsigned long)top[i]->count);
+	prof_print_reasons(out, top[i]);
+    }
+    fprintf(out, "Conflicts (aborted tx -> other tx):\n");
+    nr = prof_top(prof_edges, top, PROF_TOP);
+    for (i=0; i<nr; i++) {
+	fprintf(out, "  %p -> %p: %lu\n", (void*)top[i]->key, (void*)top[i]->key2, (unsigned long)top[i]->count);
+    }
+}
+
+void stm_reset_profile()
+{
+    stm_tx_t *tx;
+    
+    memset(prof_locks, 0x0, sizeof(prof_locks));
+    memset(prof_sites, 0x0, sizeof(prof_sites));
+    memset(prof_edges, 0x0, sizeof(prof_edges));
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	tx->prof_aborts = 0;
+	tx->prof_dropped = 0;
+    }
+}
 
+/* at stm_exit: to ADAPTSTM_PROFILE, or to stdout with GLOBAL_STATS */
+static void prof_exit()
+{
+    char *name = getenv("ADAPTSTM_PROFILE");
+    FILE *out;
+    
+    if (name==NULL) {
 #ifdef GLOBAL_STATS
-    tx->commits++;
-#endif
-#ifdef STATS
-    tx->nb_tot_reads+=tx->nb_reads;
-    tx->nb_tot_writes+=tx->nb_writes;
-    if (tx->nb_writes>tx->nb_max_writes) tx->nb_max_writes = tx->nb_writes;
-    if (tx->nb_writes<tx->nb_min_writes) tx->nb_min_writes = tx->nb_writes;
-    if (tx->nb_reads>tx->nb_max_reads) tx->nb_max_reads = tx->nb_reads;
-    if (tx->nb_reads<tx->nb_min_reads) tx->nb_min_reads = tx->nb_reads;
+	stm_dump_profile(stdout);
 #endif
-    /* Check status */
-    assert(tx->status == TX_COMMITTED);
+	return;
+    }
+    if ((out = fopen(name, "w"))==NULL) {
+	perror("fopen: cannot write the abort profile");
+	return;
+    }
+    stm_dump_profile(out);
+    fclose(out);
+}
+#else
+/* without ABORT_PROFILE nothing is recorded */
+void stm_dump_profile(FILE *out)
+{
 }
 
-static inline __always_inline void stm_abort_or_retry_helper(stm_tx_t *tx) {
-    
-    /* if we are in a writethrough mode we first need to undo all changes! */
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-    if (tx->writethrough)
-	buf_write_back(tx);
-#elif defined(WRITETHROUGH)
-    buf_write_back(tx);
+void stm_reset_profile()
+{
+}
 #endif
 
-    buf_release_all_locks(tx, 0);
 
-    tx->status = TX_ABORTED;
+/*******************************************************************\
+ * Event trace
+\*******************************************************************/
 
-    /* Deallocat allocated memory during transaction */
-    mem_free_memory(tx);
+#ifdef TX_TRACE
+/* only the thread of the descriptor */
+static inline void trace_add(stm_tx_t *tx, stm_word_t type, stm_word_t info, stm_word_t arg, stm_word_t other)
+{
+    uint64_t head = tx->trace_head;
+    trace_rec_t *rec;
     
-    /* reset the rw_buffer */
-    buf_reset(tx);
+    if (unlikely(head - tx->trace_tail >= TRACE_RING)) {
+	tx->trace_dropped++;
+	return;
+    }
+    rec = &tx->trace_ring[head & (TRACE_RING-1)];
+    rec->tsc = cm_now();
+    rec->arg = arg;
+    rec->other = other;
+    rec->type = type;
+    rec->info = info;
+    /* the flusher reads the record after it saw the new head (TSO) */
+    asm __volatile__("": : :"memory");
+    tx->trace_head = head + 1;
 }
 
-/**
- * Retry this transaction
- *
- * @param tx is a pointer to the transaction descriptor
- */
-inline __always_inline void stm_retry(stm_tx_t *tx)
+/* the abort record, other is the cause if we know it */
+static void trace_abort(stm_tx_t *tx)
 {
-    DPRINTF("\tstm retry: %p\n", tx);
+    stm_word_t other = TRACE_NOBODY;
+    
+    if (tx->abort_reason==STM_ABORT_KILLED) other = tx->trace_killer;
+    else if (tx->abort_reason==STM_ABORT_CONFLICT || tx->abort_reason==STM_ABORT_DEADLOCK) other = TRACE_ID(tx->waiting_for);
+    trace_add(tx, TRACE_ABORT, tx->abort_reason, tx->nrreads, other);
+}
 
-    /* Check status */
-    assert(tx->status == TX_ACTIVE || tx->status == TX_WAITING);
+/* writes the new records of one descriptor (trace_mutex held) */
+static void trace_flush_tx(stm_tx_t *tx)
+{
+    uint64_t head = tx->trace_head, tail = tx->trace_tail, first;
+    trace_chunk_t chunk;
     
-    stm_abort_or_retry_helper(tx);
+    if (head==tail) return;
+    asm __volatile__("": : :"memory");
+    chunk.id = tx->trace_id;
+    chunk.count = head - tail;
+    chunk.dropped = tx->trace_dropped;
+    fwrite(&chunk, sizeof(chunk), 1, trace_file);
+    /* the ring may wrap around between tail and head */
+    first = TRACE_RING - (tail & (TRACE_RING-1));
+    if (first > head - tail) first = head - tail;
+    fwrite(&tx->trace_ring[tail & (TRACE_RING-1)], sizeof(trace_rec_t), first, trace_file);
+    fwrite(tx->trace_ring, sizeof(trace_rec_t), head - tail - first, trace_file);
+    asm __volatile__("": : :"memory");
+    tx->trace_tail = head;
+}
+
+static void trace_flush()
+{
+    stm_tx_t *tx;
     
-    tx->adaptretries++;
+    pthread_mutex_lock(&trace_mutex);
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	if (tx->trace_ring!=NULL) trace_flush_tx(tx);
+    }
+    fflush(trace_file);
+    pthread_mutex_unlock(&trace_mutex);
+}
 
-#ifdef GLOBAL_STATS
-    tx->retries++;
-#endif
+static void *trace_loop(void *arg)
+{
+    while (trace_running) {
+	usleep(TRACE_FLUSH_MS*1000);
+	trace_flush();
+    }
+    return NULL;
+}
+
+/* opens ADAPTSTM_TRACE and starts the flusher */
+static void trace_init()
+{
+    char *name = getenv("ADAPTSTM_TRACE");
+    trace_header_t header;
     
-    //if (tx->jmp != NULL) {
-    longjmp(tx->env,1);
-    //} else {
-    //perror("no longjmp destination\n");
-    //exit(1);
-    //}
+    trace_file = NULL;
+    trace_next_id = 0;
+    if (name==NULL) return;
+    if ((trace_file = fopen(name, "w"))==NULL) {
+	perror("fopen: cannot write the event trace");
+	exit(1);
+    }
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    /* the records carry cm clock timestamps */
+    pthread_once(&cm_clock_once, cm_clock_init);
+    header.tsc_khz = cm_tsc_khz;
+    fwrite(&header, sizeof(header), 1, trace_file);
+    pthread_mutex_init(&trace_mutex, NULL);
+    trace_running = 1;
+    if (pthread_create(&trace_thread, NULL, trace_loop, NULL)!=0) {
+	perror("pthread_create: cannot start the trace flusher");
+	exit(1);
+    }
 }
 
+/* stops the flusher and writes the rest (before the descriptors are freed) */
+static void trace_exit()
+{
+    if (trace_file==NULL) return;
+    trace_running = 0;
+    pthread_join(trace_thread, NULL);
+    trace_flush();
+    fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_destroy(&trace_mutex);
+}
+#endif
+
 
 /*******************************************************************\
- *  LOAD and STORE                                                 *
+ * Access recording
 \*******************************************************************/
 
-/**
- * Called by the CURRENT thread to load a word-sized value.
- *
- * @param tx is a pointer to the transaction descriptor
- * @param addr is the address to load
- */
-stm_word_t stm_load(stm_tx_t *tx, stm_word_t *addr)
+#ifdef ACCESS_RECORD
+/* the id of key, new keys get the next id (rec_mutex held) */
+static stm_word_t rec_map_id(rec_map_t *map, stm_word_t key)
 {
-    DPRINTF("\t\tstm load: %p (%p)", tx, addr);
-
-#ifdef STATS
-    tx->nb_reads++;
-#endif
-    /* Check status */
-    assert(tx->status == TX_ACTIVE);
+    stm_word_t i, j;
 
-    /* make sure that we read the correct version */
-    return buf_check_read(tx, addr);
+    if (2*(map->count+1) > map->size) {
+	rec_map_t old = *map;
+	map->size = (old.size==0) ? 1024 : 2*old.size;
+	map->keys = (stm_word_t*)calloc(map->size, sizeof(stm_word_t));
+	map->ids = (stm_word_t*)malloc(map->size*sizeof(stm_word_t));
+	if (map->keys==NULL || map->ids==NULL) {
+	    perror("malloc: no free memory!");
+	    exit(1);
+	}
+	for (i=0; i<old.size; i++) {
+	    if (old.keys[i]==0) continue;
+	    for (j=REC_HASH(old.keys[i]-1) & (map->size-1); map->keys[j]!=0; j = (j+1) & (map->size-1));
+	    map->keys[j] = old.keys[i];
+	    map->ids[j] = old.ids[i];
+	}
+	free(old.keys);
+	free(old.ids);
+    }
+    for (i=REC_HASH(key) & (map->size-1); map->keys[i]!=0; i = (i+1) & (map->size-1)) {
+	if (map->keys[i]==key+1) return map->ids[i];
+    }
+    map->keys[i] = key+1;
+    map->ids[i] = map->count++;
+    return map->ids[i];
 }
 
+/* only the thread of the descriptor, goes to the global map on a miss */
+static stm_word_t rec_cached_id(rec_cache_t *cache, stm_word_t size, rec_map_t *map, stm_word_t key)
+{
+    rec_cache_t *c = &cache[(key ^ (key >> 8)) & (size-1)];
 
-/**
- * Called by the CURRENT thread to store a word-sized value.
- *
- * @param tx is a pointer to the transaction descriptor
- * @param addr is the address to write to
- * @param value is the value to write to addr
- */
-void stm_store(stm_tx_t *tx, stm_word_t *addr, stm_word_t value)
+    if (unlikely(c->key!=key)) {
+	pthread_mutex_lock(&rec_mutex);
+	c->id = rec_map_id(map, key);
+	pthread_mutex_unlock(&rec_mutex);
+	c->key = key;
+    }
+    return c->id;
+}
+
+/* room for one more record */
+static void rec_grow(stm_tx_t *tx)
 {
-    DPRINTF("\t\tstm write: %p (%p=%p)\n", tx, addr, (void*)value);
-    writeset_t *write;
-#ifdef STATS
-    tx->nb_writes++;
-#endif
-    write = buf_get_write_addr(tx, addr, 1, value);
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-    if (tx->writethrough) {
-	*addr = value;
-    } else {
-	write->value = value;
+    tx->rec_size *= 2;
+    if ((tx->rec_buf = (uint8_t*)realloc(tx->rec_buf, tx->rec_size))==NULL) {
+	perror("malloc: no free memory!");
+	exit(1);
     }
-#elif defined(WRITEBACK)
-    write->value = value;
-#elif defined(WRITETHROUGH)
-    *addr = value;
-#else
-    assert(1=0); // either WRITEBACK, or WRITEHTROUGH or ADAPTIVENESS and WRITEBACK and WRITETHROUGH must be defined!
-#endif
 }
 
+/* the replay address of addr */
+static inline void rec_put_addr(stm_tx_t *tx, stm_word_t addr)
+{
+    stm_word_t page = rec_cached_id(tx->rec_pages, REC_CACHE, &rec_pages, addr >> REC_PAGE_SHIFT);
 
+    addr = (page << REC_PAGE_SHIFT) | (addr & ((1UL << REC_PAGE_SHIFT)-1));
+    tx->rec_len += rec_put_number(&tx->rec_buf[tx->rec_len], rec_zigzag((int64_t)(addr - tx->rec_last)));
+    tx->rec_last = addr;
+}
 
-/*******************************************************************\
- * Functions to work with the read buffers and write buffers
-\*******************************************************************/
+static void rec_access(stm_tx_t *tx, stm_word_t type, stm_word_t addr)
+{
+    if (unlikely(tx->rec_len + REC_MAX_SIZE > tx->rec_size)) rec_grow(tx);
+    tx->rec_buf[tx->rec_len++] = type;
+    rec_put_addr(tx, addr);
+}
 
-static inline void buf_acquire_all_locks(stm_tx_t *tx)
+/* one record per word of a range access (the replay works on words) */
+static void rec_range(stm_tx_t *tx, stm_word_t type, stm_word_t addr, stm_word_t size)
 {
-#ifndef EAGER_LOCKING
-    /* aquire all write locks */
-    bufferslab_t *wset = tx->writeset;
-    stm_word_t i;
-    while (wset!=NULL) {
-	for (i=0; i<wset->size; i++) {
-	    /* acquire this lock and save the version */
-	    lock_acquire(tx, wset->data.writes[i].addr);
-	}
-	wset = wset->next;
-    }
-#endif
+    stm_word_t w, end = addr + size;
+    for (w = addr & ~(stm_word_t)(sizeof(stm_word_t)-1); w<end; w += sizeof(stm_word_t))
+	rec_access(tx, type, w);
 }
 
-static inline __always_inline void buf_release_all_locks(stm_tx_t *tx, stm_word_t version)
+static void rec_malloc(stm_tx_t *tx, void *addr, size_t size)
 {
-    /* release all write locks */
-    lockset_t *mylocks = tx->lockset;
-    stm_word_t i;
-    if (version==0) {
-	for (i=0; i<tx->nrlocks; i++) {
-	    stm_word_t *lockaddr = mylocks[i].lock;
-	    /* release the lock and save the version */
-	    assert(*lockaddr==(stm_word_t)tx);
-	    LOCK_RELEASE(lockaddr, mylocks[i].version);
-	}
-    } else {
-	for (i=0; i<tx->nrlocks; i++) {
-	    stm_word_t *lockaddr = mylocks[i].lock;
-	    /* release the lock and save the version */
-	    assert(*lockaddr==(stm_word_t)tx);
-	    LOCK_RELEASE(lockaddr, version);
-	}
+    if (unlikely(tx->rec_len + REC_MAX_SIZE > tx->rec_size)) rec_grow(tx);
+    tx->rec_buf[tx->rec_len++] = REC_MALLOC;
+    tx->rec_len += rec_put_number(&tx->rec_buf[tx->rec_len], size);
+    rec_put_addr(tx, (stm_word_t)addr);
+}
+
+/* every attempt, the buffer is written out between two transactions only */
+static void rec_start(stm_tx_t *tx, stm_word_t readonly, void *site)
+{
+    if (tx->rec_len >= REC_FLUSH) {
+	pthread_mutex_lock(&rec_mutex);
+	rec_flush_tx(tx);
+	pthread_mutex_unlock(&rec_mutex);
     }
+    tx->rec_mark = tx->rec_len;
+    tx->rec_mark_last = tx->rec_last;
+    if (unlikely(tx->rec_len + REC_MAX_SIZE > tx->rec_size)) rec_grow(tx);
+    tx->rec_buf[tx->rec_len++] = REC_START | (readonly ? REC_READONLY : 0);
+    tx->rec_len += rec_put_number(&tx->rec_buf[tx->rec_len],
+				  rec_cached_id(tx->rec_sites, REC_SITE_CACHE, &rec_sites, (stm_word_t)site));
 }
 
-/**
- * This is a special version of buf_validate that forwards one lock
- * that has been taken speculatively and we are currently trying to
- * validate that specific lock and to extend the readset version
- * So we have to check that lock as well!
- */
-static inline stm_word_t buf_validate_lockspecial(stm_tx_t *tx, stm_word_t xlockValue, stm_word_t *xlockaddr)
+/* writes the records of one descriptor (rec_mutex held) */
+static void rec_flush_tx(stm_tx_t *tx)
 {
-    readset_t *rset = tx->readset;
-    stm_word_t *lockaddr, lockValue, i;
+    rec_chunk_t chunk;
 
-    /* Check the status */
-    assert(tx->status == TX_ACTIVE);
+    if (tx->rec_len==0) return;
+    chunk.id = tx->rec_id;
+    chunk.size = tx->rec_len;
+    fwrite(&chunk, sizeof(chunk), 1, rec_file);
+    fwrite(tx->rec_buf, 1, tx->rec_len, rec_file);
+    tx->rec_len = 0;
+}
 
-    for (i=0; i<tx->nrreads; i++) {
-	readset_t *thisread = &(rset[i]);
-	lockaddr = thisread->lock;
-	assert(lockaddr!=NULL);	    
-	lockValue = *lockaddr;
-	if (lockaddr==xlockaddr) lockValue = xlockValue; // forward value
-#ifdef EAGER_LOCKING
-	/* Check if the lock value has changed since we first read it */
-	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) &&
-	    (thisread->version!=LOCK_GET_VERSION_FROM_VALUE(lockValue)))
-#else
-	/* Check if the lock value has changed since we first read it */
-	/* or check the version stored in the write buffer if this transaction owns the lock*/
-	/*    TODO: buf_get_write_lock_version checks lock value from earlier write, that has
-		not yet been acquired. need to change this!
-	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx)
-	    ? (thisread->version != LOCK_GET_VERSION_FROM_VALUE(lockValue))
-	    : (thisread->version != buf_get_write_lock_version(tx, lockaddr)))
-	*/
-	assert(LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx);
-	if (thisread->version != LOCK_GET_VERSION_FROM_VALUE(lockValue))
-#endif
-	{
-	    DPRINTF("special validate: wrong version: %lx != %lx (tx: %p)\n", thisread->version, lockValue, tx);
-	    return 0;
-	}
+/* a new descriptor (unused_tx_mutex held) */
+static void rec_new(stm_tx_t *tx)
+{
+    tx->rec_buf = NULL;
+    tx->rec_len = 0;
+    tx->rec_last = 0;
+    tx->rec_id = rec_next_id++;
+    memset(tx->rec_pages, 0xff, sizeof(tx->rec_pages));
+    memset(tx->rec_sites, 0xff, sizeof(tx->rec_sites));
+    if (rec_file==NULL) return;
+    tx->rec_size = 2*REC_FLUSH;
+    if ((tx->rec_buf = (uint8_t*)malloc(tx->rec_size))==NULL) {
+	perror("malloc: no free memory!");
+	exit(1);
     }
-    return 1;
 }
-static inline stm_word_t buf_validate(stm_tx_t *tx)
+
+/* opens ADAPTSTM_RECORD */
+static void rec_init()
 {
-    readset_t *rset = tx->readset;
-    stm_word_t *lockaddr, lockValue, i;
+    char *name = getenv("ADAPTSTM_RECORD");
+    rec_header_t header;
 
-    /* Check the status */
-    assert(tx->status == TX_ACTIVE);
+    rec_file = NULL;
+    rec_next_id = 0;
+    memset(&rec_pages, 0x0, sizeof(rec_map_t));
+    memset(&rec_sites, 0x0, sizeof(rec_map_t));
+    if (name==NULL) return;
+    if ((rec_file = fopen(name, "w"))==NULL) {
+	perror("fopen: cannot write the access recording");
+	exit(1);
+    }
+    memset(&header, 0x0, sizeof(header));
+    memcpy(header.magic, REC_MAGIC, sizeof(header.magic));
+    header.page_shift = REC_PAGE_SHIFT;
+    fwrite(&header, sizeof(header), 1, rec_file);
+    pthread_mutex_init(&rec_mutex, NULL);
+}
 
-    for (i=0; i<tx->nrreads; i++) {
-	readset_t *thisread = &(rset[i]);
-	lockaddr = thisread->lock;
-	assert(lockaddr!=NULL);	    
-	lockValue = *lockaddr;
-#ifdef EAGER_LOCKING
-	/* Check if the lock value has changed since we first read it */
-	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) &&
-	    (thisread->version!=LOCK_GET_VERSION_FROM_VALUE(lockValue)))
-#else
-	/* Check if the lock value has changed since we first read it */
-	/* or check the version stored in the write buffer if this transaction owns the lock*/
-	/*    TODO: buf_get_write_lock_version checks lock value from earlier write, that has
-		not yet been acquired. need to change this!
-	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx)
-	    ? (thisread->version != LOCK_GET_VERSION_FROM_VALUE(lockValue))
-	    : (thisread->version != buf_get_write_lock_version(tx, lockaddr)))
-	*/
-	assert(LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx);
-	if (thisread->version != LOCK_GET_VERSION_FROM_VALUE(lockValue))
-#endif
-	{
-	    DPRINTF("validate: wrong version: %lx != %lx (tx: %p)\n", thisread->version, lockValue, tx);
-	    return 0;
-	}
+/* writes the rest (before the descriptors are freed) */
+static void rec_exit()
+{
+    stm_tx_t *tx;
+
+    if (rec_file==NULL) return;
+    pthread_mutex_lock(&rec_mutex);
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	if (tx->rec_buf!=NULL) rec_flush_tx(tx);
     }
-    return 1;
+    fclose(rec_file);
+    rec_file = NULL;
+    pthread_mutex_unlock(&rec_mutex);
+    pthread_mutex_destroy(&rec_mutex);
+    free(rec_pages.keys);
+    free(rec_pages.ids);
+    free(rec_sites.keys);
+    free(rec_sites.ids);
 }
+#endif
 
-/**
- * Write back all data from our local (write) buffer into memory
- * We don't worry about locks, this function assumes that all locks
- * are already taken!
- * (The locks will be freed later by release_all_locks!)
- */
-static inline void buf_write_back(stm_tx_t *tx)
+
+/*******************************************************************\
+ * Live statistics
+\*******************************************************************/
+
+#ifdef LIVE_STATS
+/* creates the segment, ADAPTSTM_LIVE overrides the name /adaptstm.<pid> */
+static void live_init()
 {
-    /* Check the status */
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-    assert((tx->status == TX_COMMITTED && !tx->writethrough) || (tx->status == TX_ABORTED && tx->writethrough) );
-#elif defined(WRITEBACK)
-    assert(tx->status == TX_COMMITTED);
-#elif defined(WRITETHROUGH)
-    assert(tx->status == TX_ABORTED);
-#endif    
+    char *name = getenv("ADAPTSTM_LIVE");
+    FILE *comm;
+    int fd;
     
-    /* write back */
-    bufferslab_t *wset = tx->writeset;
-    volatile stm_word_t *addr;
-    stm_word_t i;
-    while (wset!=NULL) {
-#ifndef NO_SSE
-	// prefetch wset->next does not help!
-	//__builtin_prefetch(wset->next);
-#endif
-	for (i=0; i<wset->size; i++) {
-	    addr = wset->data.writes[i].addr;
-	    /* write back */
-	    *addr = wset->data.writes[i].value;
-	}
-	wset = wset->next;
+    live_seg = NULL;
+    if (name!=NULL)
+	snprintf(live_name, sizeof(live_name), "%s", name);
+    else
+	snprintf(live_name, sizeof(live_name), LIVE_PREFIX "%d", (int)getpid());
+    if ((fd = shm_open(live_name, O_CREAT | O_RDWR | O_TRUNC, 0644))<0) {
+	perror("shm_open: no live statistics");
+	return;
+    }
+    if (ftruncate(fd, sizeof(live_segment_t))!=0 ||
+	(live_seg = (live_segment_t*)mmap(NULL, sizeof(live_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))==MAP_FAILED) {
+	perror("mmap: no live statistics");
+	live_seg = NULL;
+	close(fd);
+	shm_unlink(live_name);
+	return;
+    }
+    close(fd);
+    live_seg->pid = getpid();
+    pthread_once(&cm_clock_once, cm_clock_init);
+    live_seg->tsc_khz = cm_tsc_khz;
+    live_seg->lock_bits = lock_bits;
+    live_seg->started = time(NULL);
+    live_seg->nslots = 0;
+    if ((comm = fopen("/proc/self/comm", "r"))!=NULL) {
+	if (fgets(live_seg->comm, sizeof(live_seg->comm), comm)!=NULL)
+	    live_seg->comm[strcspn(live_seg->comm, "\n")] = 0;
+	fclose(comm);
     }
+    /* stmtop ignores the segment until the header is complete */
+    asm __volatile__("": : :"memory");
+    memcpy(live_seg->magic, LIVE_MAGIC, sizeof(live_seg->magic));
 }
 
-static inline __always_inline stm_word_t wbuf_idx_from_addr(stm_tx_t *tx, stm_word_t *addr)
+static void live_exit()
 {
-#if defined(ADAPTIVENESS) && (defined(ADAPTIVEHASH) || defined(ADAPTIVEWHASH2))
-    switch (tx->adaptive_hash) {
-    case 0: return (((stm_word_t)addr >> 8) & WBUF_MASK);
-    case 1: return (((stm_word_t)addr >> 6) & WBUF_MASK);
-    case 2: return (((stm_word_t)addr >> 4) & WBUF_MASK);
-    case 3: return (((stm_word_t)addr >> 2) & WBUF_MASK);
-    case 4: return ((((stm_word_t)addr >> 16)^((stm_word_t)addr>>5)) & WBUF_MASK);
-    case 5: return ((((stm_word_t)addr >> 12)^((stm_word_t)addr>>2)) & WBUF_MASK);
-    default:
-	return WBUF_IDX_FROM_ADDR(tx, addr);
-    }
-#else
-    return WBUF_IDX_FROM_ADDR(tx, addr);
-#endif
+    if (live_seg==NULL) return;
+    munmap(live_seg, sizeof(live_segment_t));
+    shm_unlink(live_name);
+    live_seg = NULL;
 }
 
-static inline __always_inline writeset_t *buf_get_write_addr(stm_tx_t *tx, stm_word_t *addr, stm_word_t allocate, stm_word_t value)
+/**
+ * A thread took the descriptor (stm_new, called with unused_tx_mutex held).
+ * Slots of deleted descriptors are reused before a new one is handed out.
+ */
+static void live_attach(stm_tx_t *tx)
 {
-    writeset_t *hashptr, **hashentry;
+    uint64_t i;
     
-    /* Check status */
-    assert(tx->status == TX_ACTIVE);
+    if (live_seg==NULL) return;
+    for (i=0; i<live_seg->nslots && live_seg->threads[i].in_use; i++);
+    if (i==LIVE_SLOTS) return;
+    if (i==live_seg->nslots) live_seg->nslots++;
+    tx->live = &live_seg->threads[i];
+    tx->live->tid = syscall(SYS_gettid);
+    live_update(tx);
+    tx->live->in_use = 1;
+}
 
-#ifdef ADAPTIVENESS
-    // we don't need a hash table yet, there are only few writes!
-    if (likely(tx->nr_uniq_writes<=NRWBEFOREHASH)) {
-	stm_word_t i;
-	writeset_t *writes = tx->writeset->data.writes;
-	// use switch optimization
-	switch (tx->nr_uniq_writes) {
-	case 11: if (writes->addr == addr) return writes; writes++;
-	case 10: if (writes->addr == addr) return writes; writes++;
-	case 9: if (writes->addr == addr) return writes; writes++;
-	case 8: if (writes->addr == addr) return writes; writes++;
-	case 7: if (writes->addr == addr) return writes; writes++;
-	case 6: if (writes->addr == addr) return writes; writes++;
-	case 5: if (writes->addr == addr) return writes; writes++;
-	case 4: if (writes->addr == addr) return writes; writes++;
-	case 3: if (writes->addr == addr) return writes; writes++;
-	case 2: if (writes->addr == addr) return writes; writes++;
-	case 1: if (writes->addr == addr) return writes; writes++;
-	case 0: break;
-	default:
-	    for (i=0; i<tx->nr_uniq_writes; i++) {
-		if (writes->addr == addr) return writes;
-		writes++;
-	    }
-	}
-	if (allocate) {
-	    /* make sure, that we have the lock as well */
-#ifdef EAGER_LOCKING
-	    lock_acquire(tx, addr);
-	    asm __volatile__("": : :"memory");
-#endif
-	    writes->addr=addr;
+/* plain stores into the slot of this thread */
+static void live_update(stm_tx_t *tx)
+{
+    live_thread_t *live = tx->live;
+    
+    live->commits = tx->stats.s.commits;
+    live->aborts = tx->stats.s.aborts;
+    live->lock_waits = tx->stats.s.lock_waits;
+    live->reads = tx->nrreads;
+    live->writes = tx->nr_uniq_writes;
+    live->whashsize = tx->whashsize;
 #if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-	    if (tx->writethrough) {
-		writes->value = *addr;
-	    }
+    live->writethrough = tx->writethrough;
 #elif defined(WRITETHROUGH)
-	    writes->value = *addr;
+    live->writethrough = 1;
+#else
+    live->writethrough = 0;
 #endif
-#ifdef WRITEBLOOM
-	    tx->writebloom|=WBLOOMHASH((stm_word_t)addr);
+    live->lazy = !TX_EAGER(tx);
+#if defined(ADAPTIVENESS) && (defined(ADAPTIVEHASH) || defined(ADAPTIVEWHASH2))
+    live->adaptive_hash = tx->adaptive_hash;
+#else
+    live->adaptive_hash = LIVE_HASH_FIXED;
 #endif
-	    tx->writeset->size = ++tx->nr_uniq_writes;
-	    if (tx->nr_uniq_writes<=NRWBEFOREHASH) {
-		return writes;
-	    } else {
-		// build up hash list and enqueue existing entries
-		sse2_memzero128aligned(tx->writehash, tx->whashsize*sizeof(writeset_t*));
-		writes = tx->writeset->data.writes;
-		// enqueue existing entries
-		for (i=0; i<tx->nr_uniq_writes; i++) {
-		    hashentry = ADDR2WENTRY(tx, tx->writehash, writes[i].addr);
-		    //tx->writebloom|=WBLOOMHASH((stm_word_t)writes[i].addr);
-		    writes[i].next = (*hashentry);
-#if defined(ADAPTIVENESS)
-		    if (*hashentry!=NULL) tx->whashcollisions++;
+    live->readonly = tx->readonly;
+    live->priority = tx->priority;
+}
 #endif
-		    *hashentry = &(writes[i]);
-		}
-		return &(writes[NRWBEFOREHASH]);
+
+
+/*******************************************************************\
+ * Hardware counters
+\*******************************************************************/
+
+#ifdef PERF_COUNTERS
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_EVENTS] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1D-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "dTLB-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/* opens the counters for the calling thread (cycles lead the group) */
+static void perf_open(stm_tx_t *tx)
+{
+    struct perf_event_attr attr;
+    stm_word_t tid = syscall(SYS_gettid);
+    int i;
+    
+    if (tx->perf_tid==tid || perf_disabled) return;
+    perf_close(tx);
+    for (i=0; i<PERF_EVENTS; i++) {
+	memset(&attr, 0x0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[i].type;
+	attr.config = perf_events[i].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	tx->perf_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, (i==0) ? -1 : tx->perf_fd[0], 0);
+	if (tx->perf_fd[i]<0) {
+	    if (i==0) {
+		perror("perf_event_open: no hardware counters");
+		perf_disabled = 1;
+		return;
 	    }
-	} else {
-	    return NULL;
+	    continue;
 	}
+	tx->perf_page[i] = (struct perf_event_mmap_page*)mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, tx->perf_fd[i], 0);
+	if (tx->perf_page[i]==MAP_FAILED) tx->perf_page[i] = NULL;
     }
-#endif
+    tx->perf_tid = tid;
+}
+
+static void perf_close(stm_tx_t *tx)
+{
+    int i;
     
-    hashentry = ADDR2WENTRY(tx, tx->writehash, addr);
+    for (i=0; i<PERF_EVENTS; i++) {
+	if (tx->perf_page[i]!=NULL) munmap(tx->perf_page[i], sysconf(_SC_PAGESIZE));
+	if (tx->perf_fd[i]>=0) close(tx->perf_fd[i]);
+	tx->perf_page[i] = NULL;
+	tx->perf_fd[i] = -1;
+    }
+    tx->perf_tid = 0;
+}
 
-    /* if we don't have a hit in the bloom filter we know for sure that
-     * this is a new entry and can skip directly to the allocate part
-     * otherwise we must check the hashtable for such an entry
-     * (this is expensive!)
-     */
-#ifdef WRITEBLOOM
-    //if (((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom)) {
-    stm_word_t wbloomhash = WBLOOMHASH((stm_word_t)addr);
-    if ((wbloomhash & tx->writebloom) != wbloomhash) {
-	hashptr=NULL;
-    } else {
-#endif
-	hashptr = *hashentry;
-	
-	/* fast forward to the correct entry */
-	while (hashptr!=NULL && hashptr->addr!=addr) {
-	    hashptr = hashptr->next;
-	}
-#ifdef WRITEBLOOM
-    } 
-#endif
+static inline uint64_t perf_rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+    asm __volatile__("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return low | ((uint64_t)high << 32);
+}
+
+/* reads all counters, with rdpmc if the kernel allows it (otherwise with read) */
+static inline void perf_read(stm_tx_t *tx, uint64_t *values)
+{
+    struct perf_event_mmap_page *page;
+    uint32_t seq, idx;
+    uint64_t count;
+    int64_t pmc;
+    int i;
     
-    /* return the address if we found the entry */
-    /* it is either NULL or contains our hashptr with the correct addr */
-    if (hashptr!=NULL) {
-#ifndef EAGER_LOCKING
-    	// if not eager locking -> check if addr still valid!
-	stm_word_t version = lock_safe_get_value(tx, ADDR2LOCKADDR(addr));
-	if (version>tx->max_version) {
-	    DPRINTF("write: abort: version>max_version\n");
-	    stm_retry(tx);
+    for (i=0; i<PERF_EVENTS; i++) {
+	if ((page = tx->perf_page[i])==NULL) {
+	    if (tx->perf_fd[i]<0 || read(tx->perf_fd[i], &values[i], sizeof(uint64_t))!=sizeof(uint64_t)) values[i] = 0;
+	    continue;
 	}
-#endif
-	return hashptr;
+	do {
+	    seq = page->lock;
+	    asm __volatile__("": : :"memory");
+	    idx = page->index;
+	    count = page->offset;
+	    if (page->cap_user_rdpmc && idx) {
+		/* sign extend the counter of pmc_width bits */
+		pmc = perf_rdpmc(idx - 1) << (64 - page->pmc_width);
+		count += pmc >> (64 - page->pmc_width);
+	    } else if (read(tx->perf_fd[i], &count, sizeof(uint64_t))!=sizeof(uint64_t)) {
+		count = 0;
+	    }
+	    asm __volatile__("": : :"memory");
+	} while (page->lock!=seq);
+	values[i] = count;
     }
+}
+
+/* the entry of a start site, the last entry takes all sites that do not fit */
+static perf_site_t *perf_site(stm_tx_t *tx, void *site)
+{
+    int i;
     
-    /* maybe we need to allocate a new one */
-    if (allocate) {
-	/* make sure, that we have the lock as well */
-#ifdef EAGER_LOCKING
-	lock_acquire(tx, addr);
-	asm __volatile__("": : :"memory");
-#endif
-	++tx->nr_uniq_writes;
-	// no more space - need to allocate new slab
-	if (unlikely(tx->writeset->size==NRWRITESINSLAB)) {
-	    bufferslab_t *slab = alloc_slab(tx);
-	    slab->next = tx->writeset;
-	    tx->writeset = slab;
+    for (i=0; i<PERF_SITES-1; i++) {
+	if (tx->perf_sites[i].site==site) return &tx->perf_sites[i];
+	if (tx->perf_sites[i].site==NULL) {
+	    TX_STATS_BEGIN(tx);
+	    tx->perf_sites[i].site = site;
+	    TX_STATS_END(tx);
+	    return &tx->perf_sites[i];
 	}
+    }
+    return &tx->perf_sites[PERF_SITES-1];
+}
 
-	writeset_t *newwrite = &(tx->writeset->data.writes[tx->writeset->size++]);
-#if defined(ADAPTIVENESS)
-	if (*hashentry!=NULL) tx->whashcollisions++;
-#endif
-	newwrite->next = (*hashentry);
-	newwrite->addr = addr;
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-	if (tx->writethrough) {
-	    newwrite->value = *addr;
-	}
-#elif defined(WRITETHROUGH)
-	newwrite->value = *addr;
-#endif
-#ifdef WRITEBLOOM
-	tx->writebloom|=WBLOOMHASH((stm_word_t)addr);
-#endif
-	*hashentry = newwrite;
+static inline void perf_add(uint64_t *sum, uint64_t *from, uint64_t *to)
+{
+    int i;
+    for (i=0; i<PERF_EVENTS; i++) sum[i] += to[i] - from[i];
+}
 
-	return newwrite;
+/* samples[0]: commit entry, 1: locks acquired, 2: validated, 3: written back */
+static void perf_commit(stm_tx_t *tx, uint64_t samples[5][PERF_EVENTS], stm_word_t writer)
+{
+    perf_site_t *site = tx->perf_cur;
+    int i;
+    
+    perf_read(tx, samples[4]);
+    TX_STATS_BEGIN(tx);
+    site->commits++;
+    perf_add(site->body, tx->perf_start, samples[0]);
+    if (writer) {
+	site->writers++;
+	for (i=0; i<PERF_PHASES; i++) perf_add(site->phase[i], samples[i], samples[i+1]);
     }
-    return NULL;
+    TX_STATS_END(tx);
 }
 
-/**
- * Reads a memory location transactionally
- * There are several cases we must consider
- * * we already have the lock on that memory region
- *   * we already wrote to that memory address -> return the (cached) value
- *   * we did not write to that memory address -> return *addr
- * * we did not write to that memory region
- *   * check if we already read from that location and check version -> return *addr
- *     (this might not be needed)
- *   * add a new read entry and check the version -> return *addr
- */
-static inline __always_inline stm_word_t buf_check_read(stm_tx_t *tx, stm_word_t *addr)
+static void perf_abort(stm_tx_t *tx)
 {
-    volatile stm_word_t *lock;
-    readset_t *hashptr;
-    stm_word_t value, version;
+    perf_site_t *site = tx->perf_cur;
+    uint64_t now[PERF_EVENTS];
     
-    /* Check status */
-    assert(tx->status == TX_ACTIVE);
+    perf_read(tx, now);
+    TX_STATS_BEGIN(tx);
+    site->aborts++;
+    perf_add(site->aborted, tx->perf_start, now);
+    TX_STATS_END(tx);
+}
+
+static void perf_print_line(FILE *out, const char *name, uint64_t *values, unsigned long n)
+{
+    int i;
+    
+    fprintf(out, "  %-12s", name);
+    for (i=0; i<PERF_EVENTS; i++) fprintf(out, " %10.1f", (double)values[i]/n);
+    fprintf(out, " %6.2f\n", values[PERF_CYCLES] ? (double)values[PERF_INSTRUCTIONS]/values[PERF_CYCLES] : 0.0);
+}
+
+/* merges the tables of all descriptors by site */
+void stm_dump_perf(FILE *out)
+{
+    static const char *phases[PERF_PHASES] = { "acquire", "validate", "write back", "release" };
+    perf_site_t *sites, cur;
+    stm_tx_t *tx;
+    int i, j, k, n = 0, max = 0;
+    
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) max += PERF_SITES;
+    if (max==0) return;
+    if ((sites = (perf_site_t*)calloc(max, sizeof(perf_site_t)))==NULL) {
+	perror("malloc: no free memory!");
+	exit(1);
+    }
+    for (tx = all_tx; tx!=NULL; tx = tx->next_tx) {
+	for (i=0; i<PERF_SITES; i++) {
+	    stm_stats_read(tx, &cur, &tx->perf_sites[i], sizeof(perf_site_t));
+	    if (cur.site==NULL) continue;
+	    /* the last entry mixes sites */
+	    if (i==PERF_SITES-1) cur.site = (void*)~0UL;
+	    for (j=0; j<n && sites[j].site!=cur.site; j++);
+	    if (j==n) sites[n++].site = cur.site;
+	    sites[j].commits += cur.commits;
+	    sites[j].aborts += cur.aborts;
+	    sites[j].writers += cur.writers;
+	    for (k=0; k<PERF_EVENTS; k++) {
+		sites[j].body[k] += cur.body[k];
+		sites[j].aborted[k] += cur.aborted[k];
+		for (i=0; i<PERF_PHASES; i++) sites[j].phase[i][k] += cur.phase[i][k];
+	    }
+	}
+    }
+    if (n>0) fprintf(out, "Hardware counters per transaction site (averages):\n");
+    for (j=0; j<n; j++) {
+	perf_site_t *site = &sites[j];
+	if (site->site==(void*)~0UL)
+	    fprintf(out, "Site (other): %lu commits, %lu aborts\n", site->commits, site->aborts);
+	else
+	    fprintf(out, "Site %p: %lu commits, %lu aborts\n", site->site, site->commits, site->aborts);
+	fprintf(out, "  %-12s", "");
+	for (k=0; k<PERF_EVENTS; k++) fprintf(out, " %10s", perf_events[k].name);
+	fprintf(out, " %6s\n", "IPC");
+	if (site->commits) perf_print_line(out, "body", site->body, site->commits);
+	for (i=0; i<PERF_PHASES && site->writers; i++) perf_print_line(out, phases[i], site->phase[i], site->writers);
+	if (site->aborts) perf_print_line(out, "aborted", site->aborted, site->aborts);
+    }
+    free(sites);
+}
+
+/* at stm_exit: to ADAPTSTM_PERF, or to stdout with GLOBAL_STATS */
+static void perf_exit()
+{
+    char *name = getenv("ADAPTSTM_PERF");
+    FILE *out;
+    
+    if (name==NULL) {
+#ifdef GLOBAL_STATS
+	stm_dump_perf(stdout);
+#endif
+	return;
+    }
+    if ((out = fopen(name, "w"))==NULL) {
+	perror("fopen: cannot write the hardware counters");
+	return;
+    }
+    stm_dump_perf(out);
+    fclose(out);
+}
+#else
+/* without PERF_COUNTERS nothing is counted */
+void stm_dump_perf(FILE *out)
+{
+}
+#endif
+
+
+/*******************************************************************\
+ * START, COMMIT and ABORT
+\*******************************************************************/
+
+/**
+ * Start a transaction
+ *
+ * @param tx is a pointer to the transaction descriptor
+ * @param env is a pointer to the jump buffer which is used to return to this point in case of a retry
+ *            or NULL to create a jump buffer internally using the stack saving mechanism
+ * @param readonly is 1 if the caller asked for a read-only transaction
+ * @param site is the return address of stm_start (used to detect read-only sites)
+ */
+static inline __always_inline void stm_start_helper(stm_tx_t *tx, jmp_buf *env, stm_word_t readonly, void *site)
+{
+    DPRINTF("\tstm start: %p\n", tx);
+    /* Check status */
+    assert(tx->status != TX_ACTIVE && tx->status != TX_WAITING);
+#ifdef ACCESS_RECORD
+    if (tx->rec_buf!=NULL) rec_start(tx, readonly, site);
+#endif
+#ifdef ABORT_PROFILE
+    tx->prof_site = site;
+    tx->prof_pc = site;
+    PROF_CLEAR(tx);
+#endif
+    
+    //tx->jmp = env;
+    
+    /* Reset the tansactional memory buffer */
+    tx->freed = NULL;
+    tx->allocated = NULL;
+
+#ifdef ADAPTIVENESS
+    // used for adaptiveness
+    tx->wtotal+=tx->nr_uniq_writes;
+    tx->nrtx++;
+    
+    // adapt every 100 transactions
+    if (unlikely(tx->adaptcommits>=TX_PARAM(tx, ADAPT_PERIOD))) {
+	/* pick up global parameter changes */
+	if (unlikely(tx->param_epoch!=stm_param_epoch)) stm_param_load(tx);
+
+	// adapt write through or write back
+	if ((tx->adaptretries*100) / (tx->adaptcommits+1) > TX_PARAM(tx, ADAPT_RETRY_PERCENT)) {
+	    if (tx->writethrough==1) TX_STAT_INC(tx, wt_switches);
+	    tx->writethrough=0; /* false */
+	} else {
+	    if (tx->writethrough==0) TX_STAT_INC(tx, wt_switches);
+	    tx->writethrough=1;
+	}
+#ifdef ADAPTIVE_LOCKING
+	lock_adapt_mode(tx);
+#endif
+
+#ifdef ADAPTIVE_WHASH
+	if ((tx->wtotal/tx->nrtx)*100>tx->whashsize*TX_PARAM(tx, WHASH_GROW_PERCENT) && tx->whashsize<WBUF_MAX_HASH_ARRAY_SIZE) {
+	    // more than 33% (default) load in the whashtable -> double the whashtable
+	    tx->whashsize*=2;
+	    tx->whashmask = tx->whashsize-1;
+	    TX_STAT_INC(tx, hash_switches);
+	    //printf("new whashsize: %d\n", tx->whashsize);
+	    //free(tx->writehash);
+	    //if (posix_memalign((void**)&(tx->writehash), 64, tx->whashsize*sizeof(writeset_t*))!=0) {
+	    //perror("malloc: no free memory!");
+	    //exit(1);
+	    //}
+	}
+	if ((tx->wtotal/tx->nrtx)*100<tx->whashsize*TX_PARAM(tx, WHASH_SHRINK_PERCENT) && tx->whashsize>16) {
+	    // less than 10% (default) load in the whashtable -> half the whashtable
+	    tx->whashsize/=2;
+	    tx->whashmask = tx->whashsize-1;
+	    TX_STAT_INC(tx, hash_switches);
+	    //printf("new whashsize: %d\n", tx->whashsize);
+	    //free(tx->writehash);
+	    //if (posix_memalign((void**)&(tx->writehash), 64, tx->whashsize*sizeof(writeset_t*))!=0) {
+	    //perror("malloc: no free memory!");
+	    //exit(1);
+	    //}
+	}
+#endif
+	
+	if (tx->whashcollisions*10/(tx->wtotal+1)) {
+	    // > 25% collisionrate
+	    //printf("switching hash fct: %d\n", tx->adaptive_hash);
+	    TX_STAT_INC(tx, hash_switches);
+#ifdef ADAPTIVEHASH
+	    tx->adaptive_hash = (tx->adaptive_hash+1) % 6;
+#endif
+#ifdef ADAPTIVEWHASH2
+	    tx->adaptive_hash = (tx->adaptive_hash+3) % 7 + 2;
+#endif
+	}
+	
+	tx->whashcollisions=0;
+	// reset
+	tx->adaptretries = 0;
+	tx->adaptcommits = 1;
+
+#ifdef LOCKS_QUIESCE
+	// false conflicts or hot locks? -> change the lock mapping
+	lock_adapt_check(tx);
+#endif
+
+    }
+    tx->writebloom = 0;
+#else
+    // no adaptiveness: set the writehash to zero and remove wbloom
+    sse2_memzero128aligned(tx->writehash, tx->whashsize*sizeof(writeset_t*));
+    tx->writebloom = -1;
+    if (unlikely(tx->param_epoch!=stm_param_epoch)) stm_param_load(tx);
+#endif
+    
+    /* clear read and writeset */
+    tx->nr_uniq_writes = 0;
+    tx->nrreads = 0;
+    if (unlikely(++tx->readepoch==0)) {
+	/* the tag wrapped around, old entries would match again */
+	memset(tx->readfilter, 0x0, (tx->readfiltermask+1)*sizeof(uint64_t));
+	tx->readepoch = 1;
+    }
+    tx->nrlocks = 0;
+    if (tx->range_chunks!=NULL) range_reset(tx);
+    
+    tx->waiting_for = NULL;
+    /* a new attempt, older abort requests do not match anymore */
+    tx->cm_serial++;
+    if (tx->cm_policy==STM_CM_GREEDY && tx->cm_timestamp==0) tx->cm_timestamp = cm_now();
+#ifdef GLOBAL_STATS
+    if (tx->lat_start==0) tx->lat_start = TSC_READ();
+#endif
+#ifdef CYCLE_STATS
+    tx->cyc_attempt = TSC_READ();
+    if (tx->cyc_start==0) tx->cyc_start = tx->cyc_attempt;
+#endif
+    
+#ifdef STATS
+    tx->nb_reads = 0;
+    tx->nb_writes = 0;
+#endif
+    /* remember the current version */
+    tx->max_version = clock_start_version(tx);
+#ifdef GLOBAL_STATS
+    tx->start    = tx->max_version;
+#endif
+
+#ifdef ADAPTIVE_READONLY
+    /* sites that did not write for a while run read-only */
+    tx->ro_site = &(tx->ro_sites[RO_SITE_IDX(site)]);
+    if (tx->ro_site->site != site) {
+	tx->ro_site->site = site;
+	tx->ro_site->streak = 0;
+    }
+    if (tx->ro_site->streak >= RO_PROMOTE_COMMITS) readonly = 1;
+#endif
+    /* unless a store already restarted this transaction */
+    tx->readonly = readonly && !tx->ro_forbidden;
+    TRACE(tx, TRACE_START, tx->readonly, 0, TRACE_NOBODY);
+
+    /* Change transaction status to TX_ACTIVE*/
+    tx->status = TX_ACTIVE;
+    tx->in_flight = 1;
+#ifdef LOCKS_QUIESCE
+    /* the lock mapping may only change while we are not in flight */
+    LOCK_QUIESCE_FENCE();
+    if (unlikely(lock_quiesce_pending) && !tx->escalated) lock_quiesce_wait(tx);
+#endif
+#ifdef PERF_COUNTERS
+    if (tx->perf_tid!=0) {
+	tx->perf_cur = perf_site(tx, site);
+	perf_read(tx, tx->perf_start);
+    }
+#endif
+}
+
+void stm_start(stm_tx_t *tx, jmp_buf *env)
+{
+    stm_start_helper(tx, env, 0, __builtin_return_address(0));
+}
+
+/**
+ * Start a transaction with a deadline
+ * The deadline is set by the first attempt and kept across retries,
+ * a retry past the deadline times out or escalates.
+ */
+int stm_start_deadline(stm_tx_t *tx, jmp_buf *env, uint64_t deadline, int flags)
+{
+    if (tx->deadline==0) {
+	if (flags & STM_DEADLINE_TSC)
+	    tx->deadline = deadline;
+	else
+	    tx->deadline = cm_now() + deadline*cm_tsc_khz/1000000;
+	if (tx->deadline==0) tx->deadline = 1;
+	tx->deadline_flags = flags;
+    } else if (!tx->escalated && cm_now()>=tx->deadline) {
+	if (!(tx->deadline_flags & STM_DEADLINE_ESCALATE)) {
+	    DPRINTF("\tstm timed out: %p\n", tx);
+	    TX_STAT_INC(tx, timeouts);
+	    tx->deadline = 0;
+	    tx->cm_karma = 0;
+	    tx->cm_timestamp = 0;
+#ifdef GLOBAL_STATS
+	    tx->lat_start = 0;
+#endif
+#ifdef CYCLE_STATS
+	    tx->cyc_start = 0;
+#endif
+	    return STM_TIMED_OUT;
+	}
+	/* guaranteed progress: wait until no other transaction runs, keep them out until we commit */
+	DPRINTF("\tstm escalated: %p\n", tx);
+	TX_STAT_INC(tx, escalations);
+	lock_quiesce_begin(1);
+	tx->escalated = 1;
+    }
+    stm_start_helper(tx, env, 0, __builtin_return_address(0));
+    return 0;
+}
+
+/**
+ * Start a read-only transaction
+ * Loads are neither logged nor validated, a store restarts the
+ * transaction in normal mode.
+ */
+void stm_start_ro(stm_tx_t *tx, jmp_buf *env)
+{
+    stm_start_helper(tx, env, 1, __builtin_return_address(0));
+}
+
+/**
+ * Commit this transaction
+ *
+ * @param tx is a pointer to the transaction descriptor
+ */
+void stm_commit(stm_tx_t *tx)
+{
+    stm_word_t commit_version, validate = 0;
+#ifdef PERF_COUNTERS
+    uint64_t pmc[5][PERF_EVENTS];			/* commit phase boundaries */
+#endif
+#ifdef CYCLE_STATS
+    uint64_t cyc[5];					/* commit phase boundaries */
+    
+    cyc[0] = 0;
+#endif
+    
+    DPRINTF("\tstm commit start: %p\n", tx);
+    PROF_PC(tx);
+    PERF_SAMPLE(tx, pmc[0]);
+
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+    /* last chance for other transactions to abort us */
+    CM_CHECK_ABORT(tx);
+    /* range buffers that were not finished */
+    while (unlikely(tx->range_pending!=NULL))
+	stm_finish_writing(tx, tx->range_pending->addr, tx->range_pending->size);
+    
+    if (tx->nr_uniq_writes==0 && tx->nrlocks==0) {
+	/* No need to acquire, validate or extend anything in read only mode */
+	tx->status = TX_COMMITTED;
+#ifdef ADAPTIVE_READONLY
+	tx->ro_site->streak++;
+#endif
+#ifdef STATS
+	if (tx->readonly) tx->nb_ro_commits++;
+#endif
+    } else {
+#ifdef ADAPTIVE_READONLY
+	tx->ro_site->streak = 0;
+#endif
+	/* Try to acquire all locks */
+#ifdef CYCLE_STATS
+	cyc[0] = TSC_READ();
+#endif
+	buf_acquire_all_locks(tx);
+	
+	/* Increment the counter and get the newest version */
+	commit_version = clock_commit_version(tx, &validate);
+#ifdef CYCLE_STATS
+	cyc[1] = TSC_READ();
+#endif
+	PERF_SAMPLE(tx, pmc[1]);
+	
+	/* Special case: if max_version + 2 == commit_version we do not need to validate
+	 * (the clock strategy tells us if this shortcut holds) */
+#ifdef STATS
+	if (validate) tx->nb_commit_validate++; else tx->nb_commit_novalidate++;
+#endif
+	if (validate) {
+	    /* Before we can write back we need to validate the read set */
+	    if (unlikely(!buf_validate(tx))) {
+		/* This is the end of this function since stm_retry never returns */
+		DPRINTF("\tstm commit validate failed: %p\n", tx);
+		TX_ABORT(tx, STM_ABORT_COMMIT_VALIDATE);
+	    }
+	}
+	/* The locks are acquired and the read set validated */
+	tx->status = TX_COMMITTED;
+#ifdef CYCLE_STATS
+	cyc[2] = validate ? TSC_READ() : cyc[1];
+#endif
+#ifdef PERF_COUNTERS
+	if (validate) PERF_SAMPLE(tx, pmc[2]); else memcpy(pmc[2], pmc[1], sizeof(pmc[1]));
+#endif
+	
+	/* Write the write buffer back to the shared memory */
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+	if (!tx->writethrough)
+	    buf_write_back(tx);
+#elif defined(WRITEBACK)
+	buf_write_back(tx);
+#endif
+#ifdef CYCLE_STATS
+	cyc[3] = TSC_READ();
+#endif
+	PERF_SAMPLE(tx, pmc[3]);
+
+	buf_release_all_locks(tx, commit_version);
+    }
+    
+    /* Free the memory which was freed during the transaction */
+    mem_free_memory(tx);
+    
+#ifdef ADAPTIVE_LOCKING
+    lock_account_held(tx);
+#endif
+    TX_STATS_BEGIN(tx);
+    tx->stats.s.commits++;
+    if (tx->nr_uniq_writes==0 && tx->nrlocks==0) tx->stats.s.ro_commits++;
+    tx->stats.s.reads += tx->nrreads;
+    tx->stats.s.writes += tx->nr_uniq_writes;
+    if (tx->nrreads > tx->stats.s.max_reads) tx->stats.s.max_reads = tx->nrreads;
+    if (tx->nr_uniq_writes > tx->stats.s.max_writes) tx->stats.s.max_writes = tx->nr_uniq_writes;
+#ifdef CYCLE_STATS
+    cyc[4] = TSC_READ();
+    tx->stats.s.cycles_committed += cyc[4] - tx->cyc_attempt;
+    hist_add(&tx->stats.hist[STM_HIST_ATTEMPT], cyc[4] - tx->cyc_attempt);
+    hist_add(&tx->stats.hist[STM_HIST_TX], cyc[4] - tx->cyc_start);
+    if (cyc[0]) {
+	hist_add(&tx->stats.hist[STM_HIST_ACQUIRE], cyc[1] - cyc[0]);
+	if (validate) hist_add(&tx->stats.hist[STM_HIST_VALIDATE], cyc[2] - cyc[1]);
+	hist_add(&tx->stats.hist[STM_HIST_WRITEBACK], cyc[3] - cyc[2]);
+	hist_add(&tx->stats.hist[STM_HIST_RELEASE], cyc[4] - cyc[3]);
+    }
+    tx->cyc_start = 0;
+#endif
+    TX_STATS_END(tx);
+    TRACE(tx, TRACE_COMMIT, 0, tx->nr_uniq_writes, TRACE_NOBODY);
+    LIVE_UPDATE(tx);
+#ifdef ACCESS_RECORD
+    if (tx->rec_buf!=NULL) {
+	if (unlikely(tx->rec_len==tx->rec_size)) rec_grow(tx);
+	tx->rec_buf[tx->rec_len++] = REC_COMMIT;
+    }
+#endif
+#ifdef PERF_COUNTERS
+    if (tx->perf_cur!=NULL) perf_commit(tx, pmc, tx->nr_uniq_writes!=0 || tx->nrlocks!=0);
+    tx->perf_cur = NULL;
+#endif
+    /* Reset the buffer */
+    buf_reset(tx);
+    tx->in_flight = 0;
+    tx->cm_karma = 0;
+    tx->cm_timestamp = 0;
+    tx->deadline = 0;
+    if (unlikely(tx->escalated)) {
+	tx->escalated = 0;
+	lock_quiesce_end();
+    }
+#ifdef GLOBAL_STATS
+    prio_latency_add(&tx->latency[tx->priority], TSC_READ() - tx->lat_start);
+    tx->lat_start = 0;
+#endif
+
+    DPRINTF("\tstm commit done: %p\n", tx);
+    tx->ro_forbidden = 0;
+
+#ifdef ADAPTIVENESS
+    tx->adaptcommits++;
+#endif
+
+#ifdef GLOBAL_STATS
+    tx->commits++;
+#endif
+#ifdef STATS
+    tx->nb_tot_reads+=tx->nb_reads;
+    tx->nb_tot_writes+=tx->nb_writes;
+    if (tx->nb_writes>tx->nb_max_writes) tx->nb_max_writes = tx->nb_writes;
+    if (tx->nb_writes<tx->nb_min_writes) tx->nb_min_writes = tx->nb_writes;
+    if (tx->nb_reads>tx->nb_max_reads) tx->nb_max_reads = tx->nb_reads;
+    if (tx->nb_reads<tx->nb_min_reads) tx->nb_min_reads = tx->nb_reads;
+#endif
+    /* Check status */
+    assert(tx->status == TX_COMMITTED);
+}
+
+static inline __always_inline void stm_abort_or_retry_helper(stm_tx_t *tx) {
+    
+    /* if we are in a writethrough mode we first need to undo all changes! */
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+    if (tx->writethrough)
+	buf_undo_writes(tx);
+#elif defined(WRITETHROUGH)
+    buf_undo_writes(tx);
+#endif
+    /* after the write entries, the stripes of range accesses hold older values */
+    if (unlikely(tx->range_undo!=NULL)) range_undo(tx);
+
+    buf_release_all_locks(tx, 0);
+
+    tx->status = TX_ABORTED;
+
+    /* Deallocat allocated memory during transaction */
+    mem_free_memory(tx);
+    
+#ifdef ADAPTIVE_LOCKING
+    lock_account_held(tx);
+#endif
+    /* reset the rw_buffer */
+    buf_reset(tx);
+    tx->in_flight = 0;
+#ifdef ABORT_PROFILE
+    prof_record(tx);
+#endif
+#ifdef PERF_COUNTERS
+    if (tx->perf_cur!=NULL) perf_abort(tx);
+    tx->perf_cur = NULL;
+#endif
+#ifdef CYCLE_STATS
+    {
+	unsigned long cycles = TSC_READ() - tx->cyc_attempt;
+	TX_STATS_BEGIN(tx);
+	tx->stats.s.cycles_wasted += cycles;
+	hist_add(&tx->stats.hist[STM_HIST_ATTEMPT], cycles);
+	TX_STATS_END(tx);
+    }
+#endif
+    TX_STATS_BEGIN(tx);
+    tx->stats.s.aborts++;
+    tx->stats.s.aborts_by[tx->abort_reason]++;
+    TX_STATS_END(tx);
+    LIVE_UPDATE(tx);
+#ifdef TX_TRACE
+    if (tx->trace_ring!=NULL) trace_abort(tx);
+    tx->trace_killer = TRACE_NOBODY;
+#endif
+}
+
+/**
+ * Retry this transaction
+ *
+ * @param tx is a pointer to the transaction descriptor
+ */
+inline __always_inline void stm_retry(stm_tx_t *tx)
+{
+    DPRINTF("\tstm retry: %p\n", tx);
+
+    /* Check status */
+    assert(tx->status == TX_ACTIVE || tx->status == TX_WAITING);
+    
+    /* the work of this attempt counts for the next one */
+    tx->cm_karma += tx->nrreads + tx->nr_uniq_writes;
+    stm_abort_or_retry_helper(tx);
+    
+    tx->adaptretries++;
+#ifdef ACCESS_RECORD
+    /* only committed attempts are recorded */
+    tx->rec_len = tx->rec_mark;
+    tx->rec_last = tx->rec_mark_last;
+#endif
+    tx->abort_reason = STM_ABORT_EXPLICIT;
+
+#ifdef GLOBAL_STATS
+    tx->retries++;
+#endif
+    
+    //if (tx->jmp != NULL) {
+    longjmp(tx->env,1);
+    //} else {
+    //perror("no longjmp destination\n");
+    //exit(1);
+    //}
+}
+
+
+/*******************************************************************\
+ *  LOAD and STORE                                                 *
+\*******************************************************************/
+
+/**
+ * Called by the CURRENT thread to load a word-sized value.
+ *
+ * @param tx is a pointer to the transaction descriptor
+ * @param addr is the address to load
+ */
+stm_word_t stm_load(stm_tx_t *tx, stm_word_t *addr)
+{
+    DPRINTF("\t\tstm load: %p (%p)", tx, addr);
+    PROF_PC(tx);
+
+#ifdef STATS
+    tx->nb_reads++;
+#endif
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+    CM_CHECK_ABORT(tx);
+    REC(tx, REC_LOAD, addr);
+
+    /* make sure that we read the correct version */
+    if (tx->readonly) return buf_check_read_ro(tx, addr);
+    return buf_check_read(tx, addr);
+}
+
+
+/**
+ * Called by the CURRENT thread to store a word-sized value.
+ *
+ * @param tx is a pointer to the transaction descriptor
+ * @param addr is the address to write to
+ * @param value is the value to write to addr
+ */
+void stm_store(stm_tx_t *tx, stm_word_t *addr, stm_word_t value)
+{
+    DPRINTF("\t\tstm write: %p (%p=%p)\n", tx, addr, (void*)value);
+    writeset_t *write;
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_writes++;
+#endif
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    CM_CHECK_ABORT(tx);
+    REC(tx, REC_STORE, addr);
+#ifdef TX_TRACE
+    stm_word_t writes = tx->nr_uniq_writes;
+    write = buf_get_write_addr(tx, addr, 1, value);
+    if (tx->nr_uniq_writes!=writes) TRACE(tx, TRACE_STORE, 0, LOCK_IDX_FROM_ADDR(addr), TRACE_NOBODY);
+#else
+    write = buf_get_write_addr(tx, addr, 1, value);
+#endif
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+    if (tx->writethrough) {
+	*addr = value;
+    } else {
+	write->value = value;
+	write->mask = WMASK_ALL;
+    }
+#elif defined(WRITEBACK)
+    write->value = value;
+    write->mask = WMASK_ALL;
+#elif defined(WRITETHROUGH)
+    *addr = value;
+#else
+    assert(1=0); // either WRITEBACK, or WRITEHTROUGH or ADAPTIVENESS and WRITEBACK and WRITETHROUGH must be defined!
+#endif
+}
+
+/**
+ * Called by the CURRENT thread to store the bits of value that are set
+ * in mask, the other bits of the word keep their value.
+ * Write-back merges the bits into the write entry (and the entry into
+ * memory at commit, under the lock), write-through into memory. The
+ * word is not read first.
+ *
+ * @param tx is a pointer to the transaction descriptor
+ * @param addr is the address to write to
+ * @param value is the value to write to addr
+ * @param mask selects the bits of value that are written
+ */
+void stm_store2(stm_tx_t *tx, stm_word_t *addr, stm_word_t value, stm_word_t mask)
+{
+    DPRINTF("\t\tstm write2: %p (%p=%p/%p)\n", tx, addr, (void*)value, (void*)mask);
+    writeset_t *write;
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_writes++;
+#endif
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    CM_CHECK_ABORT(tx);
+    REC(tx, REC_STORE, addr);
+#ifdef TX_TRACE
+    stm_word_t writes = tx->nr_uniq_writes;
+    write = buf_get_write_addr(tx, addr, 1, value);
+    if (tx->nr_uniq_writes!=writes) TRACE(tx, TRACE_STORE, 0, LOCK_IDX_FROM_ADDR(addr), TRACE_NOBODY);
+#else
+    write = buf_get_write_addr(tx, addr, 1, value);
+#endif
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+    if (tx->writethrough) {
+	*addr = (*addr & ~mask) | (value & mask);
+    } else {
+	write->value = (write->value & ~mask) | (value & mask);
+	write->mask |= mask;
+    }
+#elif defined(WRITEBACK)
+    write->value = (write->value & ~mask) | (value & mask);
+    write->mask |= mask;
+#elif defined(WRITETHROUGH)
+    (void)write; /* the entry only keeps the old value */
+    *addr = (*addr & ~mask) | (value & mask);
+#endif
+}
+
+/* size bytes at addr (naturally aligned, inside one word) are read from their word */
+static inline __always_inline void stm_load_sub(stm_tx_t *tx, volatile void *addr, void *to, stm_word_t size)
+{
+    stm_word_t value;
+
+    assert(SUBWORD_OFF(addr) + size <= sizeof(stm_word_t));
+    value = stm_load(tx, SUBWORD_BASE(addr));
+    memcpy(to, (char*)&value + SUBWORD_OFF(addr), size);
+}
+
+/* size bytes at addr (naturally aligned, inside one word) are masked into their word */
+static inline __always_inline void stm_store_sub(stm_tx_t *tx, volatile void *addr, const void *from, stm_word_t size)
+{
+    stm_word_t value = 0;
+
+    assert(SUBWORD_OFF(addr) + size <= sizeof(stm_word_t));
+    memcpy((char*)&value + SUBWORD_OFF(addr), from, size);
+    stm_store2(tx, SUBWORD_BASE(addr), value, buf_byte_mask(SUBWORD_OFF(addr), size));
+}
+
+/**
+ * Sub-word loads and stores: the word that contains addr is read or
+ * written with a mask, its neighbouring bytes are not touched.
+ */
+uint8_t stm_load_u8(stm_tx_t *tx, volatile uint8_t *addr)
+{
+    uint8_t value;
+    stm_load_sub(tx, addr, &value, sizeof(value));
+    return value;
+}
+
+uint16_t stm_load_u16(stm_tx_t *tx, volatile uint16_t *addr)
+{
+    uint16_t value;
+    stm_load_sub(tx, addr, &value, sizeof(value));
+    return value;
+}
+
+uint32_t stm_load_u32(stm_tx_t *tx, volatile uint32_t *addr)
+{
+    uint32_t value;
+    stm_load_sub(tx, addr, &value, sizeof(value));
+    return value;
+}
+
+void stm_store_u8(stm_tx_t *tx, volatile uint8_t *addr, uint8_t value)
+{
+    stm_store_sub(tx, addr, &value, sizeof(value));
+}
+
+void stm_store_u16(stm_tx_t *tx, volatile uint16_t *addr, uint16_t value)
+{
+    stm_store_sub(tx, addr, &value, sizeof(value));
+}
+
+void stm_store_u32(stm_tx_t *tx, volatile uint32_t *addr, uint32_t value)
+{
+    stm_store_sub(tx, addr, &value, sizeof(value));
+}
+
+/**
+ * A read-only transaction tried to write, restart it in normal mode
+ * (and stop running its start site read-only).
+ */
+static void stm_ro_restart(stm_tx_t *tx)
+{
+    DPRINTF("\tstm ro restart: %p\n", tx);
+    tx->ro_forbidden = 1;
+#ifdef ADAPTIVE_READONLY
+    tx->ro_site->streak = 0;
+#endif
+#ifdef STATS
+    tx->nb_ro_restarts++;
+#endif
+    TX_ABORT(tx, STM_ABORT_RO_RESTART);
+}
+
+/*******************************************************************\
+ *  Range accesses                                                 *
+\*******************************************************************/
+
+/* size bytes of scratch memory (16 byte aligned) until the next attempt starts */
+static void *range_alloc(stm_tx_t *tx, stm_word_t size)
+{
+    range_chunk_t *chunk = tx->range_chunks;
+    stm_word_t bytes;
+    void *mem;
+
+    size = RANGE_ALIGN(size);
+    if (chunk==NULL || chunk->used+size > chunk->size) {
+	bytes = (size>RANGE_CHUNK_SIZE) ? size : RANGE_CHUNK_SIZE;
+	if (posix_memalign((void**)&chunk, 64, sizeof(range_chunk_t)+bytes)!=0) {
+	    perror("malloc: no free memory!");
+	    exit(1);
+	}
+	chunk->size = bytes;
+	chunk->used = 0;
+	chunk->next = tx->range_chunks;
+	tx->range_chunks = chunk;
+    }
+    mem = chunk->data + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+/* a new attempt: keeps the newest chunk, frees the others */
+static void range_reset(stm_tx_t *tx)
+{
+    range_chunk_t *chunk = tx->range_chunks, *old;
+
+    while ((old = chunk->next)!=NULL) {
+	chunk->next = old->next;
+	free(old);
+    }
+    chunk->used = 0;
+    tx->range_pending = NULL;
+    tx->range_undo = NULL;
+}
+
+/* abort (write-through): the stripes of the range accesses get their old bytes */
+static void range_undo(stm_tx_t *tx)
+{
+    range_undo_t *undo;
+
+    for (undo = tx->range_undo; undo!=NULL; undo = undo->next)
+	sse2_memcpy(undo->addr, undo->data, undo->size);
+    tx->range_undo = NULL;
+}
+
+/**
+ * Called by the CURRENT thread to read a range: returns a private copy
+ * of [addr, addr+num_bytes) that stays valid until the transaction ends.
+ * Every stripe is checked and logged once.
+ */
+volatile void *stm_get_read_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes)
+{
+    void *copy;
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_reads++;
+#endif
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+    CM_CHECK_ABORT(tx);
+    REC_RANGE(tx, REC_LOAD, addr, num_bytes);
+
+    copy = range_alloc(tx, num_bytes);
+    buf_read_range(tx, (char*)addr, num_bytes, (char*)copy);
+    return copy;
+}
+
+volatile void *stm_get_read2_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes)
+{
+    return stm_get_read_addr(tx, addr, num_bytes);
+}
+
+/**
+ * Write-through: locks the stripes, logs the old values and returns addr,
+ * the caller writes in place. Write-back: returns a buffer (with the
+ * current values if modify is set) that stm_finish_writing moves into
+ * the write set.
+ */
+static volatile void *range_get_write_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes, int modify)
+{
+    range_buf_t *buf;
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_writes++;
+#endif
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    CM_CHECK_ABORT(tx);
+    if (modify) REC_RANGE(tx, REC_LOAD, addr, num_bytes);
+    REC_RANGE(tx, REC_STORE, addr, num_bytes);
+
+    if (!TX_WRITEBACK(tx)) {
+	buf_write_range(tx, (char*)addr, num_bytes, NULL);
+	return addr;
+    }
+    buf = (range_buf_t*)range_alloc(tx, sizeof(range_buf_t) + num_bytes);
+    buf->addr = (char*)addr;
+    buf->size = num_bytes;
+    if (modify) buf_read_range(tx, (char*)addr, num_bytes, buf->data);
+    buf->next = tx->range_pending;
+    tx->range_pending = buf;
+    return buf->data;
+}
+
+volatile void *stm_get_write_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes)
+{
+    return range_get_write_addr(tx, addr, num_bytes, 0);
+}
+
+volatile void *stm_get_modify_addr(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes)
+{
+    return range_get_write_addr(tx, addr, num_bytes, 1);
+}
+
+/**
+ * Called by the CURRENT thread when it is done with the pointer of
+ * stm_get_write_addr/stm_get_modify_addr: the first num_bytes of the
+ * buffer are moved into the write set (write-back, nothing to do for
+ * write-through). Buffers that are not finished are moved at commit.
+ */
+void stm_finish_writing(stm_tx_t *tx, volatile void *addr, unsigned int num_bytes)
+{
+    range_buf_t *buf, **prev;
+
+    for (prev = &tx->range_pending; (buf = *prev)!=NULL; prev = &buf->next) {
+	if (buf->addr==(char*)addr) {
+	    *prev = buf->next;
+	    buf_write_range(tx, buf->addr, (num_bytes<buf->size) ? num_bytes : buf->size, buf->data);
+	    return;
+	}
+    }
+}
+
+/**
+ * Called by the CURRENT thread to copy a shared range into private memory
+ */
+void stm_load_bytes(stm_tx_t *tx, volatile void *addr, void *buf, size_t size)
+{
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_reads++;
+#endif
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+    CM_CHECK_ABORT(tx);
+    REC_RANGE(tx, REC_LOAD, addr, size);
+
+    buf_read_range(tx, (char*)addr, size, (char*)buf);
+}
+
+/**
+ * Called by the CURRENT thread to copy private memory into a shared range
+ */
+void stm_store_bytes(stm_tx_t *tx, volatile void *addr, const void *buf, size_t size)
+{
+    PROF_PC(tx);
+#ifdef STATS
+    tx->nb_writes++;
+#endif
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    CM_CHECK_ABORT(tx);
+    REC_RANGE(tx, REC_STORE, addr, size);
+
+    buf_write_range(tx, (char*)addr, size, (const char*)buf);
+}
+
+/**
+ * Called by the CURRENT thread to copy between two shared ranges (they
+ * must not overlap), RANGE_COPY_SIZE bytes at a time
+ */
+void stm_memcpy(stm_tx_t *tx, volatile void *to, volatile void *from, size_t size)
+{
+    char buf[RANGE_COPY_SIZE];
+    size_t len;
+
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    for (; size>0; size -= len) {
+	len = (size<RANGE_COPY_SIZE) ? size : RANGE_COPY_SIZE;
+	stm_load_bytes(tx, from, buf, len);
+	stm_store_bytes(tx, to, buf, len);
+	from = (char*)from + len;
+	to = (char*)to + len;
+    }
+}
+
+/**
+ * Called by the CURRENT thread to set every byte of a shared range to c
+ */
+void stm_memset(stm_tx_t *tx, volatile void *addr, int c, size_t size)
+{
+    char buf[RANGE_COPY_SIZE];
+    size_t len;
+
+    memset(buf, c, (size<RANGE_COPY_SIZE) ? size : RANGE_COPY_SIZE);
+    for (; size>0; size -= len) {
+	len = (size<RANGE_COPY_SIZE) ? size : RANGE_COPY_SIZE;
+	stm_store_bytes(tx, addr, buf, len);
+	addr = (char*)addr + len;
+    }
+}
+
+
+
+/*******************************************************************\
+ * Functions to work with the read buffers and write buffers
+\*******************************************************************/
+
+static inline void buf_acquire_all_locks(stm_tx_t *tx)
+{
+    bufferslab_t *wset = tx->writeset;
+    stm_word_t i;
+    /* eager locking already owns them */
+    if (TX_EAGER(tx)) return;
+    /* aquire all write locks */
+    while (wset!=NULL) {
+	for (i=0; i<wset->size; i++) {
+	    /* acquire this lock and save the version */
+	    lock_acquire(tx, wset->data.writes[i].addr);
+	}
+	wset = wset->next;
+    }
+}
+
+static inline __always_inline void buf_release_all_locks(stm_tx_t *tx, stm_word_t version)
+{
+    /* release all write locks */
+    lockset_t *mylocks = tx->lockset;
+    stm_word_t i;
+    if (version==0) {
+	for (i=0; i<tx->nrlocks; i++) {
+	    stm_word_t *lockaddr = mylocks[i].lock;
+	    /* release the lock and save the version */
+	    assert(*lockaddr==(stm_word_t)tx);
+	    LOCK_RELEASE(lockaddr, mylocks[i].version);
+	}
+    } else {
+	for (i=0; i<tx->nrlocks; i++) {
+	    stm_word_t *lockaddr = mylocks[i].lock;
+	    /* release the lock and save the version */
+	    assert(*lockaddr==(stm_word_t)tx);
+	    LOCK_RELEASE(lockaddr, version);
+	}
+    }
+#ifdef CM_BLOCKING
+    /* nothing but a load if nobody waits for us */
+    asm __volatile__("": : :"memory");
+    if (unlikely(tx->cm_waiters)) cm_wake(tx);
+#endif
+}
+
+/**
+ * This is a special version of buf_validate that forwards one lock
+ * that has been taken speculatively and we are currently trying to
+ * validate that specific lock and to extend the readset version
+ * So we have to check that lock as well!
+ */
+static inline stm_word_t buf_validate_lockspecial(stm_tx_t *tx, stm_word_t xlockValue, stm_word_t *xlockaddr)
+{
+    readset_t *rset = tx->readset;
+    stm_word_t *lockaddr, lockValue, i;
+
+    /* Check the status */
+    assert(tx->status == TX_ACTIVE);
+
+    for (i=0; i<tx->nrreads; i++) {
+	readset_t *thisread = &(rset[i]);
+	lockaddr = (stm_word_t*)LOCK_ADDR_FROM_IDX(thisread->lock);
+	lockValue = *lockaddr;
+	if (lockaddr==xlockaddr) lockValue = xlockValue; // forward value
+	/* Check if the lock value has changed since we first read it.
+	 * Locks we own (eager: taken on a write, lazy: taken by this
+	 * commit) are fine, lock_acquire retries if the version was
+	 * newer than max_version when it took them. */
+	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) &&
+	    (thisread->version!=LOCK_GET_VERSION_FROM_VALUE(lockValue)))
+	{
+	    DPRINTF("special validate: wrong version: %lx != %lx (tx: %p)\n", thisread->version, lockValue, tx);
+	    return 0;
+	}
+    }
+    return 1;
+}
+static inline stm_word_t buf_validate(stm_tx_t *tx)
+{
+    readset_t *rset = tx->readset;
+    stm_word_t *lockaddr, lockValue, i;
+
+    /* Check the status */
+    assert(tx->status == TX_ACTIVE);
+    TX_STAT_INC(tx, validations);
+
+    for (i=0; i<tx->nrreads; i++) {
+	readset_t *thisread = &(rset[i]);
+	lockaddr = (stm_word_t*)LOCK_ADDR_FROM_IDX(thisread->lock);
+	lockValue = *lockaddr;
+	/* Check if the lock value has changed since we first read it.
+	 * Locks we own (eager: taken on a write, lazy: taken by this
+	 * commit) are fine, lock_acquire retries if the version was
+	 * newer than max_version when it took them. */
+	if ((LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) &&
+	    (thisread->version!=LOCK_GET_VERSION_FROM_VALUE(lockValue)))
+	{
+	    DPRINTF("validate: wrong version: %lx != %lx (tx: %p)\n", thisread->version, lockValue, tx);
+	    PROF_CONFLICT(tx, thisread->lock, 0, NULL);
+	    TRACE(tx, TRACE_VALIDATE, 0, tx->nrreads, TRACE_NOBODY);
+	    return 0;
+	}
+    }
+    TRACE(tx, TRACE_VALIDATE, 1, tx->nrreads, TRACE_NOBODY);
+    return 1;
+}
+
+/**
+ * Write back all data from our local (write) buffer into memory
+ * We don't worry about locks, this function assumes that all locks
+ * are already taken!
+ * (The locks will be freed later by release_all_locks!)
+ */
+static inline void buf_write_back(stm_tx_t *tx)
+{
+    /* Check the status */
+    assert(tx->status == TX_COMMITTED && TX_WRITEBACK(tx));
+    
+    /* write back */
+    bufferslab_t *wset = tx->writeset;
+    writeset_t *write;
+    stm_word_t i;
+    while (wset!=NULL) {
+#ifndef NO_SSE
+	// prefetch wset->next does not help!
+	//__builtin_prefetch(wset->next);
+#endif
+	for (i=0; i<wset->size; i++) {
+	    write = &(wset->data.writes[i]);
+	    if (likely(write->mask==WMASK_ALL))
+		*write->addr = write->value;
+	    else
+		buf_write_merge(write);
+	}
+	wset = wset->next;
+    }
+}
+
+/* write-back of a partly written word (the lock is ours) */
+static __attribute__((noinline)) void buf_write_merge(writeset_t *write)
+{
+    volatile stm_word_t *addr = write->addr;
+    *addr = WMASK_MERGE(write, *addr);
+}
+
+/**
+ * Write-through abort: the write entries hold the old values of whole
+ * words, they are written back before the locks are released.
+ */
+static inline void buf_undo_writes(stm_tx_t *tx)
+{
+    /* Only write-through keeps the old values */
+    assert(!TX_WRITEBACK(tx));
+    
+    bufferslab_t *wset = tx->writeset;
+    stm_word_t i;
+    while (wset!=NULL) {
+	for (i=0; i<wset->size; i++) {
+	    *wset->data.writes[i].addr = wset->data.writes[i].value;
+	}
+	wset = wset->next;
+    }
+}
+
+static inline __always_inline stm_word_t wbuf_idx_from_addr(stm_tx_t *tx, stm_word_t *addr)
+{
+#if defined(ADAPTIVENESS) && (defined(ADAPTIVEHASH) || defined(ADAPTIVEWHASH2))
+    switch (tx->adaptive_hash) {
+    case 0: return (((stm_word_t)addr >> 8) & WBUF_MASK);
+    case 1: return (((stm_word_t)addr >> 6) & WBUF_MASK);
+    case 2: return (((stm_word_t)addr >> 4) & WBUF_MASK);
+    case 3: return (((stm_word_t)addr >> 2) & WBUF_MASK);
+    case 4: return ((((stm_word_t)addr >> 16)^((stm_word_t)addr>>5)) & WBUF_MASK);
+    case 5: return ((((stm_word_t)addr >> 12)^((stm_word_t)addr>>2)) & WBUF_MASK);
+    default:
+	return WBUF_IDX_FROM_ADDR(tx, addr);
+    }
+#else
+    return WBUF_IDX_FROM_ADDR(tx, addr);
+#endif
+}
+
+static inline __always_inline writeset_t *buf_get_write_addr(stm_tx_t *tx, stm_word_t *addr, stm_word_t allocate, stm_word_t value)
+{
+    writeset_t *hashptr, **hashentry;
+    
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+
+#ifdef ADAPTIVENESS
+    // we don't need a hash table yet, there are only few writes!
+    if (likely(tx->nr_uniq_writes<=TX_PARAM(tx, NRWBEFOREHASH))) {
+	stm_word_t i;
+	writeset_t *writes = tx->writeset->data.writes;
+	// use switch optimization
+	switch ((allocate==WBUF_NEW) ? 0 : tx->nr_uniq_writes) {
+	case 11: if (writes->addr == addr) return writes; writes++;
+	case 10: if (writes->addr == addr) return writes; writes++;
+	case 9: if (writes->addr == addr) return writes; writes++;
+	case 8: if (writes->addr == addr) return writes; writes++;
+	case 7: if (writes->addr == addr) return writes; writes++;
+	case 6: if (writes->addr == addr) return writes; writes++;
+	case 5: if (writes->addr == addr) return writes; writes++;
+	case 4: if (writes->addr == addr) return writes; writes++;
+	case 3: if (writes->addr == addr) return writes; writes++;
+	case 2: if (writes->addr == addr) return writes; writes++;
+	case 1: if (writes->addr == addr) return writes; writes++;
+	case 0: writes = &(tx->writeset->data.writes[tx->nr_uniq_writes]); break;
+	default:
+	    for (i=0; i<tx->nr_uniq_writes; i++) {
+		if (writes->addr == addr) return writes;
+		writes++;
+	    }
+	}
+	if (allocate) {
+#ifdef ADAPTIVE_LOCKING
+	    if (tx->nr_uniq_writes==0) tx->first_write = tx->nrreads;
+#endif
+	    /* make sure, that we have the lock as well */
+	    if (TX_EAGER(tx) && allocate<WBUF_LOCKED) {
+		lock_acquire(tx, addr);
+		asm __volatile__("": : :"memory");
+	    }
+	    writes->addr=addr;
+	    writes->mask=0;
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+	    if (tx->writethrough) {
+		writes->value = *addr;
+	    }
+#elif defined(WRITETHROUGH)
+	    writes->value = *addr;
+#endif
+#ifdef WRITEBLOOM
+	    tx->writebloom|=WBLOOMHASH((stm_word_t)addr);
+#endif
+	    tx->writeset->size = ++tx->nr_uniq_writes;
+	    if (tx->nr_uniq_writes<=TX_PARAM(tx, NRWBEFOREHASH)) {
+		return writes;
+	    } else {
+		// build up hash list and enqueue existing entries
+		sse2_memzero128aligned(tx->writehash, tx->whashsize*sizeof(writeset_t*));
+		writes = tx->writeset->data.writes;
+		// enqueue existing entries
+		for (i=0; i<tx->nr_uniq_writes; i++) {
+		    hashentry = ADDR2WENTRY(tx, tx->writehash, writes[i].addr);
+		    //tx->writebloom|=WBLOOMHASH((stm_word_t)writes[i].addr);
+		    writes[i].next = (*hashentry);
+#if defined(ADAPTIVENESS)
+		    if (*hashentry!=NULL) tx->whashcollisions++;
+#endif
+		    *hashentry = &(writes[i]);
+		}
+		return &(writes[tx->nr_uniq_writes-1]);
+	    }
+	} else {
+	    return NULL;
+	}
+    }
+#endif
+    
+    hashentry = ADDR2WENTRY(tx, tx->writehash, addr);
+
+    /* if we don't have a hit in the bloom filter we know for sure that
+     * this is a new entry and can skip directly to the allocate part
+     * otherwise we must check the hashtable for such an entry
+     * (this is expensive!)
+     */
+#ifdef WRITEBLOOM
+    //if (((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom)) {
+    stm_word_t wbloomhash = WBLOOMHASH((stm_word_t)addr);
+    if ((wbloomhash & tx->writebloom) != wbloomhash || allocate==WBUF_NEW) {
+	hashptr=NULL;
+    } else {
+#else
+    if (allocate==WBUF_NEW) {
+	hashptr=NULL;
+    } else {
+#endif
+	hashptr = *hashentry;
+	
+	/* fast forward to the correct entry */
+	while (hashptr!=NULL && hashptr->addr!=addr) {
+	    hashptr = hashptr->next;
+	}
+    }
+    
+    /* return the address if we found the entry */
+    /* it is either NULL or contains our hashptr with the correct addr */
+    if (hashptr!=NULL) {
+	if (!TX_EAGER(tx)) {
+	    // if not eager locking -> check if addr still valid!
+	    stm_word_t version = lock_safe_get_value(tx, ADDR2LOCKADDR(addr), addr);
+	    if (clock_is_newer(tx, version)) {
+		DPRINTF("write: abort: version>max_version\n");
+		clock_conflict(tx, version);
+		PROF_CONFLICT(tx, ADDR2LOCKADDR(addr) - locks, addr, NULL);
+		TX_ABORT(tx, STM_ABORT_LOCK_VERSION);
+	    }
+	}
+	return hashptr;
+    }
+    
+    /* maybe we need to allocate a new one */
+    if (allocate) {
+	/* make sure, that we have the lock as well */
+	if (TX_EAGER(tx) && allocate<WBUF_LOCKED) {
+	    lock_acquire(tx, addr);
+	    asm __volatile__("": : :"memory");
+	}
+	++tx->nr_uniq_writes;
+	// no more space - need to allocate new slab
+	if (unlikely(tx->writeset->size==NRWRITESINSLAB)) {
+	    bufferslab_t *slab = alloc_slab(tx);
+	    slab->next = tx->writeset;
+	    tx->writeset = slab;
+	}
+
+	writeset_t *newwrite = &(tx->writeset->data.writes[tx->writeset->size++]);
+#if defined(ADAPTIVENESS)
+	if (*hashentry!=NULL) tx->whashcollisions++;
+#endif
+	newwrite->next = (*hashentry);
+	newwrite->addr = addr;
+	newwrite->mask = 0;
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+	if (tx->writethrough) {
+	    newwrite->value = *addr;
+	}
+#elif defined(WRITETHROUGH)
+	newwrite->value = *addr;
+#endif
+#ifdef WRITEBLOOM
+	tx->writebloom|=WBLOOMHASH((stm_word_t)addr);
+#endif
+	*hashentry = newwrite;
+
+	return newwrite;
+    }
+    return NULL;
+}
+
+/**
+ * Reads a memory location transactionally
+ * There are several cases we must consider
+ * * we already have the lock on that memory region
+ *   * we already wrote to that memory address -> return the (cached) value
+ *   * we did not write to that memory address -> return *addr
+ * * we did not write to that memory region
+ *   * check if we already read from that location and check version -> return *addr
+ *     (this might not be needed)
+ *   * add a new read entry and check the version -> return *addr
+ */
+static inline __always_inline stm_word_t buf_check_read(stm_tx_t *tx, stm_word_t *addr)
+{
+    volatile stm_word_t *lock;
+    stm_word_t value, version, idx;
+    writeset_t *partial = NULL;
+    
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+
+    /* get the lock */
+    idx = LOCK_IDX_FROM_ADDR(addr);
+    lock = LOCK_ADDR_FROM_IDX(idx);
+
+    if (TX_EAGER(tx) && LOCK_GET_OWNER_ADDR_FROM_VALUE(*lock)==tx) {
+	// we own the lock! (e.g. we wrote to a different address that is
+	// covered by the same lock or wrote to this addr)
+
+	
+	// did we already write to this address?
+#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
+	writeset_t *write;
+#ifdef WRITEBLOOM
+	if (!tx->writethrough && !((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#else
+	if (!tx->writethrough && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#endif
+	    DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)write->value);
+	    if (likely(write->mask==WMASK_ALL)) return write->value;
+	    // partly written word, the lock is ours so memory holds the rest
+	    return WMASK_MERGE(write, *addr);
+	}
+#elif defined(WRITEBACK)
+	writeset_t *write;
+#ifdef WRITEBLOOM
+	if (!((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#else
+	if ((write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#endif
+	    DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)write->value);
+	    if (likely(write->mask==WMASK_ALL)) return write->value;
+	    // partly written word, the lock is ours so memory holds the rest
+	    return WMASK_MERGE(write, *addr);
+	}
+#endif
+	DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)*addr);
+	// therefore we just return the value!
+	// do we need to check if hashptr is NULL?
+	// no! buf_validate does this (or we validated when we took the
+	// lock in the write case!)	
+	return *addr;
+    }
+    if (!TX_EAGER(tx)) {
+	// lazy locking - we need to check if we already wrote to that place
+	writeset_t *write;
+#ifdef WRITEBLOOM
+	if (!((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#else
+	if ((write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+#endif
+	    if (likely(write->mask==WMASK_ALL)) return write->value;
+	    // partly written word, the rest is read (and validated) as usual
+	    partial = write;
+	}
+    }
+
+#ifndef SAFE_MODE
+ buf_check_read_retry:
+#endif
+    /* get the version of the lock (or tx that holds the lock) */
+    /* other path: we have to check the lock (but need the safe version) */
+    version = buf_read_lock(tx, lock, idx, addr);
+    DPRINTF(" (tx: %p lock %p: %p/%p val:%p)\n", tx, lock, (void*)version, (void*)tx->max_version, (void*)*addr);
+    
+    /* if we are not in the safe mode, then this read could fail! */
+    /* it could be that another thread freed our memory location after
+       we checked the version above */
+    asm __volatile__("": : :"memory");
+    value = *addr;
+    asm __volatile__("": : :"memory");
+    
+#ifndef SAFE_MODE
+    // check if the version is still the same (needed for correctness).
+    // if we use WT then another w-tx might already have written this location!
+    if (unlikely(version != *lock)) {
+#ifdef STATS
+	tx->nb_read_ver_change++;
+#endif
+	// let's not abort but recheck this read (goto is nicer than a loop)
+	goto buf_check_read_retry;
+	//stm_retry(tx);
+    }
+#endif
+
+    buf_log_read(tx, idx, version);
+
+#ifdef SAFE_MODE
+    // we are in SAFE_MODE - return read lock
+    *lock = version;
+#endif
+
+    if (unlikely(partial!=NULL)) value = WMASK_MERGE(partial, value);
+    return value;
+}
+
+/**
+ * Gets the version of the lock we read under. If it is newer than our
+ * snapshot, the read set is extended (or the transaction aborts).
+ * In SAFE_MODE the lock is ours on return, the caller gives it back.
+ */
+static inline __always_inline stm_word_t buf_read_lock(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t idx, stm_word_t *addr)
+{
+    stm_word_t version;
+
+#ifdef SAFE_MODE
+    do {
+#endif
+	/* Get lock */
+	version = lock_safe_get_value(tx, lock, addr);
+#ifdef SAFE_MODE
+	/* try to acquire lock */
+	/* the safe mode acquires the lock during the read section, but we do
+	   not account for this lock in any way! */
+    } while (!LOCK_SET_OWNER_ADDR(lock, version, (stm_word_t)tx));
+#endif
+
+    // the second part of this assertion does not hold
+    // maybe we already wrote to an address that is covered by the same lock (hash collission)
+    //assert(hashptr==NULL || LOCK_GET_OWNER_ADDR_FROM_VALUE(LOCK_GET_VALUE(lock))!=tx);
+
+    /* the lock has an incorrect version
+     * we must check if we can extend the readset (if we didn't yet read
+     * from that location), otherwise we must abort
+     */
+    if (unlikely(clock_is_newer(tx, version))) {
+	stm_word_t current = clock_extend_version(tx, version);
+	/* are all the older reads still valid? */
+#ifdef SAFE_MODE
+	// give up lock if we might retry (this lock is not accounted for)
+	*lock = version;
+#endif
+	/* if we already read from that location OR we cannot validate our buffer,
+	 * then we retry
+	 */
+	// we can recover in ~50% of the cases, seems a fair deal!
+#ifdef STATS
+	tx->nb_read_ver_err++;
+#endif
+	if (current==0 || !buf_validate(tx)) {
+	    /* This is the end of this function since stm_retrynever returns */
+	    DPRINTF("read: abort: version>max_version\n");
+	    PROF_CONFLICT(tx, idx, addr, NULL);
+	    TX_ABORT(tx, STM_ABORT_READ_VALIDATE);
+	}
+#ifdef STATS
+	tx->nb_read_ver_err_rec++;
+#endif
+	TX_STAT_INC(tx, extensions);
+	TRACE(tx, TRACE_EXTEND, 0, tx->nrreads, TRACE_NOBODY);
+#ifdef SAFE_MODE
+	do {
+	    /* Get lock */
+	    version = lock_safe_get_value(tx, lock, addr);
+	    /* try to acquire lock */
+	} while (!LOCK_SET_OWNER_ADDR(lock, version, (stm_word_t)tx));
+
+	// we are in safe mode _and_ hold the lock, but the read set extension failed
+	// therefore we abort
+	if (version>tx->max_version) {
+	    *lock=version;
+	    PROF_CONFLICT(tx, idx, addr, NULL);
+	    TX_ABORT(tx, STM_ABORT_READ_VALIDATE);
+	}
+#endif
+	// yes, we can extend the version!
+	tx->max_version = current;
+    }
+    return version;
+}
+
+/**
+ * Logs a read under the lock idx. Did we already log this lock? (the
+ * list might still contain duplicates if the filter lost an entry, but
+ * they are rare)
+ */
+static inline __always_inline void buf_log_read(stm_tx_t *tx, stm_word_t idx, stm_word_t version)
+{
+    readset_t *hashptr;
+
+    if (buf_read_filter(tx, idx)) {
+#ifdef STATS
+	tx->nb_read_dups++;
+#endif
+    } else {
+	/* allocate a new read entry */
+	if (unlikely(tx->nrreads==tx->maxreads)) {
+	    tx->readsize *= 2;
+	    tx->maxreads=tx->readsize/sizeof(readset_t);
+	    DPRINTF("read larger: %ld (%ld) %p\n", tx->maxreads, tx->readsize, tx);
+	    if ((tx->readset = (readset_t*)realloc(tx->readset, tx->readsize))==0) { printf("no mem\n"); abort(); }
+	}
+	hashptr = &(tx->readset[tx->nrreads++]);
+	hashptr->lock = idx;
+	hashptr->version = version;
+	TRACE(tx, TRACE_LOAD, 0, idx, TRACE_NOBODY);
+
+	/* keep the filter at most half full */
+	if (unlikely(tx->nrreads*2 > tx->readfiltermask && tx->readfiltermask < RFILTER_MAX_SIZE-1)) {
+	    buf_grow_read_filter(tx);
+	}
+    }
+}
+
+/**
+ * Checks if a lock is already in the read set and remembers it otherwise.
+ * Skipping a duplicate is safe: if the lock had been changed since we
+ * logged it, then its version is newer than our snapshot (the read set
+ * extension would have failed) and we never get here.
+ */
+static inline __always_inline stm_word_t buf_read_filter(stm_tx_t *tx, stm_word_t idx)
+{
+    uint64_t tag = RFILTER_TAG(tx, idx);
+    uint64_t *slot = &(tx->readfilter[idx & tx->readfiltermask]);
+    if (*slot == tag) return 1;
+    *slot = tag;
+    return 0;
+}
+
+/* doubles the read filter and enqueues the current read set */
+static void buf_grow_read_filter(stm_tx_t *tx)
+{
+    stm_word_t i, size = (tx->readfiltermask+1)*2;
+    free(tx->readfilter);
+    if (posix_memalign((void**)&tx->readfilter, 64, size*sizeof(uint64_t))!=0) {
+	perror("malloc: no free memory!");
+	exit(1);
+    }
+    memset(tx->readfilter, 0x0, size*sizeof(uint64_t));
+    tx->readfiltermask = size-1;
+    DPRINTF("read filter larger: %ld %p\n", size, tx);
+    for (i=0; i<tx->nrreads; i++) {
+	buf_read_filter(tx, tx->readset[i].lock);
+    }
+}
+
+/**
+ * Reads a memory location in a read-only transaction
+ * Nothing is logged: the version of the lock must not be newer than
+ * our snapshot, otherwise we retry (there is no read set to extend).
+ */
+static inline __always_inline stm_word_t buf_check_read_ro(stm_tx_t *tx, stm_word_t *addr)
+{
+    volatile stm_word_t *lock = ADDR2LOCKADDR(addr);
+    stm_word_t value, version;
+
+    /* Check status */
+    assert(tx->status == TX_ACTIVE && tx->nrlocks == 0);
+
+#ifndef SAFE_MODE
+ buf_check_read_ro_retry:
+#endif
+    version = buf_read_lock_ro(tx, lock, addr);
+
+    asm __volatile__("": : :"memory");
+    value = *addr;
+    asm __volatile__("": : :"memory");
+
+#ifdef SAFE_MODE
+    *lock = version;
+#else
+    if (unlikely(version != *lock)) {
+	goto buf_check_read_ro_retry;
+    }
+#endif
+    return value;
+}
+
+/* the version of the lock, read-only transactions cannot extend their snapshot */
+static inline __always_inline stm_word_t buf_read_lock_ro(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t *addr)
+{
+    stm_word_t version;
+
+#ifdef SAFE_MODE
+    do {
+	version = lock_safe_get_value(tx, lock, addr);
+    } while (!LOCK_SET_OWNER_ADDR(lock, version, (stm_word_t)tx));
+#else
+    version = lock_safe_get_value(tx, lock, addr);
+#endif
+    if (unlikely(clock_is_newer(tx, version))) {
+#ifdef SAFE_MODE
+	*lock = version;
+#endif
+	DPRINTF("read-only: abort: version>max_version\n");
+	clock_conflict(tx, version);
+	PROF_CONFLICT(tx, lock - locks, addr, NULL);
+	TX_ABORT(tx, STM_ABORT_READ_VALIDATE);
+    }
+    return version;
+}
+
+/* end of the stripe of addr (all bytes before it use the same lock), at most end */
+static inline __always_inline char *buf_stripe_end(char *addr, char *end)
+{
+#ifdef LOCK_REGIONS
+    lock_region_t *region = lock_region_of((stm_word_t)addr);
+    stm_word_t next = (((stm_word_t)addr >> region->shift) + 1) << region->shift;
+    stm_word_t bound, i;
+    /* the start or end of a region may cut the stripe */
+    for (i=0; i<lock_nregions; i++) {
+	bound = lock_regions[i].start;
+	if (bound>(stm_word_t)addr && bound<next) next = bound;
+	bound += lock_regions[i].size;
+	if (bound>(stm_word_t)addr && bound<next) next = bound;
+    }
+#else
+    stm_word_t next = (((stm_word_t)addr >> LOCK_SHIFT) + 1) << LOCK_SHIFT;
+#endif
+    return ((stm_word_t)end < next) ? end : (char*)next;
+}
+
+/* mask of len bytes at byte offset off of a word */
+static inline __always_inline stm_word_t buf_byte_mask(stm_word_t off, stm_word_t len)
+{
+    stm_word_t mask = 0;
+    memset((char*)&mask + off, 0xff, len);
+    return mask;
+}
+
+/* copies our buffered writes to [addr, end) over the bytes at to */
+static void buf_overlay_writes(stm_tx_t *tx, char *addr, char *end, char *to)
+{
+    stm_word_t *w = SUBWORD_BASE(addr);
+    stm_word_t value;
+    writeset_t *write;
+    char *lo, *hi;
+
+    if (tx->nr_uniq_writes==0) return;
+    for (; (char*)w<end; w++) {
+#ifdef WRITEBLOOM
+	if (((WBLOOMHASH((stm_word_t)w)|tx->writebloom)^tx->writebloom)) continue;
+#endif
+	if ((write = buf_get_write_addr(tx, w, 0, 0))==NULL) continue;
+	lo = ((char*)w<addr) ? addr : (char*)w;
+	hi = ((char*)(w+1)>end) ? end : (char*)(w+1);
+	if (likely(write->mask==WMASK_ALL)) {
+	    value = write->value;
+	} else {
+	    value = 0;
+	    memcpy((char*)&value + (lo-(char*)w), to + (lo-addr), hi-lo);
+	    value = WMASK_MERGE(write, value);
+	}
+	memcpy(to + (lo-addr), (char*)&value + (lo-(char*)w), hi-lo);
+    }
+}
+
+/**
+ * Reads [addr, addr+size) into to, one stripe at a time: the lock is
+ * checked once and one read entry is logged per stripe (none in
+ * read-only mode), the bytes are copied as a block.
+ */
+static void buf_read_range(stm_tx_t *tx, char *addr, stm_word_t size, char *to)
+{
+    volatile stm_word_t *lock;
+    stm_word_t idx, version, len;
+    char *end = addr + size, *next;
+
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+
+    for (; addr<end; addr = next, to += len) {
+	next = buf_stripe_end(addr, end);
+	len = next - addr;
+	idx = LOCK_IDX_FROM_ADDR(addr);
+	lock = LOCK_ADDR_FROM_IDX(idx);
+
+	if (tx->readonly) {
+#ifndef SAFE_MODE
+	buf_read_range_ro_retry:
+#endif
+	    version = buf_read_lock_ro(tx, lock, (stm_word_t*)addr);
+	    asm __volatile__("": : :"memory");
+	    sse2_memcpy(to, addr, len);
+	    asm __volatile__("": : :"memory");
+#ifdef SAFE_MODE
+	    *lock = version;
+#else
+	    if (unlikely(version != *lock)) goto buf_read_range_ro_retry;
+#endif
+	    continue;
+	}
+
+	if (TX_EAGER(tx) && LOCK_GET_OWNER_ADDR_FROM_VALUE(*lock)==tx) {
+	    // we own the stripe, memory holds the committed (write-through: our) values
+	    sse2_memcpy(to, addr, len);
+	} else {
+#ifndef SAFE_MODE
+	buf_read_range_retry:
+#endif
+	    version = buf_read_lock(tx, lock, idx, (stm_word_t*)addr);
+	    asm __volatile__("": : :"memory");
+	    sse2_memcpy(to, addr, len);
+	    asm __volatile__("": : :"memory");
+#ifndef SAFE_MODE
+	    if (unlikely(version != *lock)) {
+#ifdef STATS
+		tx->nb_read_ver_change++;
+#endif
+		goto buf_read_range_retry;
+	    }
+#endif
+	    buf_log_read(tx, idx, version);
+#ifdef SAFE_MODE
+	    *lock = version;
+#endif
+	    // eager locking: we have no writes in a stripe that is not ours
+	    if (TX_EAGER(tx)) continue;
+	}
+	if (TX_WRITEBACK(tx)) buf_overlay_writes(tx, addr, next, to);
+    }
+}
+
+/**
+ * Writes size bytes from from to [addr, addr+size), one stripe at a
+ * time: with eager locking the lock is taken once per stripe.
+ * Write-through keeps the old bytes of a stripe it locked first as one
+ * block (other stripes get write entries for the undo) and copies the
+ * bytes into memory at the end (from==NULL: the caller writes them in
+ * place). Write-back puts the bytes into write entries, partly written
+ * words are merged with memory at commit (byte mask).
+ */
+static void buf_write_range(stm_tx_t *tx, char *addr, stm_word_t size, const char *from)
+{
+    stm_word_t *w, locks, allocate;
+    writeset_t *write;
+    range_undo_t *undo = NULL;
+    char *start = addr, *end = addr + size, *next, *lo, *hi, *saved = NULL;
+
+    /* Check status */
+    assert(tx->status == TX_ACTIVE);
+
+    for (; addr<end; addr = next) {
+	next = buf_stripe_end(addr, end);
+	allocate = WBUF_LOCKED;
+	if (TX_EAGER(tx)) {
+	    locks = tx->nrlocks;
+	    lock_acquire(tx, (stm_word_t*)addr);
+	    asm __volatile__("": : :"memory");
+	    /* a lock that was not ours yet covers none of our writes */
+	    if (tx->nrlocks!=locks) allocate = WBUF_NEW;
+	}
+	w = (stm_word_t*)((stm_word_t)addr & ~(stm_word_t)(sizeof(stm_word_t)-1));
+
+	if (!TX_WRITEBACK(tx)) {
+	    if (allocate==WBUF_NEW) {
+		/* consecutive new stripes share one undo block */
+		if (undo==NULL || undo->addr+undo->size!=addr) {
+		    if (saved==NULL) saved = (char*)range_alloc(tx, size);
+		    undo = (range_undo_t*)range_alloc(tx, sizeof(range_undo_t));
+		    undo->addr = addr;
+		    undo->size = 0;
+		    undo->data = saved + (addr-start);
+		    undo->next = tx->range_undo;
+		    tx->range_undo = undo;
+		}
+		sse2_memcpy(undo->data + undo->size, addr, next-addr);
+		undo->size += next-addr;
+	    } else {
+		/* the entries keep the old values for the undo */
+		for (; (char*)w<next; w++) buf_get_write_addr(tx, w, WBUF_LOCKED, 0);
+	    }
+	    continue;
+	}
+
+	for (; (char*)w<next; w++) {
+	    lo = ((char*)w<addr) ? addr : (char*)w;
+	    hi = ((char*)(w+1)>next) ? next : (char*)(w+1);
+	    write = buf_get_write_addr(tx, w, allocate, 0);
+	    if (hi-lo==sizeof(stm_word_t)) {
+		memcpy(&write->value, from + (lo-start), sizeof(stm_word_t));
+		write->mask = WMASK_ALL;
+	    } else {
+		memcpy((char*)&write->value + (lo-(char*)w), from + (lo-start), hi-lo);
+		write->mask |= buf_byte_mask(lo-(char*)w, hi-lo);
+	    }
+	}
+    }
+    /* all stripes are ours */
+    if (!TX_WRITEBACK(tx) && from!=NULL) sse2_memcpy(start, from, size);
+}
+
+/**
+ * Resets the read write buffer
+ * - all blocks are reset and stored in a
+ *   recycle list.
+ *
+ * * @param tx is a pointer to the transaction descriptor
+ */
+static inline void buf_reset(stm_tx_t *tx)
+{
+    bufferslab_t *slabs, *last;
+
+    slabs = tx->writeset->next;
+    tx->writeset->size=0;
+    tx->writeset->next=NULL;
+    if (slabs!=NULL) {
+	last = slabs;
+	while (last->next!=NULL) {
+	    last = last->next;
+	}
+	free_slabs(tx, slabs, last);
+    }
+
+}
+
+
+/*******************************************************************\
+ * Locking functions
+\*******************************************************************/
+
+static inline __always_inline stm_word_t lock_safe_get_value(stm_tx_t *tx, volatile stm_word_t *lock, stm_word_t *addr)
+{
+	stm_word_t lockValue;
+
+	/* Ensure that the lock is free */
+	lockValue = *lock;
+
+	/* common case: lock is free or we have the lock */
+	/* if this is not the case, then we try to handle the conflict */
+	if (LOCK_IS_FREE(lockValue) || (LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue)==tx)) {
+	    return lockValue;
+	} else {
+	    LOCK_HOT_COUNT(lock);
+	    TX_STAT_INC(tx, lock_waits);
+	    TRACE(tx, TRACE_WAIT, 0, lock - locks, LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue)->trace_id);
+#ifdef ABORT_PROFILE
+	    PROF_CONFLICT(tx, lock - locks, addr, LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue)->prof_site);
+#endif
+#ifdef LOCKS_CLASSIFY
+	    lock_count_conflict(LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue), addr);
+#endif
+	    while (!LOCK_IS_FREE(lockValue) && LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) {
+		cont_handle_conflict(tx, LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue), lock);
+		lockValue = *lock;
+	    }
+	    /* If there was a conflict the the status was set to TX_WAITING */
+	    tx->status = TX_ACTIVE;
+	    PROF_CLEAR(tx);
+	    TRACE(tx, TRACE_WAIT_END, 0, lock - locks, TRACE_NOBODY);
+	}
+	return lockValue;
+}
+
+static inline __always_inline void lock_acquire(stm_tx_t *tx, stm_word_t *addr)
+{
+    stm_word_t lockValue;
+#ifdef STATS
+    tx->nb_locks++;
+#endif
+    volatile stm_word_t *lockaddr = ADDR2LOCKADDR(addr);
+
+    // do we already own the lock?
+    DPRINTF("lockaddr: %p (value: %p, tx %p)\n", lockaddr, (void*)*lockaddr, tx);
+    if (LOCK_GET_OWNER_ADDR_FROM_VALUE(*lockaddr)==tx) { return; }
+#ifdef LOCKS_HOT
+    if (unlikely(--tx->lock_samples==0)) {
+	tx->lock_samples = LOCK_HOT_SAMPLE;
+	lock_hot_count(lockaddr - locks);
+    }
+#endif
+    // no, then let's get it!
+    do {
+	/* Get lock */
+	lockValue = lock_safe_get_value(tx, lockaddr, addr);
+	/* try to acquire lock */
+    } while (!LOCK_SET_OWNER_ADDR(lockaddr, lockValue, (stm_word_t)tx));
+
+    // check that the version of the lock is smaller that our max version
+    if (unlikely(clock_is_newer(tx, lockValue))) {
+	//stm_word_t current = GLOBAL_VERSION;
+	/* are all the older reads still valid? */
+	/* if we already read from that location OR we cannot validate our buffer,
+	 * then we retry
+	 */
+	// we can recover in ~<<50% of the cases, seems a fair deal!
+#ifdef STATS
+	//tx->nb_lock_ver_err++;
+#endif
+	// never works!
+	//if (!buf_validate_lockspecial(tx, lockValue, (stm_word_t*)lockaddr)) {
+	//DPRINTF("lock is too large %d > %d (tx %p)\n", lockValue, tx->max_version, tx);
+	    *lockaddr=lockValue;
+	    clock_conflict(tx, lockValue);
+	    /* This is the end of this function since stm_retry never returns */
+	    PROF_CONFLICT(tx, lockaddr - locks, addr, NULL);
+	    TX_ABORT(tx, STM_ABORT_LOCK_VERSION);
+	    //}
+#ifdef STATS
+	    //tx->nb_lock_ver_err_rec++;
+#endif
+	// yes, we can extend the version!
+	//tx->max_version = current;
+	
+	//*lockaddr=lockValue;
+	//stm_retry(tx);
+    }
+    assert(!clock_is_newer(tx, lockValue));
+
+    // no more space, allocate new slab
+    if (unlikely(tx->nrlocks==tx->maxlocks)) {
+	lockset_t *new;
+	tx->locksize *= 2;
+	tx->maxlocks = tx->locksize/sizeof(lockset_t);
+	DPRINTF("lock larger: %ld (%ld) %p\n", tx->maxlocks, tx->locksize, tx);
+	if (posix_memalign((void**)&new, 64, tx->locksize)!=0) { abort(); }
+	// TODO: optimize the memcpy!
+	memcpy(new, tx->lockset, tx->locksize/2);
+	free(tx->lockset);
+	tx->lockset=new;
+    }
+    
+    /* the lock has been acquired */
+    // enqueue the lockaddr in our locklist
+    assert(lockaddr!=NULL);
+    tx->lockset[tx->nrlocks].lock = (stm_word_t*)lockaddr;
+    tx->lockset[tx->nrlocks++].version = LOCK_GET_VERSION_FROM_VALUE(lockValue);
+    TRACE(tx, TRACE_LOCK, 0, lockaddr - locks, TRACE_NOBODY);
+    //add_lock_to_lockset(tx, lockaddr, lockValue
+}
+
+#ifdef LOCKS_NUMA_INTERLEAVE
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_F_MEMS_ALLOWED
+#define MPOL_F_MEMS_ALLOWED (1<<2)
+#endif
+#define NUMA_MAX_NODES 1024
+/* interleaves the pages of the table over all nodes we may allocate on */
+static void lock_interleave_table(void *table, size_t size)
+{
+    unsigned long nodes[NUMA_MAX_NODES/(8*sizeof(unsigned long))];
+    memset(nodes, 0x0, sizeof(nodes));
+    /* no libnuma needed, the syscalls are enough */
+    if (syscall(SYS_get_mempolicy, NULL, nodes, NUMA_MAX_NODES, NULL, MPOL_F_MEMS_ALLOWED)!=0 ||
+	syscall(SYS_mbind, table, size, MPOL_INTERLEAVE, nodes, NUMA_MAX_NODES, 0)!=0) {
+	DPRINTF("locks: no numa interleaving\n");
+    }
+}
+#endif
+
+#ifdef LOCKS_MMAP
+/* maps size bytes aligned to align (the unused head and tail are unmapped) */
+static void *lock_map_aligned(size_t size, size_t align)
+{
+    char *mem, *aligned;
+    mem = mmap(NULL, size+align, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem==MAP_FAILED) return MAP_FAILED;
+    aligned = (char*)(((stm_word_t)mem + align-1) & ~(align-1));
+    if (aligned>mem) munmap(mem, aligned-mem);
+    if (aligned+size < mem+size+align) munmap(aligned+size, (mem+size+align)-(aligned+size));
+    return aligned;
+}
+#endif
+
+/**
+ * Allocates the global lock table
+ * With LOCKS_HUGEPAGES we try 1 GB and 2 MB hugetlb pages and then
+ * transparent huge pages, with LOCKS_NUMA_INTERLEAVE the pages are
+ * spread over all nodes (before they are touched by lock_reset).
+ */
+static volatile stm_word_t *lock_alloc_table(size_t size)
+{
+    void *table;
+#ifdef LOCKS_MMAP
+    table = MAP_FAILED;
+#ifdef LOCKS_HUGEPAGES
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_1GB)
+    if (size%HUGEPAGE_1GB_SIZE==0)
+	table = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_HUGE_1GB, -1, 0);
+#endif
+#ifdef MAP_HUGETLB
+    if (table==MAP_FAILED && size%HUGEPAGE_SIZE==0)
+	table = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+    if (table==MAP_FAILED) {
+	/* no reserved huge pages, ask for transparent ones */
+	table = lock_map_aligned(size, HUGEPAGE_SIZE);
+#ifdef MADV_HUGEPAGE
+	if (table!=MAP_FAILED) madvise(table, size, MADV_HUGEPAGE);
+#endif
+    }
+#else
+    table = lock_map_aligned(size, 64);
+#endif
+    if (table==MAP_FAILED) {
+	printf("Could not allocate locks\n");
+	exit(1);
+    }
+#ifdef LOCKS_NUMA_INTERLEAVE
+    lock_interleave_table(table, size);
+#endif
+#else
+#ifdef VALGRIND
+    // valgrind cannot memalgin >1meg
+    if (posix_memalign((void**)&table, LOCK_HASH_ARRAY_SIZE/4, size)) {
+#else
+    /* aligned to the table size (without the side table of hot locks) */
+    if (posix_memalign((void**)&table, 1UL << (8*sizeof(long) - 1 - __builtin_clzl(size)), size)) {
+#endif
+	printf("Could not allocate locks\n");
+	exit(1);
+    }
+#endif
+    return (volatile stm_word_t*)table;
+}
+
+static void lock_free_table(volatile stm_word_t *table, size_t size)
+{
+#ifdef LOCKS_MMAP
+    /* hugetlb mappings and lock_map_aligned start at the table */
+    munmap((void*)table, size);
+#else
+    free((stm_word_t*)table);
+#endif
+}
+
+static void lock_reset(volatile stm_word_t *table, size_t size)
+{
+	volatile stm_word_t *curLock = table;
+
+#ifndef NO_SSE
+	stm_word_t i;
+
+	stm_word_t n_div_128 = size / 128;
+
+	assert(size % 128==0);
+	
+	// load the first 4 words into the xmm register
+#ifdef __LP64__
+	__m128i d = (__m128i)_mm_set_epi64((__m64)LOCK_FREE, (__m64)LOCK_FREE);
+#else    
+	__m128i d = (__m128i)_mm_set_epi32(LOCK_FREE, LOCK_FREE, LOCK_FREE, LOCK_FREE);
+#endif
+	
+	char *p = (char*)curLock;
+	for(i = 0; i < n_div_128; i++) {
+		_mm_store_si128((__m128i *)&p[0], d);
+		_mm_store_si128((__m128i *)&p[16], d);
+		_mm_store_si128((__m128i *)&p[32], d);
+		_mm_store_si128((__m128i *)&p[48], d);
+		_mm_store_si128((__m128i *)&p[64], d);
+		_mm_store_si128((__m128i *)&p[80], d);
+		_mm_store_si128((__m128i *)&p[96], d);
+		_mm_store_si128((__m128i *)&p[112], d);
+		p += 128;
+	}
+	_mm_sfence();
+#else
+	volatile stm_word_t *endPointer = table + size/sizeof(stm_word_t);
+	while (curLock < endPointer) { *curLock++ = LOCK_FREE; }
+#endif
+	
+}
+
+#ifdef LOCK_REGIONS
+/* returns the region of addr (the default region if none matches) */
+static inline __always_inline lock_region_t *lock_region_of(stm_word_t addr)
+{
+    stm_word_t i;
+    for (i=0; i<lock_nregions; i++) {
+	if ((uintptr_t)(addr - lock_regions[i].start) < (uintptr_t)lock_regions[i].size)
+	    return &lock_regions[i];
+    }
+    return LOCK_DEFAULT_REGION;
+}
+
+static inline __always_inline stm_word_t lock_idx_from_addr(stm_word_t addr)
+{
+    lock_region_t *region = lock_region_of(addr);
+    if (region->flags & STM_REGION_HASH_MULT)
+	return LOCK_HASH_MULTIPLY(addr >> region->shift);
+    return (addr >> region->shift) & LOCK_MASK;
+}
+
+/**
+ * Registers [addr, addr+size) with its own lock granularity of 2^shift
+ * bytes. Regions must not overlap. Must not be called inside a
+ * transaction, running transactions are drained first.
+ */
+int stm_register_region(void *addr, size_t size, unsigned int shift, int flags)
+{
+    lock_region_t *region;
+    
+    if (shift<LOCK_MIN_SHIFT) shift = LOCK_MIN_SHIFT;
+    if (shift>LOCK_MAX_SHIFT) shift = LOCK_MAX_SHIFT;
+    lock_quiesce_begin(1);
+    if (lock_nregions==LOCK_REGIONS_MAX) {
+	lock_quiesce_end();
+	return -1;
+    }
+    region = &lock_regions[lock_nregions];
+    memset(region, 0x0, sizeof(lock_region_t));
+    region->start = (stm_word_t)addr;
+    region->size = size;
+    region->shift = shift;
+    region->flags = flags;
+    lock_nregions++;
+    lock_quiesce_end();
+    return 0;
+}
+
+/* Removes the region that starts at addr, its memory uses the default mapping again */
+void stm_unregister_region(void *addr)
+{
+    stm_word_t i;
+    
+    lock_quiesce_begin(1);
+    for (i=0; i<lock_nregions; i++) {
+	if (lock_regions[i].start==(stm_word_t)addr) {
+	    lock_nregions--;
+	    memmove(&lock_regions[i], &lock_regions[i+1], (lock_nregions-i)*sizeof(lock_region_t));
+	    break;
+	}
+    }
+    lock_quiesce_end();
+}
+#else
+/* without LOCK_REGIONS all memory uses the default mapping */
+int stm_register_region(void *addr, size_t size, unsigned int shift, int flags)
+{
+    return -1;
+}
+
+void stm_unregister_region(void *addr)
+{
+}
+#endif
+
+#ifdef LOCKS_HOT
+/* returns the index of the padded side table lock if idx is hot */
+static inline __always_inline stm_word_t lock_idx_hot(stm_word_t idx)
+{
+    stm_word_t slot = idx & (LOCK_HOT_SLOTS-1);
+    if (unlikely(lock_hot_map[slot]==idx))
+	return LOCK_HASH_ARRAY_SIZE + slot*LOCKS_PER_LINE;
+    return idx;
+}
+
+/**
+ * Counts a sampled acquisition or a conflict of a lock. The candidate
+ * of a slot is replaced once its count dropped to zero, so only locks
+ * that dominate their slot reach the threshold.
+ */
+static inline void lock_hot_count(stm_word_t idx)
+{
+    lock_hot_candidate_t *cand;
+    
+    if (idx>=LOCK_HASH_ARRAY_SIZE) return; /* already hot */
+    cand = &lock_hot_candidates[idx & (LOCK_HOT_SLOTS-1)];
+    if (cand->idx==idx) {
+	cand->count++;
+    } else if (cand->count==0) {
+	cand->idx = idx;
+	cand->count = 1;
+    } else {
+	cand->count--;
+    }
+}
+
+static void lock_hot_reset()
+{
+    stm_word_t i;
+    for (i=0; i<LOCK_HOT_SLOTS; i++) {
+	lock_hot_map[i] = -1;
+	lock_hot_candidates[i].idx = -1;
+	lock_hot_candidates[i].count = 0;
+    }
+}
+
+/* moves the candidates above the threshold into free slots of the side table */
+static void lock_hot_promote()
+{
+    stm_word_t i, found = 0;
+    
+    for (i=0; i<LOCK_HOT_SLOTS; i++) {
+	if (lock_hot_candidates[i].count>=LOCK_HOT_THRESHOLD && lock_hot_map[i]==-1) found = 1;
+    }
+    if (!found || !lock_quiesce_begin(0)) return;
+    for (i=0; i<LOCK_HOT_SLOTS; i++) {
+	lock_hot_candidate_t *cand = &lock_hot_candidates[i];
+	if (cand->count>=LOCK_HOT_THRESHOLD && lock_hot_map[i]==-1 && cand->idx>=0) {
+	    /* nobody runs, the lock is free: keep its version */
+	    locks[LOCK_HASH_ARRAY_SIZE + i*LOCKS_PER_LINE] = locks[cand->idx];
+	    lock_hot_map[i] = cand->idx;
+	    lock_hot_promotions++;
+	}
+	cand->count = 0;
+    }
+    lock_quiesce_end();
+}
+#endif
 
-    /* get the lock */
-    lock = ADDR2LOCKADDR(addr);
+#ifdef LOCKS_CLASSIFY
+/**
+ * Classifies a conflict on the lock of addr with the transaction owner.
+ * The write set of the owner is read without synchronization (slabs are
+ * never returned to the system while the descriptor lives), so the
+ * result is only a hint.
+ */
+static stm_word_t lock_classify_conflict(stm_tx_t *owner, stm_word_t *addr)
+{
+    stm_word_t result = CONFLICT_UNKNOWN;
+    stm_word_t idx = LOCK_IDX_FROM_ADDR(addr);
+    stm_word_t stripe = (stm_word_t)addr >> LOCK_SHIFT_OF(addr);
+    int seen = 0;
+    bufferslab_t *slab = owner->writeset;
+    
+    while (slab!=NULL && seen<LOCK_CLASSIFY_MAX_WRITES) {
+	stm_word_t i, size = slab->size;
+	if (size>NRWRITESINSLAB) size = NRWRITESINSLAB;
+	for (i=0; i<size; i++) {
+	    stm_word_t *other = slab->data.writes[i].addr;
+	    if (other==addr) return CONFLICT_TRUE;
+	    if (LOCK_IDX_FROM_ADDR(other)==idx) {
+		if (((stm_word_t)other >> LOCK_SHIFT_OF(addr))==stripe)
+		    result = CONFLICT_STRIPE;
+		else if (result==CONFLICT_UNKNOWN)
+		    result = CONFLICT_ALIAS;
+	    }
+	}
+	seen += size;
+	slab = slab->next;
+    }
+    return result;
+}
 
-#if defined(EAGER_LOCKING)
-    if (LOCK_GET_OWNER_ADDR_FROM_VALUE(*lock)==tx) {
-	// we own the lock! (e.g. we wrote to a different address that is
-	// covered by the same lock or wrote to this addr)
+/* counts a conflict for the lock table and the region of addr */
+static void lock_count_conflict(stm_tx_t *owner, stm_word_t *addr)
+{
+    stm_word_t kind = lock_classify_conflict(owner, addr);
+#ifdef LOCKS_RESIZE
+    FETCH_ADD(&lock_table_conflicts.nr[kind], 1);
+    FETCH_ADD(&lock_table_conflicts.total, 1);
+#endif
+#ifdef LOCKS_ADAPTIVE
+    lock_region_t *region = lock_region_of((stm_word_t)addr);
+    if (region->flags & STM_REGION_ADAPTIVE) {
+	FETCH_ADD(&region->conflicts.nr[kind], 1);
+	FETCH_ADD(&region->conflicts.total, 1);
+    }
+#endif
+}
 
-	
-	// did we already write to this address?
-#if defined(ADAPTIVENESS) && defined(WRITEBACK) && defined(WRITETHROUGH)
-	writeset_t *write;
-#ifdef WRITEBLOOM
-	if (!tx->writethrough && !((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
-#else
-	if (!tx->writethrough && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+/**
+ * Starts a new decision window if at least min conflicts were counted.
+ * Only one thread wins, it gets the counts of the window in nr.
+ */
+static int lock_conflicts_window(lock_conflicts_t *conflicts, stm_word_t min, stm_word_t *nr)
+{
+    stm_word_t i, total = conflicts->total;
+    
+    if (total<min || !CAS(&conflicts->total, total, 0)) return 0;
+    for (i=0; i<4; i++) {
+	nr[i] = conflicts->nr[i];
+	conflicts->nr[i] = 0;
+    }
+    return 1;
+}
 #endif
-	    DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)write->value);
-	    return write->value;
+
+#ifdef ADAPTIVE_LOCKING
+/* how long would the locks be held: accesses after the first write */
+static inline void lock_account_held(stm_tx_t *tx)
+{
+    if (tx->nr_uniq_writes==0) return;
+    tx->adaptaccesses += tx->nrreads + tx->nr_uniq_writes;
+    tx->adaptheld += tx->nrreads + tx->nr_uniq_writes - tx->first_write;
+}
+
+/**
+ * Called from the adaptation (outside of a transaction, no locks held):
+ * with many aborts, writers that write early lock at commit time and
+ * writers that write late lock on the first write.
+ */
+static void lock_adapt_mode(stm_tx_t *tx)
+{
+    stm_word_t lazy = tx->lazy;
+    
+    if (tx->writethrough) {
+	lazy = 0;
+    } else if ((tx->adaptretries*100) / (tx->adaptcommits+1) > TX_PARAM(tx, LOCKING_ABORT_PERCENT) && tx->adaptaccesses) {
+	if (tx->adaptheld*100 > tx->adaptaccesses*TX_PARAM(tx, LOCKING_LAZY_HELD)) lazy = 1;
+	else if (tx->adaptheld*100 < tx->adaptaccesses*TX_PARAM(tx, LOCKING_EAGER_HELD)) lazy = 0;
+    }
+    if (lazy!=tx->lazy) TX_STAT_INC(tx, lock_mode_switches);
+    tx->lazy = lazy;
+    tx->adaptaccesses = 0;
+    tx->adaptheld = 0;
+}
+#endif
+
+#ifdef LOCKS_QUIESCE
+/**
+ * Called from the adaptation (outside of a transaction):
+ * regions with many conflicts on other words of the same stripe use a
+ * finer granularity, regions with many aliases use the multiplicative
+ * hash. If aliases remain, the lock table grows. Hot locks move into
+ * their own cache lines.
+ */
+static void lock_adapt_check(stm_tx_t *tx)
+{
+#ifdef LOCKS_CLASSIFY
+    stm_word_t nr[4], total;
+#endif
+#ifdef LOCKS_HOT
+    lock_hot_promote();
+#endif
+#ifdef LOCKS_ADAPTIVE
+    stm_word_t i;
+    
+    for (i=0; i<=LOCK_REGIONS_MAX; i++) {
+	lock_region_t *region = &lock_regions[i];
+	if (i<LOCK_REGIONS_MAX && i>=lock_nregions) continue;
+	if (!(region->flags & STM_REGION_ADAPTIVE)) continue;
+	if (!lock_conflicts_window(&region->conflicts, LOCK_ADAPT_MIN_CONFLICTS, nr)) continue;
+	total = nr[0] + nr[1] + nr[2] + nr[3];
+	if (nr[CONFLICT_STRIPE]*100 > total*LOCK_ADAPT_FALSE_PERCENT && region->shift>LOCK_MIN_SHIFT) {
+	    /* split the stripes */
+	    if (!lock_quiesce_begin(0)) return;
+	    if (region->flags & STM_REGION_ADAPTIVE) region->shift--;
+	    lock_adaptations++;
+	    lock_quiesce_end();
+	} else if (nr[CONFLICT_ALIAS]*100 > total*LOCK_ADAPT_FALSE_PERCENT && !(region->flags & STM_REGION_HASH_MULT)) {
+	    /* strided accesses alias with shift & mask */
+	    if (!lock_quiesce_begin(0)) return;
+	    if (region->flags & STM_REGION_ADAPTIVE) region->flags |= STM_REGION_HASH_MULT;
+	    lock_adaptations++;
+	    lock_quiesce_end();
 	}
-#elif defined(WRITEBACK)
-	writeset_t *write;
-#ifdef WRITEBLOOM
-	if (!((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
-#else
-	if ((write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+    }
 #endif
-	    DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)write->value);
-	    return write->value;
+#ifdef LOCKS_RESIZE
+    if (lock_conflicts_window(&lock_table_conflicts, LOCK_RESIZE_MIN_CONFLICTS, nr)) {
+	total = nr[0] + nr[1] + nr[2] + nr[3];
+	if (nr[CONFLICT_ALIAS]*100 > total*LOCK_RESIZE_ALIAS_PERCENT && lock_bits<LOCK_MAX_BITS)
+	    lock_resize(lock_bits+1);
+    }
+#endif
+}
+
+/* without membarrier every stm_start needs a full fence */
+static void lock_quiesce_init()
+{
+    lock_quiesce_pending = 0;
+    lock_quiesce_fence = (syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)!=0);
+#ifdef GLOBAL_STATS
+    if (lock_quiesce_fence) printf("membarrier not available, stm_start uses a fence\n");
+#endif
+}
+
+/**
+ * Drains all transactions, new ones wait in stm_start until
+ * lock_quiesce_end. Must be called outside of a transaction. Returns 0
+ * if another thread is already quiescing and wait is not set.
+ */
+static int lock_quiesce_begin(int wait)
+{
+    stm_tx_t *cur;
+    
+    while (!CAS(&lock_quiesce_pending, 0, 1)) {
+	if (!wait) return 0;
+	sched_yield();
+    }
+    /* either a starting tx sees pending or we see its in_flight flag */
+    if (lock_quiesce_fence)
+	__sync_synchronize();
+    else
+	syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    
+    for (cur = all_tx; cur!=NULL; cur = cur->next_tx) {
+	while (cur->in_flight) sched_yield();
+    }
+    return 1;
+}
+
+static void lock_quiesce_end()
+{
+    __sync_synchronize();
+    lock_quiesce_pending = 0;
+}
+
+/* Waits in stm_start until the lock mapping is stable again, then retakes the snapshot */
+static void lock_quiesce_wait(stm_tx_t *tx)
+{
+    while (lock_quiesce_pending) {
+	tx->in_flight = 0;
+	while (lock_quiesce_pending) sched_yield();
+	tx->in_flight = 1;
+	LOCK_QUIESCE_FENCE();
+    }
+    tx->max_version = clock_start_version(tx);
+#ifdef GLOBAL_STATS
+    tx->start    = tx->max_version;
+#endif
+}
+#endif
+
+#ifdef LOCKS_RESIZE
+/**
+ * Replaces the lock table with a table of 2^bits entries.
+ * No transaction runs while the table is swapped, so all locks are
+ * free and the new table starts with every lock free.
+ */
+static void lock_resize(stm_word_t bits)
+{
+    volatile stm_word_t *oldlocks = locks, *newlocks;
+    size_t oldsize = LOCK_TABLE_SIZE(LOCK_HASH_ARRAY_SIZE);
+    size_t newsize = LOCK_TABLE_SIZE(1UL << bits);
+    
+    newlocks = lock_alloc_table(newsize);
+    lock_reset(newlocks, newsize);
+    if (!lock_quiesce_begin(0)) {
+	lock_free_table(newlocks, newsize);
+	return;
+    }
+    locks = newlocks;
+    lock_bits = bits;
+    lock_mask = (1UL << bits) - 1;
+#ifdef LOCKS_HOT
+    lock_hot_reset();
+#endif
+    lock_resizes++;
+    lock_quiesce_end();
+    
+    lock_free_table(oldlocks, oldsize);
+}
+#endif
+
+
+/*******************************************************************\
+ * Global clock
+\*******************************************************************/
+
+/* checks /proc/cpuinfo for an invariant tsc that can be read with rdtscp */
+static int clock_tsc_available()
+{
+    char line[8192];
+    int found = 0;
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo==NULL) return 0;
+    while (fgets(line, sizeof(line), cpuinfo)!=NULL) {
+	if (strncmp(line, "flags", 5)==0) {
+	    found = strstr(line, " constant_tsc")!=NULL && strstr(line, " nonstop_tsc")!=NULL &&
+		strstr(line, " rdtscp")!=NULL;
+	    break;
+	}
+    }
+    fclose(cpuinfo);
+    return found;
+}
+
+#ifdef CLOCK_TSC
+/* one sender and one receiver pinned to two different cores */
+typedef struct tsc_calib {
+    volatile stm_word_t tsc;
+    volatile stm_word_t turn;
+    stm_word_t min_delta;				/* min(receiver tsc - sender tsc) */
+} tsc_calib_t;
+
+typedef struct tsc_calib_thread {
+    tsc_calib_t *calib;
+    int sender;
+} tsc_calib_thread_t;
+
+static void *clock_tsc_calibrate_thread(void *arg)
+{
+    tsc_calib_thread_t *me = (tsc_calib_thread_t*)arg;
+    tsc_calib_t *calib = me->calib;
+    stm_word_t i, delta;
+
+    for (i=0; i<TSC_CALIBRATION_ROUNDS; i++) {
+	if (me->sender) {
+	    while (calib->turn != 2*i) asm __volatile__("pause": : :"memory");
+	    calib->tsc = TSC_READ();
+	    calib->turn = 2*i+1;
+	} else {
+	    while (calib->turn != 2*i+1) asm __volatile__("pause": : :"memory");
+	    delta = TSC_READ() - calib->tsc;
+	    if (i==0 || delta<calib->min_delta) calib->min_delta = delta;
+	    calib->turn = 2*i+2;
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Measures the one-way delay from the sender to the receiver core.
+ * The smallest delay is the transfer time of the cache line plus the
+ * offset between the two clocks, the larger value of both directions
+ * is an upper bound of the offset.
+ * Returns -1 if the threads could not be pinned.
+ */
+static stm_word_t clock_tsc_measure(int from, int to)
+{
+    tsc_calib_t calib __attribute__((aligned(64)));
+    tsc_calib_thread_t args[2] = { { &calib, 1 }, { &calib, 0 } };
+    int cpus[2] = { from, to };
+    pthread_t threads[2];
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int i, ok = 1;
+
+    calib.tsc = 0;
+    calib.turn = 0;
+    calib.min_delta = 0;
+    for (i=0; i<2; i++) {
+	pthread_attr_init(&attr);
+	CPU_ZERO(&set);
+	CPU_SET(cpus[i], &set);
+	if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set)!=0 ||
+	    pthread_create(&threads[i], &attr, clock_tsc_calibrate_thread, &args[i])!=0) {
+	    ok = 0;
+	    /* let an already started sender finish */
+	    if (i==1) { args[1].sender = 0; clock_tsc_calibrate_thread(&args[1]); }
+	    pthread_attr_destroy(&attr);
+	    break;
 	}
+	pthread_attr_destroy(&attr);
+    }
+    if (i>0) pthread_join(threads[0], NULL);
+    if (i>1) pthread_join(threads[1], NULL);
+    return ok ? calib.min_delta : -1;
+}
+
+/* upper bound of the tsc offset between all cores we may run on */
+static int clock_tsc_calibrate()
+{
+    cpu_set_t set;
+    int cpu, base = -1;
+    stm_word_t skew = 0, delta;
+
+    if (sched_getaffinity(0, sizeof(set), &set)!=0) return 0;
+    for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+	if (!CPU_ISSET(cpu, &set)) continue;
+	if (base==-1) { base = cpu; continue; }
+	if ((delta = clock_tsc_measure(base, cpu))<0) return 0;
+	if (delta>skew) skew = delta;
+	if ((delta = clock_tsc_measure(cpu, base))<0) return 0;
+	if (delta>skew) skew = delta;
+    }
+    clock_tsc_skew = skew;
+    DPRINTF("tsc clock: skew %ld cycles\n", skew);
+    return 1;
+}
+
+/* spins until the local tsc passed version (at most clock_tsc_skew cycles) */
+static inline stm_word_t clock_tsc_wait(stm_word_t version)
+{
+    stm_word_t now;
+    while ((now = TSC_VERSION(TSC_READ())) < version) {
+	asm __volatile__("pause": : :"memory");
+    }
+    return now;
+}
 #endif
-	DPRINTF(" (in wset, tx: %p lock %p: %p val:%p)\n", tx, lock, (void*)tx->max_version, (void*)*addr);
-	// therefore we just return the value!
-	// do we need to check if hashptr is NULL?
-	// no! buf_validate does this (or we validated when we took the
-	// lock in the write case!)	
-	return *addr;
+
+/* selects the clock at runtime (only the tsc clock has a fallback) */
+static void clock_init()
+{
+#ifdef CLOCK_TSC
+    clock_tsc = clock_tsc_available() && clock_tsc_calibrate();
+    DPRINTF("tsc clock: %s\n", clock_tsc ? "enabled" : "fallback to global clock");
+#endif
+}
+
+#if defined(CLOCK_GV5) || defined(CLOCK_GV6)
+/* moves the global clock forward to at least version */
+static inline stm_word_t clock_advance(stm_word_t version)
+{
+    stm_word_t gv;
+    while ((gv = GLOBAL_VERSION) < version) {
+	if (CAS(&GLOBAL_VERSION, gv, version)) return version;
+    }
+    return gv;
+}
+#endif
+
+#if defined(CLOCK_GV4) || defined(CLOCK_GV6)
+/* TL2 GV4: a single CAS, if it fails another tx incremented the clock
+ * concurrently and we share its commit version (pass on failure) */
+static inline __always_inline stm_word_t clock_gv4_commit_version(stm_tx_t *tx, stm_word_t *validate)
+{
+    stm_word_t gv = GLOBAL_VERSION;
+    if (likely(CAS(&GLOBAL_VERSION, gv, gv+2))) {
+	*validate = (tx->max_version != gv);
+	return gv+2;
     }
+#ifdef STATS
+    tx->nb_clock_cas_fail++;
+#endif
+    /* somebody else holds the same commit version, so we must validate */
+    *validate = 1;
+    return GLOBAL_VERSION;
+}
+#endif
+
+/* returns the snapshot version for a new transaction */
+static inline __always_inline stm_word_t clock_start_version(stm_tx_t *tx)
+{
+#ifdef CLOCK_TSC
+    if (likely(clock_tsc)) return TSC_VERSION(TSC_READ());
+#endif
+#ifdef CLOCK_TLC
+    return 0;
 #else
-    // lazy locking - we need to check if we already read from that place
-    writeset_t *write;
-#ifdef WRITEBLOOM
-    if (!((WBLOOMHASH((stm_word_t)addr)|tx->writebloom)^tx->writebloom) && (write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+    return GLOBAL_VERSION;
+#endif
+}
+
+/* is the version in a lock newer than the snapshot of this transaction? */
+static inline __always_inline stm_word_t clock_is_newer(stm_tx_t *tx, stm_word_t version)
+{
+#ifdef CLOCK_TLC
+    return TLC_CLOCK_FROM_VERSION(version) > tx->tlc_seen[TLC_TID_FROM_VERSION(version)];
+#else
+    return version > tx->max_version;
+#endif
+}
+
+/**
+ * Returns the new max_version if the snapshot of the transaction can be
+ * extended to include version (the read set must be validated afterwards)
+ * or 0 if the transaction must retry.
+ */
+static inline stm_word_t clock_extend_version(stm_tx_t *tx, stm_word_t version)
+{
+#ifdef CLOCK_TSC
+    /* commits are in the future of the committing core, wait for them */
+    if (likely(clock_tsc)) return clock_tsc_wait(version);
+#endif
+#if defined(CLOCK_TLC)
+    /* there is no global order, remember the clock and retry */
+    clock_conflict(tx, version);
+    return 0;
+#elif defined(CLOCK_GV5) || defined(CLOCK_GV6)
+    /* the version might be newer than the clock */
+    return clock_advance(version);
 #else
-    if ((write=buf_get_write_addr(tx, addr, 0, 0))!=NULL) {
+    return GLOBAL_VERSION;
+#endif
+}
+
+/* called before a retry because of a version that is newer than our snapshot */
+static inline void clock_conflict(stm_tx_t *tx, stm_word_t version)
+{
+#ifdef CLOCK_TSC
+    if (likely(clock_tsc)) { clock_tsc_wait(version); return; }
 #endif
-	return write->value;
+#if defined(CLOCK_TLC)
+    stm_word_t tid = TLC_TID_FROM_VERSION(version);
+    if (tx->tlc_seen[tid] < TLC_CLOCK_FROM_VERSION(version))
+	tx->tlc_seen[tid] = TLC_CLOCK_FROM_VERSION(version);
+#elif defined(CLOCK_GV5) || defined(CLOCK_GV6)
+    /* otherwise the retry would start with the same (too old) snapshot */
+    clock_advance(version);
+#endif
+}
+
+#ifdef CLOCK_TLC
+/* takes a slot of the clock vector (called with unused_tx_mutex held) */
+static void tlc_acquire_id(stm_tx_t *tx)
+{
+    if (tlc_nr_free>0) {
+	tx->tlc_id = tlc_free_ids[--tlc_nr_free];
+    } else if (tlc_next_id<TLC_MAX_THREADS) {
+	tx->tlc_id = tlc_next_id++;
+    } else {
+	printf("Too many transaction descriptors for CLOCK_TLC (max %d)\n", TLC_MAX_THREADS);
+	exit(1);
     }
+    /* the versions of a slot must not go back in time, so the clock of
+     * the previous owner is continued */
+    tx->tlc_clock = tlc_clocks[tx->tlc_id];
+    tx->tlc_seen[tx->tlc_id] = tx->tlc_clock;
+}
+
+/* returns the slot of a deleted descriptor (called with unused_tx_mutex held) */
+static void tlc_release_id(stm_tx_t *tx)
+{
+    tlc_clocks[tx->tlc_id] = tx->tlc_clock;
+    tlc_free_ids[tlc_nr_free++] = tx->tlc_id;
+}
 #endif
 
- buf_check_read_retry:
-    /* get the version of the lock (or tx that holds the lock) */
-    /* other path: we have to check the lock (but need the safe version) */
-#ifdef SAFE_MODE
-    do {
+/**
+ * Returns the version that is written into the locks on commit.
+ * validate is set to 0 if nobody could have committed since the
+ * snapshot was taken (max_version + 2 == commit_version).
+ */
+static inline __always_inline stm_word_t clock_commit_version(stm_tx_t *tx, stm_word_t *validate)
+{
+    stm_word_t commit_version;
+#ifdef CLOCK_TSC
+    /* a core that reads its clock after our commit must see a larger value */
+    if (likely(clock_tsc)) {
+	*validate = 1;
+	return TSC_VERSION(TSC_READ() + clock_tsc_skew + 1);
+    }
 #endif
-	/* Get lock */
-	version = lock_safe_get_value(tx, lock);
-#ifdef SAFE_MODE
-	/* try to acquire lock */
-	/* the safe mode acquires the lock during the read section, but we do
-	   not account for this lock in any way! */
-    } while (!LOCK_SET_OWNER_ADDR(lock, version, (stm_word_t)tx));
+#if defined(CLOCK_TLC)
+    /* the local clock does not tell us anything about other transactions */
+    *validate = 1;
+    commit_version = TLC_VERSION(tx->tlc_id, ++tx->tlc_clock);
+    tx->tlc_seen[tx->tlc_id] = tx->tlc_clock;
+#elif defined(CLOCK_GV4)
+    commit_version = clock_gv4_commit_version(tx, validate);
+#elif defined(CLOCK_GV5) || defined(CLOCK_GV6)
+#ifdef CLOCK_GV6
+    if (unlikely((++tx->gv6_commits & (CLOCK_GV6_PERIOD-1)) == 0))
+	return clock_gv4_commit_version(tx, validate);
 #endif
-    DPRINTF(" (tx: %p lock %p: %p/%p val:%p)\n", tx, lock, (void*)version, (void*)tx->max_version, (void*)*addr);
+    /* the clock is not incremented, other transactions might use the same
+     * commit version and the shortcut does not hold */
+    *validate = 1;
+    commit_version = GLOBAL_VERSION+2;
+#else
+    commit_version = GLOBAL_VERSION_INC+2;
+    *validate = (tx->max_version+2 != commit_version);
+#endif
+    return commit_version;
+}
 
-    // the second part of this assertion does not hold
-    // maybe we already wrote to an address that is covered by the same lock (hash collission)
-    //assert(hashptr==NULL || LOCK_GET_OWNER_ADDR_FROM_VALUE(LOCK_GET_VALUE(lock))!=tx);
 
-    /* the lock has an incorrect version
-     * we must check if we can extend the readset (if we didn't yet read
-     * from that location), otherwise we must abort
-     */
-    if (unlikely(version > tx->max_version)) {
-	stm_word_t current = GLOBAL_VERSION;
-	/* are all the older reads still valid? */
-#ifdef SAFE_MODE
-	// give up lock if we might retry (this lock is not accounted for)
-	*lock = version;
+/*******************************************************************\
+ * Conflict handling
+\*******************************************************************/
+
+/* the contention managers, indexed by STM_CM_* */
+static const struct {
+    const char *name;
+    void (*conflict)(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock);
+} cm_policies[STM_CM_POLICIES] = {
+    { "yield", cm_yield },
+    { "backoff", cm_exp_backoff },
+    { "karma", cm_karma },
+    { "polka", cm_polka },
+    { "greedy", cm_greedy },
+    { "aggressive", cm_aggressive }
+};
+
+/* picks the cm clock (pthread_once), measures the TSC frequency for deadlines given in ns */
+static void cm_clock_init()
+{
+    struct timespec start, now;
+    unsigned long ns, tsc;
+    
+    if (clock_tsc_available()) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tsc = TSC_READ();
+	do {
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    ns = (now.tv_sec-start.tv_sec)*1000000000UL + now.tv_nsec - start.tv_nsec;
+	} while (ns < CM_TSC_CALIBRATE_NS);
+	tsc = TSC_READ() - tsc;
+	cm_tsc_khz = tsc*1000000UL/ns;
+	if (cm_tsc_khz==0) cm_tsc_khz = 1;
+	cm_clock_tsc = 1;
+    } else {
+	/* ns of CLOCK_MONOTONIC */
+	cm_tsc_khz = 1000000;
+	cm_clock_tsc = 0;
+    }
+    cm_deadline_urgent = CM_DEADLINE_URGENT_NS*cm_tsc_khz/1000000;
+    asm __volatile__("": : :"memory");
+    cm_clock_ready = 1;
+}
+
+/* the time of deadlines and greedy timestamps (see cm_tsc_khz) */
+static inline __always_inline uint64_t cm_now()
+{
+    struct timespec now;
+    
+    if (unlikely(!cm_clock_ready)) pthread_once(&cm_clock_once, cm_clock_init);
+    if (likely(cm_clock_tsc)) return TSC_READ();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+/* reads the default policy from ADAPTSTM_CM */
+static void cm_init()
+{
+    char *name = getenv("ADAPTSTM_CM");
+    int i;
+#ifdef CM_BLOCKING
+    struct timespec start, end;
+    unsigned long ns;
+    
+    /* how many pause instructions take CM_SPIN_NS? */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<10000; i++) asm __volatile__("pause": : :"memory");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec-start.tv_sec)*1000000000UL + end.tv_nsec - start.tv_nsec;
+    cm_spin_pauses = (CM_SPIN_NS*10000UL) / (ns ? ns : 1);
+    cm_block_membarrier = (syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)==0);
 #endif
-	/* if we already read from that location OR we cannot validate our buffer,
-	 * then we retry
-	 */
-	// we can recover in ~50% of the cases, seems a fair deal!
+    
+    cm_default_policy = STM_CM_YIELD;
+    if (name==NULL) return;
+    for (i=0; i<STM_CM_POLICIES; i++) {
+	if (strcmp(name, cm_policies[i].name)==0) cm_default_policy = i;
+    }
+}
+
+void stm_set_cm(stm_tx_t *tx, int policy)
+{
+    if (policy<0 || policy>=STM_CM_POLICIES) policy = STM_CM_YIELD;
+    tx->cm_policy = policy;
+}
+
+int stm_get_cm(stm_tx_t *tx)
+{
+    return tx->cm_policy;
+}
+
+/* another transaction asked us to abort */
+static void cm_remote_aborted(stm_tx_t *tx)
+{
+    DPRINTF("remote abort (tx: %p)\n", tx);
 #ifdef STATS
-	tx->nb_read_ver_err++;
+    tx->nb_cm_killed++;
 #endif
-	if (!buf_validate(tx)) {
-	    /* This is the end of this function since stm_retrynever returns */
-	    DPRINTF("read: abort: version>max_version\n");
-	    stm_retry(tx);
-	}
+    PROF_CONFLICT(tx, tx->prof_kill_lock, 0, tx->prof_kill_site);
+    TX_ABORT(tx, STM_ABORT_KILLED);
+}
+
+/* asks the owner of a lock to abort, it will notice at its next load, store or commit */
+static inline void cm_kill(stm_tx_t *tx, stm_tx_t *other)
+{
+    stm_word_t serial = other->cm_serial;
+    if (other->cm_abort!=serial) {
+#ifdef ABORT_PROFILE
+	other->prof_kill_lock = tx->prof_lock;
+	other->prof_kill_site = tx->prof_site;
+#endif
+#ifdef TX_TRACE
+	other->trace_killer = tx->trace_id;
+	TRACE(tx, TRACE_KILL, 0, 0, other->trace_id);
+#endif
+	other->cm_abort = serial;
 #ifdef STATS
-	tx->nb_read_ver_err_rec++;
+	tx->nb_cm_kills++;
 #endif
-#ifdef SAFE_MODE
-	do {
-	    /* Get lock */
-	    version = lock_safe_get_value(tx, lock);
-	    /* try to acquire lock */
-	} while (!LOCK_SET_OWNER_ADDR(lock, version, (stm_word_t)tx));
-
-	// we are in safe mode _and_ hold the lock, but the read set extension failed
-	// therefore we abort
-	if (version>tx->max_version) {
-	    *lock=version;
-	    stm_retry(tx);
-	}
+#ifdef CM_BLOCKING
+	/* it may sleep while it waits for somebody else */
+	stm_tx_t *owner = other->waiting_for;
+	if (other->status==TX_WAITING && owner!=NULL) cm_wake(owner);
 #endif
-	// yes, we can extend the version!
-	tx->max_version = current;
     }
+}
+
+/* spins for a random time below CM_BACKOFF_MIN*2^round */
+static inline void cm_backoff(stm_tx_t *tx, unsigned int round)
+{
+    unsigned long i, spins;
     
-    /* if we are not in the safe mode, then this read could fail! */
-    /* it could be that another thread freed our memory location after
-       we checked the version above */
-    asm __volatile__("": : :"memory");
-    value = *addr;
-    asm __volatile__("": : :"memory");
+    if (round>TX_PARAM(tx, BACKOFF_MAX_ROUNDS)) round = TX_PARAM(tx, BACKOFF_MAX_ROUNDS);
+    /* xorshift */
+    tx->cm_seed ^= tx->cm_seed << 13; tx->cm_seed ^= tx->cm_seed >> 7; tx->cm_seed ^= tx->cm_seed << 17;
+    spins = tx->cm_seed % ((unsigned long)CM_BACKOFF_MIN << round);
+    for (i=0; i<spins; i++) asm __volatile__("pause": : :"memory");
+}
+
+#ifdef CM_BLOCKING
+/**
+ * Spins until the owner released the lock, then sleeps on the futex of
+ * the owner (until it releases its locks or the timeout expires).
+ */
+static void cm_block(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    struct timespec timeout = { 0, CM_BLOCK_TIMEOUT_NS };
+    unsigned long i;
+    int seq;
     
-#ifndef SAFE_MODE
-    // check if the version is still the same (needed for correctness).
-    // if we use WT then another w-tx might already have written this location!
-    if (unlikely(version != *lock)) {
-#ifdef STATS
-	tx->nb_read_ver_change++;
-#endif
-	// let's not abort but recheck this read (goto is nicer than a loop)
-	goto buf_check_read_retry;
-	//stm_retry(tx);
+    for (i=0; i<cm_spin_pauses; i++) {
+	if (*lock!=(stm_word_t)other) return;
+	asm __volatile__("pause": : :"memory");
     }
+    seq = other->cm_futex;
+    FETCH_ADD(&other->cm_waiters, 1);
+    /* the owner either sees us waiting or we see the released lock */
+    if (cm_block_membarrier) syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    if (*lock==(stm_word_t)other && !CM_ABORT_REQUESTED(tx)) {
+#ifdef STATS
+	tx->nb_cm_blocks++;
 #endif
-
-    /* allocate a new read entry (list might contain duplicates, but enqueuing is faster than checking */
-    if (unlikely(tx->nrreads==tx->maxreads)) {
-	tx->readsize *= 2;
-	tx->maxreads=tx->readsize/sizeof(readset_t);
-	DPRINTF("read larger: %ld (%ld) %p\n", tx->maxreads, tx->readsize, tx);
-	//if (posix_memalign((void**)&new, 64, tx->readsize)!=0) { abort(); }
-	// TODO: optimize the memcpy!
-	//memcpy(new, tx->readset, tx->readsize/2);
-	if ((tx->readset = (readset_t*)realloc(tx->readset, tx->readsize))==0) { printf("no mem\n"); abort(); }
-	
-	//free(tx->readset);
-	//tx->readset=new;
+	syscall(SYS_futex, &other->cm_futex, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
     }
-    hashptr = &(tx->readset[tx->nrreads++]);
-    hashptr->lock = (stm_word_t*)lock;
-
-    hashptr->version = version;
+    FETCH_ADD(&other->cm_waiters, -1);
+}
 
-#ifdef SAFE_MODE
-    // we are in SAFE_MODE - return read lock
-    *lock = version;
+/* wakes all transactions that sleep on tx */
+static void cm_wake(stm_tx_t *tx)
+{
+    tx->cm_futex++;
+    syscall(SYS_futex, &tx->cm_futex, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
 #endif
 
-    return value;
+void stm_set_priority(stm_tx_t *tx, int level)
+{
+    if (level<0) level = 0;
+    if (level>=STM_PRIO_LEVELS) level = STM_PRIO_LEVELS-1;
+    tx->priority = level;
+}
+
+int stm_get_priority(stm_tx_t *tx)
+{
+    return tx->priority;
 }
 
 /**
- * Resets the read write buffer
- * - all blocks are reset and stored in a
- *   recycle list.
- *
- * * @param tx is a pointer to the transaction descriptor
+ * A cycle of waiting transactions: the transaction of the lowest class
+ * in the cycle aborts (tx itself if there is no lower one).
  */
-static inline void buf_reset(stm_tx_t *tx)
+static void cm_deadlock(stm_tx_t *tx)
 {
-    bufferslab_t *slabs, *last;
-
-    slabs = tx->writeset->next;
-    tx->writeset->size=0;
-    tx->writeset->next=NULL;
-    if (slabs!=NULL) {
-	last = slabs;
-	while (last->next!=NULL) {
-	    last = last->next;
-	}
-	free_slabs(tx, slabs, last);
+    stm_tx_t *next = tx, *victim = tx;
+    int i = 0;
+    
+    while ((next = next->waiting_for)!=NULL && next!=tx && i++<64) {
+	if (next->priority < victim->priority) victim = next;
     }
-
+    if (victim==tx) TX_ABORT(tx, STM_ABORT_DEADLOCK);
+    cm_kill(tx, victim);
 }
 
+/**
+ * Conflict with an owner of another class, returns 0 if the policy
+ * should decide. A higher class never gives up for a lower one, a lower
+ * class backs off (longer for a bigger difference) and then retries.
+ */
+static int cm_priority_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    if (tx->priority > other->priority) {
+	cm_kill(tx, other);
+	tx->yielded++;
+	CM_WAIT(tx, other, lock);
+	return 1;
+    }
+    if (tx->priority < other->priority) {
+	if (tx->yielded >= CM_PRIO_LOW_WAITS) TX_ABORT(tx, STM_ABORT_CONFLICT);
+	cm_backoff(tx, tx->yielded++ + CM_PRIO_BACKOFF*(other->priority - tx->priority));
+	return 1;
+    }
+    return 0;
+}
 
-/*******************************************************************\
- * Locking functions
-\*******************************************************************/
-
-static inline __always_inline stm_word_t lock_safe_get_value(stm_tx_t *tx, volatile stm_word_t *lock)
+/**
+ * Decides with the remaining budget: past the deadline we stop
+ * (stm_start_deadline times out or escalates), close to it the owner
+ * is asked to abort unless it has to finish earlier.
+ */
+static int cm_deadline_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
 {
-	stm_word_t lockValue;
+    uint64_t now = cm_now();
+    
+    if (now >= tx->deadline) TX_ABORT(tx, STM_ABORT_DEADLINE);
+    if (tx->deadline - now > cm_deadline_urgent) return 0;
+    if (other->deadline && other->deadline <= tx->deadline) return 0;
+    cm_kill(tx, other);
+    tx->yielded++;
+    CM_WAIT(tx, other, lock);
+    return 1;
+}
 
-	/* Ensure that the lock is free */
-	lockValue = *lock;
+#ifdef GLOBAL_STATS
+static inline void prio_latency_add(prio_latency_t *lat, unsigned long cycles)
+{
+    lat->commits++;
+    lat->cycles += cycles;
+    if (cycles > lat->max) lat->max = cycles;
+    lat->buckets[cycles ? 63 - __builtin_clzl(cycles) : 0]++;
+}
 
-	/* common case: lock is free or we have the lock */
-	/* if this is not the case, then we try to handle the conflict */
-	if (LOCK_IS_FREE(lockValue) || (LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue)==tx)) {
-	    return lockValue;
-	} else {
-	    while (!LOCK_IS_FREE(lockValue) && LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue) != tx) {
-		cont_handle_conflict(tx, LOCK_GET_OWNER_ADDR_FROM_VALUE(lockValue));
-		lockValue = *lock;
-	    }
-	    /* If there was a conflict the the status was set to TX_WAITING */
-	    tx->status = TX_ACTIVE;
-	}
-	return lockValue;
+static void prio_latency_merge(prio_latency_t *to, prio_latency_t *from)
+{
+    int i;
+    to->commits += from->commits;
+    to->cycles += from->cycles;
+    if (from->max > to->max) to->max = from->max;
+    for (i=0; i<PRIO_LAT_BUCKETS; i++) to->buckets[i] += from->buckets[i];
 }
 
-static inline __always_inline void lock_acquire(stm_tx_t *tx, stm_word_t *addr)
+/* prints avg, p50, p99 (upper bound of the log2 bucket) and max per class */
+static void prio_latency_print()
 {
-    stm_word_t lockValue;
-#ifdef STATS
-    tx->nb_locks++;
+    static const char *names[STM_PRIO_LEVELS] = { "low", "normal", "high" };
+    int i, b;
+    
+    for (i=0; i<STM_PRIO_LEVELS; i++) {
+	prio_latency_t *lat = &prio_latency[i];
+	unsigned long seen = 0, p50 = 0, p99 = 0;
+	if (lat->commits==0) continue;
+	for (b=0; b<PRIO_LAT_BUCKETS; b++) {
+	    seen += lat->buckets[b];
+	    if (p50==0 && seen*2 >= lat->commits) p50 = 2UL << b;
+	    if (p99==0 && seen*100 >= lat->commits*99) p99 = 2UL << b;
+	}
+	printf("Commit latency %s: %ld commits, avg %ld p50 <%ld p99 <%ld max %ld cycles\n", names[i],
+	       lat->commits, lat->cycles/lat->commits, p50, p99, lat->max);
+    }
+}
 #endif
-    volatile stm_word_t *lockaddr = ADDR2LOCKADDR(addr);
 
-    // do we already own the lock?
-    DPRINTF("lockaddr: %p (value: %p, tx %p)\n", lockaddr, (void*)*lockaddr, tx);
-    if (LOCK_GET_OWNER_ADDR_FROM_VALUE(*lockaddr)==tx) { return; }
-    // no, then let's get it!
-    do {
-	/* Get lock */
-	lockValue = lock_safe_get_value(tx, lockaddr);
-	/* try to acquire lock */
-    } while (!LOCK_SET_OWNER_ADDR(lockaddr, lockValue, (stm_word_t)tx));
+/* karma: work done in this and all aborted attempts of the transaction */
+static inline unsigned long cm_priority(stm_tx_t *tx)
+{
+    return tx->cm_karma + tx->nrreads + tx->nr_uniq_writes;
+}
 
-    // check that the version of the lock is smaller that our max version
-    if (unlikely(lockValue>tx->max_version)) {
-	//stm_word_t current = GLOBAL_VERSION;
-	/* are all the older reads still valid? */
-	/* if we already read from that location OR we cannot validate our buffer,
-	 * then we retry
-	 */
-	// we can recover in ~<<50% of the cases, seems a fair deal!
-#ifdef STATS
-	//tx->nb_lock_ver_err++;
-#endif
-	// never works!
-	//if (!buf_validate_lockspecial(tx, lockValue, (stm_word_t*)lockaddr)) {
-	//DPRINTF("lock is too large %d > %d (tx %p)\n", lockValue, tx->max_version, tx);
-	    *lockaddr=lockValue;
-	    /* This is the end of this function since stm_retry never returns */
-	    stm_retry(tx);
-	    //}
-#ifdef STATS
-	    //tx->nb_lock_ver_err_rec++;
+/* yield, give up after max_yields (MAX_NUM_YIELD_PER_LOCK, times the retries) yields */
+static void cm_yield(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+#ifdef EXPDROPOFF
+    if (tx->yielded > TX_PARAM(tx, MAX_YIELDS)*(tx->adaptretries)) {
+#else
+    if (tx->yielded > TX_PARAM(tx, MAX_YIELDS)) {
 #endif
-	// yes, we can extend the version!
-	//tx->max_version = current;
-	
-	//*lockaddr=lockValue;
-	//stm_retry(tx);
-    }
-    assert(lockValue<=tx->max_version);
-
-    // no more space, allocate new slab
-    if (unlikely(tx->nrlocks==tx->maxlocks)) {
-	lockset_t *new;
-	tx->locksize *= 2;
-	tx->maxlocks = tx->locksize/sizeof(lockset_t);
-	DPRINTF("lock larger: %ld (%ld) %p\n", tx->maxlocks, tx->locksize, tx);
-	if (posix_memalign((void**)&new, 64, tx->locksize)!=0) { abort(); }
-	// TODO: optimize the memcpy!
-	memcpy(new, tx->lockset, tx->locksize/2);
-	free(tx->lockset);
-	tx->lockset=new;
+	DPRINTF("yielded %i times - giving up (tx: %p)...\n", tx->yielded, tx);
+	TX_ABORT(tx, STM_ABORT_CONFLICT);
     }
+    tx->yielded++;
     
-    /* the lock has been acquired */
-    // enqueue the lockaddr in our locklist
-    assert(lockaddr!=NULL);
-    tx->lockset[tx->nrlocks].lock = (stm_word_t*)lockaddr;
-    tx->lockset[tx->nrlocks++].version = LOCK_GET_VERSION_FROM_VALUE(lockValue);
-    //add_lock_to_lockset(tx, lockaddr, lockValue
+    /* Give the other transactions time to finish their work */
+    CM_WAIT(tx, other, lock);
 }
 
-static void lock_reset()
+/* randomized exponential backoff, give up after backoff_max_rounds */
+static void cm_exp_backoff(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
 {
-	volatile stm_word_t *curLock = locks;
-
-#ifndef NO_SSE
-	int i;
+    if (tx->yielded > TX_PARAM(tx, BACKOFF_MAX_ROUNDS)) TX_ABORT(tx, STM_ABORT_CONFLICT);
+    cm_backoff(tx, tx->yielded++);
+}
 
-	int n_div_128 = (LOCK_HASH_ARRAY_SIZE*sizeof(stm_word_t)) / 128;
+/* wait until our karma plus the rounds we waited exceeds the karma of the owner */
+static void cm_karma(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    if (cm_priority(tx) + tx->yielded*CM_KARMA_WAIT > cm_priority(other)) {
+	cm_kill(tx, other);
+    } else {
+	tx->yielded++;
+    }
+    CM_WAIT(tx, other, lock);
+}
 
-	assert((LOCK_HASH_ARRAY_SIZE*sizeof(stm_word_t)) % 128==0);
-	
-	// load the first 4 words into the xmm register
-#ifdef __LP64__
-	__m128i d = (__m128i)_mm_set_epi64((__m64)LOCK_FREE, (__m64)LOCK_FREE);
-#else    
-	__m128i d = (__m128i)_mm_set_epi32(LOCK_FREE, LOCK_FREE, LOCK_FREE, LOCK_FREE);
-#endif
-	
-	char *p = (char*)curLock;
-	for(i = 0; i < n_div_128; i++) {
-		_mm_store_si128((__m128i *)&p[0], d);
-		_mm_store_si128((__m128i *)&p[16], d);
-		_mm_store_si128((__m128i *)&p[32], d);
-		_mm_store_si128((__m128i *)&p[48], d);
-		_mm_store_si128((__m128i *)&p[64], d);
-		_mm_store_si128((__m128i *)&p[80], d);
-		_mm_store_si128((__m128i *)&p[96], d);
-		_mm_store_si128((__m128i *)&p[112], d);
-		p += 128;
-	}
-	_mm_sfence();
-#else
-	volatile stm_word_t *endPointer = locks + LOCK_HASH_ARRAY_SIZE;
-	while (curLock < endPointer) { *curLock++ = LOCK_FREE; }
-#endif
-	
+/* karma, but the rounds are randomized exponential backoffs */
+static void cm_polka(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    if (cm_priority(tx) + tx->yielded*CM_KARMA_WAIT > cm_priority(other)) {
+	cm_kill(tx, other);
+	CM_WAIT(tx, other, lock);
+    } else {
+	cm_backoff(tx, tx->yielded++);
+    }
 }
 
+/* the older transaction wins, a younger one only waits for a running owner */
+static void cm_greedy(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    uint64_t mine = tx->cm_timestamp, theirs = other->cm_timestamp;
+    
+    /* owners that do not use greedy have no timestamp and count as younger */
+    if (theirs==0 || (mine!=0 && mine<theirs) || (mine==theirs && tx<other) ||
+	other->status==TX_WAITING) {
+	cm_kill(tx, other);
+    }
+    tx->yielded++;
+    CM_WAIT(tx, other, lock);
+}
 
-/*******************************************************************\
- * Conflict handling
-\*******************************************************************/
+/* always abort the owner and wait until it released the lock */
+static void cm_aggressive(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
+{
+    cm_kill(tx, other);
+    tx->yielded++;
+    CM_WAIT(tx, other, lock);
+}
 
-static inline __always_inline void cont_handle_conflict(stm_tx_t *tx, stm_tx_t *other)
+/**
+ * Called whenever a lock is owned by another transaction. Dead locks
+ * are resolved here, everything else is up to the policy of tx. We may
+ * wait here for a while, so we also check if somebody aborted us.
+ */
+static inline __always_inline void cont_handle_conflict(stm_tx_t *tx, stm_tx_t *other, volatile stm_word_t *lock)
 {
     stm_tx_t *next;
     
@@ -1321,27 +4710,20 @@ static inline __always_inline void cont_handle_conflict(stm_tx_t *tx, stm_tx_t *
 	while ((next = next->waiting_for)) {
 	    if (next == tx) {
 		DPRINTF("dead lock detected: %p - %p", tx, other);
-		stm_retry(tx);
+		cm_deadlock(tx);
+		break;
 	    }
 	    if (next->status != TX_WAITING) {
 		break;
 	    }
 	}
     }
+    CM_CHECK_ABORT(tx);
 
-#ifdef EXPDROPOFF
-    if (tx->yielded > MAX_NUM_YIELD_PER_LOCK*(tx->adaptretries)) {
-#else
-    if (tx->yielded > MAX_NUM_YIELD_PER_LOCK) {
-#endif
-	DPRINTF("yielded %i times - giving up (tx: %p)...\n", tx->yielded, tx);
-	// TODO: better contention management
-	stm_retry(tx);
-    }
-    tx->yielded++;
-    
-    /* Give the other transactions time to finish their work */
-    sched_yield();
+    /* different classes: the policy does not matter */
+    if (unlikely(tx->priority != other->priority) && cm_priority_conflict(tx, other, lock)) return;
+    if (unlikely(tx->deadline!=0) && cm_deadline_conflict(tx, other, lock)) return;
+    cm_policies[tx->cm_policy].conflict(tx, other, lock);
 }
 
 
@@ -1433,6 +4815,9 @@ void *stm_malloc(stm_tx_t *tx, size_t size)
     /* Insert the mem_block into the transaction descriptor */
     new_block->next = tx->allocated;
     tx->allocated = new_block;
+#ifdef ACCESS_RECORD
+    if (tx->rec_buf!=NULL) rec_malloc(tx, new_addr, size);
+#endif
     
     /* Return the allocated memory */
     return new_block->addr;
@@ -1455,6 +4840,8 @@ void stm_free(stm_tx_t *tx, void *addr)
     DPRINTF("\t\tstm free: %p (%p)\n", tx, addr);
     
     /* We need to lock memory in order to prevent others from accessing it. */
+    if (unlikely(tx->readonly)) stm_ro_restart(tx);
+    REC(tx, REC_FREE, addr);
 
     /* we only know, that we have at least 4 bytes, so we lock this to prevent
        other threads from overwriting or accessing these values!
@@ -1464,21 +4851,19 @@ void stm_free(stm_tx_t *tx, void *addr)
     int size = SIZE_OF_ALLOCATED_MEMORY(addr)-4;
     //printf("free %p %d\n", addr, size);
     int i;
-#ifdef EAGER_LOCKING
     void *lockaddr=NULL;
-#endif
     for (i=0; i<size/sizeof(stm_word_t); i++) {
 	// just grab the locks and increase the version if we commit
 	// a normal store would be the (slow) alternative
-#ifdef EAGER_LOCKING
-	void *tmp = (void*)ADDR2LOCKADDR((((stm_word_t*)addr)+i));
-	if (tmp!=lockaddr) {
-	    lock_acquire(tx, ((stm_word_t*)addr)+i);
-	    lockaddr=tmp;
+	if (TX_EAGER(tx)) {
+	    void *tmp = (void*)ADDR2LOCKADDR((((stm_word_t*)addr)+i));
+	    if (tmp!=lockaddr) {
+		lock_acquire(tx, ((stm_word_t*)addr)+i);
+		lockaddr=tmp;
+	    }
+	} else {
+	    buf_get_write_addr(tx, addr, 1, 0);
 	}
-#else
-	buf_get_write_addr(tx, addr, 1, 0);
-#endif
     }
     
     /* Prepare a mem_block to keep a reference to the freed memory */
@@ -0,0 +1,211 @@
+/**
+ * Live view of processes built with LIVE_STATS
+ * Maps the statistics segments (/dev/shm/adaptstm.<pid>) read-only and
+ * shows the throughput, abort rate and adaptation state (write-through
+ * or write-back, eager or lazy locking, write hash size and function,
+ * read and write set size) of every descriptor in use.
+ *
+ * usage: stmtop [-d seconds] [-n refreshes] [pid | segment name]...
+ *   without arguments all segments in /dev/shm are shown
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "adaptstm-live.h"
+
+#define MAX_SEGMENTS 64
+
+typedef struct counters {
+    uint64_t commits, aborts, lock_waits;
+} counters_t;
+
+typedef struct segment {
+    char name[64];
+    const live_segment_t *seg;				/* NULL: slot is free */
+    counters_t prev[LIVE_SLOTS];
+    int seen;						/* found in this round */
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+
+static const char *prio_names[] = { "low", "normal", "high" };
+
+/* maps a segment read-only, 0 if it is not (yet) a valid segment */
+static int attach(const char *name)
+{
+    segment_t *s = NULL;
+    const live_segment_t *seg;
+    int fd, i;
+
+    for (i=0; i<MAX_SEGMENTS; i++) {
+	if (segments[i].seg!=NULL && strcmp(segments[i].name, name)==0) {
+	    segments[i].seen = 1;
+	    return 1;
+	}
+	if (segments[i].seg==NULL && s==NULL) s = &segments[i];
+    }
+    if (s==NULL) return 0;
+    if ((fd = shm_open(name, O_RDONLY, 0))<0) return 0;
+    seg = mmap(NULL, sizeof(live_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg==MAP_FAILED) return 0;
+    if (memcmp(seg->magic, LIVE_MAGIC, sizeof(seg->magic))!=0) {
+	munmap((void*)seg, sizeof(live_segment_t));
+	return 0;
+    }
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->seg = seg;
+    s->seen = 1;
+    for (i=0; i<LIVE_SLOTS; i++) {
+	s->prev[i].commits = seg->threads[i].commits;
+	s->prev[i].aborts = seg->threads[i].aborts;
+	s->prev[i].lock_waits = seg->threads[i].lock_waits;
+    }
+    return 1;
+}
+
+static void detach(segment_t *s)
+{
+    munmap((void*)s->seg, sizeof(live_segment_t));
+    s->seg = NULL;
+}
+
+/* all adaptstm segments in /dev/shm */
+static void scan()
+{
+    DIR *dir;
+    struct dirent *e;
+    char name[64];
+
+    if ((dir = opendir("/dev/shm"))==NULL) return;
+    while ((e = readdir(dir))!=NULL) {
+	if (strncmp(e->d_name, LIVE_PREFIX+1, strlen(LIVE_PREFIX)-1)!=0 || strlen(e->d_name)>=sizeof(name)-1) continue;
+	name[0] = '/';
+	strcpy(name+1, e->d_name);
+	attach(name);
+    }
+    closedir(dir);
+}
+
+static void show(segment_t *s, double secs)
+{
+    const live_segment_t *seg = s->seg;
+    counters_t sum, now;
+    uint64_t i, n = seg->nslots;
+    double abort_rate;
+    char hash[8];
+
+    if (n>LIVE_SLOTS) n = LIVE_SLOTS;
+    memset(&sum, 0x0, sizeof(sum));
+    printf("\n%-8s %s (pid %lu), lock table 2^%lu, up %lus\n", s->name, seg->comm,
+	   (unsigned long)seg->pid, (unsigned long)seg->lock_bits, (unsigned long)(time(NULL) - seg->started));
+    printf("  %4s %7s %10s %9s %6s %8s %4s %5s %6s %4s %6s %6s %6s\n", "slot", "tid",
+	   "commits/s", "aborts/s", "abort%", "waits/s", "mode", "lock", "whash", "hash", "reads", "writes", "prio");
+    for (i=0; i<n; i++) {
+	const live_thread_t *t = &seg->threads[i];
+	now.commits = t->commits;
+	now.aborts = t->aborts;
+	now.lock_waits = t->lock_waits;
+	/* a recycled descriptor keeps its counters, the deltas stay valid */
+	if (t->in_use) {
+	    uint64_t c = now.commits - s->prev[i].commits, a = now.aborts - s->prev[i].aborts;
+	    abort_rate = (c+a) ? 100.0*a/(c+a) : 0.0;
+	    if (t->adaptive_hash==LIVE_HASH_FIXED) strcpy(hash, "-");
+	    else snprintf(hash, sizeof(hash), "%u", t->adaptive_hash);
+	    printf("  %4lu %7lu %10.0f %9.0f %6.1f %8.0f %4s %5s %6lu %4s %6lu %6lu %6s\n",
+		   (unsigned long)i, (unsigned long)t->tid, c/secs, a/secs, abort_rate,
+		   (now.lock_waits - s->prev[i].lock_waits)/secs,
+		   t->readonly ? "RO" : t->writethrough ? "WT" : "WB", t->lazy ? "lazy" : "eager",
+		   (unsigned long)t->whashsize, hash, (unsigned long)t->reads, (unsigned long)t->writes,
+		   (t->priority<3) ? prio_names[t->priority] : "?");
+	}
+	sum.commits += now.commits - s->prev[i].commits;
+	sum.aborts += now.aborts - s->prev[i].aborts;
+	sum.lock_waits += now.lock_waits - s->prev[i].lock_waits;
+	s->prev[i] = now;
+    }
+    abort_rate = (sum.commits+sum.aborts) ? 100.0*sum.aborts/(sum.commits+sum.aborts) : 0.0;
+    printf("  %4s %7s %10.0f %9.0f %6.1f %8.0f\n", "all", "", sum.commits/secs, sum.aborts/secs,
+	   abort_rate, sum.lock_waits/secs);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, i, refreshes = -1, tty = isatty(1), all;
+    double delay = 1.0, secs;
+    struct timeval last, now;
+    char name[64];
+
+    while ((opt = getopt(argc, argv, "d:n:"))!=-1) {
+	switch (opt) {
+	case 'd': delay = atof(optarg); break;
+	case 'n': refreshes = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-d seconds] [-n refreshes] [pid | segment name]...\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (delay<=0) delay = 1.0;
+    all = (optind>=argc);
+    gettimeofday(&last, NULL);
+    while (refreshes!=0) {
+	for (i=0; i<MAX_SEGMENTS; i++) segments[i].seen = 0;
+	if (all) {
+	    scan();
+	} else {
+	    for (i=optind; i<argc; i++) {
+		if (argv[i][0]=='/') snprintf(name, sizeof(name), "%s", argv[i]);
+		else snprintf(name, sizeof(name), LIVE_PREFIX "%s", argv[i]);
+		attach(name);
+	    }
+	}
+	usleep(delay*1000000);
+	gettimeofday(&now, NULL);
+	secs = (now.tv_sec - last.tv_sec) + (now.tv_usec - last.tv_usec)/1000000.0;
+	last = now;
+	if (tty) printf("\033[H\033[J");
+	printf("adaptSTM live statistics, every %.1fs\n", delay);
+	for (i=0; i<MAX_SEGMENTS; i++) {
+	    segment_t *s = &segments[i];
+	    if (s->seg==NULL) continue;
+	    /* the process is gone (killed before stm_exit) or the segment was removed */
+	    if (!s->seen || (kill(s->seg->pid, 0)!=0 && errno==ESRCH)) {
+		detach(s);
+		continue;
+	    }
+	    show(s, secs);
+	}
+	fflush(stdout);
+	if (refreshes>0) refreshes--;
+    }
+    return 0;
+}
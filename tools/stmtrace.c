@@ -0,0 +1,363 @@
+/**
+ * Analyzer of the event trace (TX_TRACE, ADAPTSTM_TRACE=file)
+ * Rebuilds the timeline of every descriptor and writes it as Chrome
+ * trace JSON (chrome://tracing, Perfetto): attempts and lock waits as
+ * slices, arrows from the transaction that caused an abort. A summary
+ * on stderr shows the longest waits-for chains (who waited on whom
+ * while the owner waited itself) and abort cascades (aborts caused by
+ * a transaction whose attempt aborted as well).
+ *
+ * usage: stmtrace [-a] [-o out.json] trace
+ *   -a also writes loads, stores and lock acquisitions as instant events
+ *
+ * Copyright (c) 2010 ETH Zurich
+ *   Mathias Payer <mathias.payer@inf.ethz.ch>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adaptstm-stats.h"
+#include "adaptstm-trace.h"
+
+#define MAX_CHAIN 64
+
+typedef struct attempt {
+    uint64_t start, end;
+    int aborted;
+    int reason;
+    int other;						/* cause of the abort or TRACE_NOBODY */
+    int depth;						/* cascade length, 0: not computed, -1: in progress */
+} attempt_t;
+
+typedef struct thread {
+    trace_rec_t *recs;
+    unsigned long nrecs, maxrecs;
+    uint64_t dropped;
+    attempt_t *attempts;
+    unsigned long nattempts;
+} thread_t;
+
+/* one record of the merged timeline */
+typedef struct event {
+    uint64_t tsc;
+    int id;
+    unsigned long idx;
+} event_t;
+
+static thread_t *threads;
+static int nthreads;
+static double cycles_per_us;
+static uint64_t tsc0;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    if ((ptr = realloc(ptr, size))==NULL) {
+	perror("realloc");
+	exit(1);
+    }
+    return ptr;
+}
+
+static void read_trace(FILE *in)
+{
+    trace_header_t header;
+    trace_chunk_t chunk;
+    thread_t *t;
+
+    if (fread(&header, sizeof(header), 1, in)!=1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))!=0) {
+	fprintf(stderr, "not an adaptSTM trace\n");
+	exit(1);
+    }
+    cycles_per_us = header.tsc_khz ? header.tsc_khz/1000.0 : 1000.0;
+    while (fread(&chunk, sizeof(chunk), 1, in)==1) {
+	if (chunk.id >= TRACE_NOBODY) {
+	    fprintf(stderr, "corrupt chunk (id %u)\n", chunk.id);
+	    exit(1);
+	}
+	if ((int)chunk.id >= nthreads) {
+	    threads = xrealloc(threads, (chunk.id+1)*sizeof(thread_t));
+	    memset(&threads[nthreads], 0x0, (chunk.id+1-nthreads)*sizeof(thread_t));
+	    nthreads = chunk.id+1;
+	}
+	t = &threads[chunk.id];
+	if (t->nrecs + chunk.count > t->maxrecs) {
+	    t->maxrecs = (t->nrecs + chunk.count)*2;
+	    t->recs = xrealloc(t->recs, t->maxrecs*sizeof(trace_rec_t));
+	}
+	if (fread(&t->recs[t->nrecs], sizeof(trace_rec_t), chunk.count, in)!=chunk.count) {
+	    fprintf(stderr, "truncated trace\n");
+	    break;
+	}
+	t->nrecs += chunk.count;
+	t->dropped = chunk.dropped;
+    }
+}
+
+static double ts(uint64_t tsc)
+{
+    return (tsc - tsc0)/cycles_per_us;
+}
+
+/* the attempt of thread id that runs at tsc, NULL if none */
+static attempt_t *attempt_at(int id, uint64_t tsc)
+{
+    thread_t *t;
+    long lo = 0, hi, mid;
+
+    if (id<0 || id>=nthreads) return NULL;
+    t = &threads[id];
+    hi = (long)t->nattempts-1;
+    while (lo<=hi) {
+	mid = (lo+hi)/2;
+	if (t->attempts[mid].end < tsc) lo = mid+1;
+	else if (t->attempts[mid].start > tsc) hi = mid-1;
+	else return &t->attempts[mid];
+    }
+    return NULL;
+}
+
+/* number of aborts in the cascade that ends with a */
+static int cascade_depth(attempt_t *a)
+{
+    attempt_t *cause;
+
+    if (a->depth > 0) return a->depth;
+    if (a->depth < 0) return 1;			/* the causes form a cycle */
+    a->depth = -1;
+    cause = (a->other!=TRACE_NOBODY) ? attempt_at(a->other, a->end) : NULL;
+    a->depth = (cause!=NULL && cause!=a && cause->aborted) ? cascade_depth(cause)+1 : 1;
+    return a->depth;
+}
+
+static int cmp_event(const void *x, const void *y)
+{
+    const event_t *a = x, *b = y;
+    return (a->tsc > b->tsc) - (a->tsc < b->tsc);
+}
+
+static void emit(FILE *out, int *first, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void emit(FILE *out, int *first, const char *fmt, ...)
+{
+    va_list ap;
+
+    fputs(*first ? "\n" : ",\n", out);
+    *first = 0;
+    va_start(ap, fmt);
+    vfprintf(out, fmt, ap);
+    va_end(ap);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out = stdout;
+    int opt, all = 0, first = 1, id, i, flow = 0;
+    unsigned long n, nevents = 0, nrecs = 0, commits = 0, aborts = 0, by[STM_ABORT_REASONS];
+    unsigned long waits = 0, caused = 0, cascaded = 0, kills = 0, validations = 0, failed = 0, extensions = 0;
+    uint64_t dropped = 0, tsc1 = 0, wait_cycles = 0, wait_max = 0;
+    int longest = 0, chain[MAX_CHAIN], best[MAX_CHAIN], nbest = 0, max_cascade = 0;
+    event_t *events;
+    int *waiting_on;
+    uint64_t *wait_start;
+
+    while ((opt = getopt(argc, argv, "ao:"))!=-1) {
+	switch (opt) {
+	case 'a': all = 1; break;
+	case 'o':
+	    if ((out = fopen(optarg, "w"))==NULL) {
+		perror("fopen");
+		exit(1);
+	    }
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-a] [-o out.json] trace\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (optind>=argc) {
+	fprintf(stderr, "usage: %s [-a] [-o out.json] trace\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[optind], "r"))==NULL) {
+	perror("fopen");
+	exit(1);
+    }
+    read_trace(in);
+    fclose(in);
+    memset(by, 0x0, sizeof(by));
+
+    /* attempts of every thread */
+    tsc0 = ~0ULL;
+    for (id=0; id<nthreads; id++) {
+	thread_t *t = &threads[id];
+	uint64_t start = 0;
+	int running = 0;
+	nrecs += t->nrecs;
+	dropped += t->dropped;
+	t->attempts = xrealloc(NULL, (t->nrecs+1)*sizeof(attempt_t));
+	for (n=0; n<t->nrecs; n++) {
+	    trace_rec_t *r = &t->recs[n];
+	    if (r->tsc < tsc0) tsc0 = r->tsc;
+	    if (r->tsc > tsc1) tsc1 = r->tsc;
+	    if (r->type==TRACE_START) {
+		start = r->tsc;
+		running = 1;
+	    } else if ((r->type==TRACE_COMMIT || r->type==TRACE_ABORT) && running) {
+		attempt_t *a = &t->attempts[t->nattempts++];
+		a->start = start;
+		a->end = r->tsc;
+		a->aborted = (r->type==TRACE_ABORT);
+		a->reason = r->info;
+		a->other = (r->type==TRACE_ABORT) ? r->other : TRACE_NOBODY;
+		a->depth = 0;
+		running = 0;
+	    }
+	}
+    }
+    if (nrecs==0) {
+	fprintf(stderr, "empty trace\n");
+	return 0;
+    }
+
+    /* merge the threads into one timeline */
+    events = xrealloc(NULL, nrecs*sizeof(event_t));
+    for (id=0; id<nthreads; id++) {
+	for (n=0; n<threads[id].nrecs; n++) {
+	    events[nevents].tsc = threads[id].recs[n].tsc;
+	    events[nevents].id = id;
+	    events[nevents++].idx = n;
+	}
+    }
+    qsort(events, nevents, sizeof(event_t), cmp_event);
+    waiting_on = xrealloc(NULL, nthreads*sizeof(int));
+    wait_start = xrealloc(NULL, nthreads*sizeof(uint64_t));
+    for (id=0; id<nthreads; id++) waiting_on[id] = TRACE_NOBODY;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (id=0; id<nthreads; id++) {
+	if (threads[id].nrecs==0) continue;
+	emit(out, &first, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"tx %d\"}}", id, id);
+    }
+    for (n=0; n<nevents; n++) {
+	trace_rec_t *r = &threads[events[n].id].recs[events[n].idx];
+	attempt_t *a;
+	id = events[n].id;
+	switch (r->type) {
+	case TRACE_START:
+	    waiting_on[id] = TRACE_NOBODY;
+	    break;
+	case TRACE_COMMIT:
+	case TRACE_ABORT:
+	    waiting_on[id] = TRACE_NOBODY;
+	    if ((a = attempt_at(id, r->tsc))==NULL || a->end!=r->tsc) break;
+	    if (r->type==TRACE_COMMIT) {
+		commits++;
+		emit(out, &first, "{\"name\": \"commit\", \"cat\": \"tx\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"writes\": %u}}",
+		     id, ts(a->start), ts(a->end)-ts(a->start), r->arg);
+		break;
+	    }
+	    aborts++;
+	    if (r->info < STM_ABORT_REASONS) by[r->info]++;
+	    emit(out, &first, "{\"name\": \"abort (%s)\", \"cat\": \"tx\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"reads\": %u, \"cause\": %d}}",
+		 stm_abort_reason_name(r->info), id, ts(a->start), ts(a->end)-ts(a->start), r->arg,
+		 (r->other==TRACE_NOBODY) ? -1 : r->other);
+	    if (r->other!=TRACE_NOBODY && r->other<nthreads) {
+		caused++;
+		i = cascade_depth(a);
+		if (i>1) cascaded++;
+		if (i>max_cascade) max_cascade = i;
+		/* an arrow from the cause to the aborted attempt */
+		emit(out, &first, "{\"name\": \"caused\", \"cat\": \"abort\", \"ph\": \"s\", \"id\": %d, \"pid\": 0, \"tid\": %d, \"ts\": %.3f}",
+		     flow, r->other, ts(r->tsc));
+		emit(out, &first, "{\"name\": \"caused\", \"cat\": \"abort\", \"ph\": \"f\", \"bp\": \"e\", \"id\": %d, \"pid\": 0, \"tid\": %d, \"ts\": %.3f}",
+		     flow++, id, ts(r->tsc));
+	    }
+	    break;
+	case TRACE_WAIT: {
+	    int len = 0, next = id;
+	    waits++;
+	    waiting_on[id] = r->other;
+	    wait_start[id] = r->tsc;
+	    /* follow the waits-for chain from here */
+	    while (next!=TRACE_NOBODY && next<nthreads && len<MAX_CHAIN) {
+		for (i=0; i<len && chain[i]!=next; i++);
+		if (i<len) break;			/* a cycle */
+		chain[len++] = next;
+		next = waiting_on[next];
+	    }
+	    if (next!=TRACE_NOBODY && len<MAX_CHAIN && next>=nthreads) chain[len++] = next;
+	    if (len > longest) {
+		longest = len;
+		memcpy(best, chain, len*sizeof(int));
+		nbest = len;
+	    }
+	    break;
+	}
+	case TRACE_WAIT_END:
+	    if (waiting_on[id]==TRACE_NOBODY) break;
+	    wait_cycles += r->tsc - wait_start[id];
+	    if (r->tsc - wait_start[id] > wait_max) wait_max = r->tsc - wait_start[id];
+	    emit(out, &first, "{\"name\": \"wait\", \"cat\": \"lock\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"lock\": %u, \"owner\": %d}}",
+		 id, ts(wait_start[id]), ts(r->tsc)-ts(wait_start[id]), r->arg, waiting_on[id]);
+	    waiting_on[id] = TRACE_NOBODY;
+	    break;
+	case TRACE_VALIDATE:
+	    validations++;
+	    if (!r->info) failed++;
+	    emit(out, &first, "{\"name\": \"validate%s\", \"cat\": \"tx\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"args\": {\"reads\": %u}}",
+		 r->info ? "" : " (failed)", id, ts(r->tsc), r->arg);
+	    break;
+	case TRACE_EXTEND:
+	    extensions++;
+	    emit(out, &first, "{\"name\": \"extend\", \"cat\": \"tx\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"args\": {\"reads\": %u}}",
+		 id, ts(r->tsc), r->arg);
+	    break;
+	case TRACE_KILL:
+	    kills++;
+	    emit(out, &first, "{\"name\": \"kill\", \"cat\": \"cm\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"args\": {\"victim\": %d}}",
+		 id, ts(r->tsc), r->other);
+	    break;
+	case TRACE_LOAD:
+	case TRACE_STORE:
+	case TRACE_LOCK:
+	    if (!all) break;
+	    emit(out, &first, "{\"name\": \"%s\", \"cat\": \"access\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"args\": {\"lock\": %u}}",
+		 (r->type==TRACE_LOAD) ? "load" : (r->type==TRACE_STORE) ? "store" : "lock", id, ts(r->tsc), r->arg);
+	    break;
+	}
+    }
+    fprintf(out, "\n]}\n");
+    if (out!=stdout) fclose(out);
+
+    fprintf(stderr, "%d descriptors, %lu records (%llu dropped), %.3f ms\n", nthreads, nrecs,
+	    (unsigned long long)dropped, (tsc1-tsc0)/cycles_per_us/1000.0);
+    fprintf(stderr, "%lu commits, %lu aborts", commits, aborts);
+    for (i=0; i<STM_ABORT_REASONS; i++) if (by[i]) fprintf(stderr, " %s:%lu", stm_abort_reason_name(i), by[i]);
+    fprintf(stderr, "\n%lu validations (%lu failed), %lu extensions, %lu kills\n", validations, failed, extensions, kills);
+    fprintf(stderr, "%lu lock waits, avg %.3f us, max %.3f us\n", waits,
+	    waits ? wait_cycles/cycles_per_us/waits : 0.0, wait_max/cycles_per_us);
+    fprintf(stderr, "longest waits-for chain: %d", longest);
+    for (i=0; i<nbest; i++) fprintf(stderr, "%s%d", i ? " -> " : " (", best[i]);
+    fprintf(stderr, "%s\n", nbest ? ")" : "");
+    fprintf(stderr, "aborts caused by another tx: %lu, cascaded (the cause aborted too): %lu, longest cascade: %d\n",
+	    caused, cascaded, max_cascade);
+    return 0;
+}